@@ -4,10 +4,10 @@ bool PASS() { return true; }
 float UNITY() { return 1; }
 
 //_______________________________________________________________________________________________________
-RooUtil::Cutflow::Cutflow() : cuttree("Root"), last_active_cut(0), ofile(0), t(0), tx(0), iseventlistbooked(false), seterrorcount(0), doskipsysthist(0), dosavettreex(0), cutflow_booked(false) { cuttreemap["Root"] = &cuttree; }
+RooUtil::Cutflow::Cutflow() : cuttree("Root"), last_active_cut(0), ofile(0), t(0), tx(0), iseventlistbooked(false), seterrorcount(0), doskipsysthist(0), dosavettreex(0), cutflow_booked(false), domultiwgthist(false), dosparsehist(false), dosavepassmask(false), passmask_tree(0), doeventcache(false), iseventcachereplaying(false), doprofile(false), profile_timing(false), profile_period(100), profile_ievent(0) { cuttreemap["Root"] = &cuttree; }
 
 //_______________________________________________________________________________________________________
-RooUtil::Cutflow::Cutflow(TFile* o) : cuttree("Root"), last_active_cut(0), ofile(o), t(0), tx(0), iseventlistbooked(false), seterrorcount(0), doskipsysthist(0), dosavettreex(0), cutflow_booked(false) { cuttreemap["Root"] = &cuttree; }
+RooUtil::Cutflow::Cutflow(TFile* o) : cuttree("Root"), last_active_cut(0), ofile(o), t(0), tx(0), iseventlistbooked(false), seterrorcount(0), doskipsysthist(0), dosavettreex(0), cutflow_booked(false), domultiwgthist(false), dosparsehist(false), dosavepassmask(false), passmask_tree(0), doeventcache(false), iseventcachereplaying(false), doprofile(false), profile_timing(false), profile_period(100), profile_ievent(0) { cuttreemap["Root"] = &cuttree; }
 
 //_______________________________________________________________________________________________________
 RooUtil::Cutflow::~Cutflow()
@@ -29,56 +29,143 @@ RooUtil::Cutflow::~Cutflow()
 }
 
 //_______________________________________________________________________________________________________
-void RooUtil::Cutflow::addToCutTreeMap(TString n) { if (cuttreemap.find(n.Data()) == cuttreemap.end()) cuttreemap[n.Data()] = cuttree.getCutPointer(n); else error(TString::Format("Cut %s already exists! no duplicate cut names allowed!", n.Data())); }
+void RooUtil::Cutflow::addToCutTreeMap(TString n) { addToCutTreeMap(n, cuttree.getCutPointer(n)); }
 
 //_______________________________________________________________________________________________________
-void RooUtil::Cutflow::setLastActiveCut(TString n) { last_active_cut = cuttree.getCutPointer(n); }
+void RooUtil::Cutflow::addToCutTreeMap(TString n, CutTree* c)
+{
+    if (cuttreemap.find(n.Data()) == cuttreemap.end())
+        cuttreemap[n.Data()] = c;
+    else
+        error(TString::Format("Cut %s already exists! no duplicate cut names allowed!", n.Data()));
+    if (doprofile and !c->profile)
+        c->profile = new CutProfile(&profile_timing);
+    if (iseventlistbooked)
+        c->setEventListHandles(tx->getBranchAddress<int>("run"), tx->getBranchAddress<int>("lumi"), tx->getBranchAddress<unsigned long long>("evt"));
+}
+
+//_______________________________________________________________________________________________________
+void RooUtil::Cutflow::removeFromCutTreeMap(CutTree* c)
+{
+    for (auto& child : c->children)
+        removeFromCutTreeMap(child);
+    std::unordered_map<TREEMAPSTRING, CutTree*>::iterator it = cuttreemap.find(c->name.Data());
+    if (it != cuttreemap.end())
+        cuttreemap.erase(it);
+}
+
+//_______________________________________________________________________________________________________
+RooUtil::CutTree* RooUtil::Cutflow::getCutPointer(TString n)
+{
+    std::unordered_map<TREEMAPSTRING, CutTree*>::iterator it = cuttreemap.find(n.Data());
+    if (it == cuttreemap.end())
+    {
+        error(TString::Format("Asked for %s cut, but did not find the cut", n.Data()));
+        return 0;
+    }
+    return it->second;
+}
+
+//_______________________________________________________________________________________________________
+RooUtil::CutTree* RooUtil::Cutflow::getCutSystPointer(CutTree* cut, TString syst)
+{
+    std::map<TString, CutTree*>::iterator it = cut->systs.find(syst);
+    if (it == cut->systs.end())
+    {
+        error(TString::Format("Asked for syst=%s of the cut=%s, but did not find it! Did you actually book this syst for the cut properly using addCutSyst() ?", syst.Data(), cut->name.Data()));
+        return 0;
+    }
+    return it->second;
+}
+
+//_______________________________________________________________________________________________________
+void RooUtil::Cutflow::setLastActiveCut(TString n) { last_active_cut = getCutPointer(n); }
 
 //_______________________________________________________________________________________________________
 void RooUtil::Cutflow::printCuts() { cuttree.printCuts(); }
 
 //_______________________________________________________________________________________________________
-CutTree& RooUtil::Cutflow::getCut(TString n) { CutTree& c = cuttree.getCut(n); setLastActiveCut(n); return c; }
+RooUtil::CutTree& RooUtil::Cutflow::getCut(TString n) { last_active_cut = getCutPointer(n); return *last_active_cut; }
+
+//_______________________________________________________________________________________________________
+std::vector<TString> RooUtil::Cutflow::getCutList(TString n) { return getCutPointer(n)->getCutList(n); }
+
+//_______________________________________________________________________________________________________
+std::vector<TString> RooUtil::Cutflow::getCutListBelow(TString n) { return getCutPointer(n)->getCutListBelow(n); }
 
 #ifdef USE_CUTLAMBDA
 //_______________________________________________________________________________________________________
 void RooUtil::Cutflow::addCut(TString n, std::function<bool()> cut, std::function<float()> weight)
 {
-    cuttree.addCut(n);
-    addToCutTreeMap(n);
-    setLastActiveCut(n);
-    setCut(n, cut, weight);
+    CutTree* c = cuttree.addCut(n);
+    addToCutTreeMap(n, c);
+    last_active_cut = c;
+    setCut(c, cut, weight);
 }
 
 //_______________________________________________________________________________________________________
 void RooUtil::Cutflow::addCutToLastActiveCut(TString n, std::function<bool()> cut, std::function<float()> weight)
 {
-    last_active_cut->addCut(n);
-    addToCutTreeMap(n);
-    setLastActiveCut(n);
-    setCut(n, cut, weight);
+    CutTree* c = last_active_cut->addCut(n);
+    addToCutTreeMap(n, c);
+    last_active_cut = c;
+    setCut(c, cut, weight);
 }
 
 #else
 
 //_______________________________________________________________________________________________________
-void RooUtil::Cutflow::addCut(TString n) { cuttree.addCut(n); addToCutTreeMap(n); setLastActiveCut(n); }
+void RooUtil::Cutflow::addCut(TString n) { CutTree* c = cuttree.addCut(n); addToCutTreeMap(n, c); last_active_cut = c; }
 
 //_______________________________________________________________________________________________________
-void RooUtil::Cutflow::addCutToLastActiveCut(TString n) { last_active_cut->addCut(n); addToCutTreeMap(n); setLastActiveCut(n); }
+void RooUtil::Cutflow::addCutToLastActiveCut(TString n) { CutTree* c = last_active_cut->addCut(n); addToCutTreeMap(n, c); last_active_cut = c; }
 
 #endif
 
 //_______________________________________________________________________________________________________
-void RooUtil::Cutflow::removeCut(TString n)
+void RooUtil::Cutflow::copyAndEditCuts(TString n, std::map<TString, TString> replacements)
+{
+    // Copies the cut "n" and all the cuts below it, and attaches the copy to the parent of "n"
+    // The names of the copies are edited by replacing each key of "replacements" by its value
+    // e.g. copyAndEditCuts("SRSSee", {{"SR", "CR"}}) creates "CRSSee" (and its children) right next to "SRSSee"
+    // N.B. The cut syst variations are not copied
+    CutTree* c = getCutPointer(n);
+    if (!c->parent)
+        error("copyAndEditCuts():: cannot copy the Root cut");
+    last_active_cut = copyCutTree(c, c->parent, replacements);
+}
+
+//_______________________________________________________________________________________________________
+RooUtil::CutTree* RooUtil::Cutflow::copyCutTree(CutTree* c, CutTree* parent, std::map<TString, TString>& replacements)
 {
-    CutTree* c = cuttree.getCutPointer(n);
+    TString n = c->name;
+    for (auto& replacement : replacements)
+        n.ReplaceAll(replacement.first, replacement.second);
+    CutTree* copy = parent->addCut(n);
+    addToCutTreeMap(n, copy);
+    copy->pass_this_cut = c->pass_this_cut;
+    copy->weight_this_cut = c->weight_this_cut;
+    copy->pass_this_cut_func = c->pass_this_cut_func;
+    copy->weight_this_cut_func = c->weight_this_cut_func;
     for (auto& child : c->children)
+        copyCutTree(child, copy, replacements);
+    return copy;
+}
+
+//_______________________________________________________________________________________________________
+void RooUtil::Cutflow::removeCut(TString n)
+{
+    CutTree* c = getCutPointer(n);
+    c->parent->children.erase(std::find(c->parent->children.begin(), c->parent->children.end(), c));
+    // A cut added with addCuts() leaves its chain together with the chained cuts below it, so that the head no longer evaluates them
+    if (c->typed_chain)
     {
-        removeCut(child->name);
+        std::vector<CutTree*>& nodes = c->typed_chain->nodes;
+        nodes.erase(std::find(nodes.begin(), nodes.end(), c), nodes.end());
     }
-    c->parent->children.erase(std::find(c->parent->children.begin(), c->parent->children.end(), c));
-    cuttreemap.erase(cuttreemap.find(n.Data()));
+    removeFromCutTreeMap(c);
+    if (last_active_cut == c)
+        last_active_cut = c->parent;
 }
 
 //_______________________________________________________________________________________________________
@@ -88,7 +175,7 @@ void RooUtil::Cutflow::filterCuts(std::vector<TString> ns)
     std::vector<TString> to_not_remove;
     for (auto& n : ns)
     {
-        std::vector<TString> cutlist = cuttree.getCutList(n);
+        std::vector<TString> cutlist = getCutList(n);
         for (auto& cut : cutlist)
         {
             to_not_remove.push_back(cut);
@@ -97,10 +184,10 @@ void RooUtil::Cutflow::filterCuts(std::vector<TString> ns)
 
     for (auto& n : ns)
     {
-        std::vector<TString> cutlist = cuttree.getCutList(n);
+        std::vector<TString> cutlist = getCutList(n);
         for (unsigned int i = 0; i < cutlist.size() - 1; ++i)
         {
-            CutTree* cut = cuttree.getCutPointer(cutlist[i]);
+            CutTree* cut = getCutPointer(cutlist[i]);
             std::vector<CutTree*> toremove;
             for (auto& child : cut->children)
             {
@@ -113,7 +200,7 @@ void RooUtil::Cutflow::filterCuts(std::vector<TString> ns)
             for (auto& child : toremove)
             {
                 cut->children.erase(std::find(cut->children.begin(), cut->children.end(), child));
-                cuttreemap.erase(cuttreemap.find(child->name.Data()));
+                removeFromCutTreeMap(child);
             }
         }
     }
@@ -124,7 +211,7 @@ void RooUtil::Cutflow::setCutLists(std::vector<TString> regions)
 {
     for (auto& region : regions)
     {
-        cutlists[region] = cuttree.getCutList(region);
+        cutlists[region] = getCutList(region);
 //        std::cout << region << std::endl;
 //        for (auto& cutname : cutlists[region])
 //            std::cout << cutname << std::endl;
@@ -133,7 +220,7 @@ void RooUtil::Cutflow::setCutLists(std::vector<TString> regions)
     {
         for (auto& cutname : cutlists[region])
         {
-            cuttreelists[region].push_back(cuttreemap[cutname.Data()]);
+            cuttreelists[region].push_back(getCutPointer(cutname));
         }
     }
 }
@@ -161,9 +248,37 @@ void RooUtil::Cutflow::bookCutflowTree()
     }
     RooUtil::CutflowUtil::createCutflowBranches(cutlists, *tx);
     createWgtSystBranches();
+    bindCutHandles();
 //    t->Print();
 }
 
+//_______________________________________________________________________________________________________
+void RooUtil::Cutflow::bindCutHandles()
+{
+#ifdef USE_TTREEX
+    // Resolve the pass/weight branches of every cut (and cut systematic) once, so that setCut(CutTree*, ...) and
+    // setCutSyst(CutTree*, ...) set them through handles instead of looking them up by name for every event
+    for (auto& pair : cuttreemap)
+    {
+        CutTree* cut = pair.second;
+        TString name = pair.first.c_str();
+        if (tx->hasBranch<bool>(name) and tx->hasBranch<float>(name+"_weight"))
+        {
+            cut->pass_handle = tx->getHandle<bool>(name);
+            cut->weight_handle = tx->getHandle<float>(name+"_weight");
+        }
+        for (auto& syst : cut->systs)
+        {
+            if (tx->hasBranch<bool>(name+syst.first) and tx->hasBranch<float>(name+syst.first+"_weight"))
+            {
+                syst.second->pass_handle = tx->getHandle<bool>(name+syst.first);
+                syst.second->weight_handle = tx->getHandle<float>(name+syst.first+"_weight");
+            }
+        }
+    }
+#endif
+}
+
 //_______________________________________________________________________________________________________
 void RooUtil::Cutflow::bookCutflowHistograms()
 {
@@ -291,6 +406,8 @@ void RooUtil::Cutflow::bookCutflowsForRegions(std::vector<TString> regions)
     setCutLists(regions);
     bookCutflowTree();
     bookCutflowHistograms();
+    if (dosavepassmask)
+        bookPassMasks();
 }
 
 //_______________________________________________________________________________________________________
@@ -300,6 +417,8 @@ void RooUtil::Cutflow::bookCutflows()
     setCutLists(regions);
     bookCutflowTree();
     bookCutflowHistograms();
+    if (dosavepassmask)
+        bookPassMasks();
 }
 
 //_______________________________________________________________________________________________________
@@ -308,6 +427,7 @@ void RooUtil::Cutflow::saveOutput()
     saveCutflows();
     saveHistograms();
     saveTTreeX();
+    savePassMasks();
     TString filename = ofile->GetName();
     TString msg = "Wrote output to " + filename;
     print(msg);
@@ -324,13 +444,71 @@ void RooUtil::Cutflow::saveCutflows()
 //_______________________________________________________________________________________________________
 void RooUtil::Cutflow::saveHistograms()
 {
+    flushWgtVarHistograms();
     ofile->cd();
+    if (dosparsehist)
+    {
+        saveSparseHistograms();
+        return;
+    }
     for (auto& pair : booked_histograms)
         pair.second->Write();
     for (auto& pair : booked_2dhistograms)
         pair.second->Write();
 }
 
+//_______________________________________________________________________________________________________
+void RooUtil::Cutflow::saveSparseHistograms()
+{
+    // Only the histograms that were filled are written out (converted to regular histograms one at a time)
+    int nwritten = 0;
+    int nempty = 0;
+    for (auto& pair : booked_histograms)
+    {
+        SparseHist1D* sh = dynamic_cast<SparseHist1D*>(pair.second);
+        if (!sh) { pair.second->Write(); nwritten++; continue; }
+        if (sh->isEmpty()) { nempty++; continue; }
+        THist* h = sh->toDense();
+        h->Write();
+        delete h;
+        nwritten++;
+    }
+    for (auto& pair : booked_2dhistograms)
+    {
+        SparseHist2D* sh = dynamic_cast<SparseHist2D*>(pair.second);
+        if (!sh) { pair.second->Write(); nwritten++; continue; }
+        if (sh->isEmpty()) { nempty++; continue; }
+        TH2F* h = sh->toDense();
+        h->Write();
+        delete h;
+        nwritten++;
+    }
+    print(TString::Format("Cutflow::saveSparseHistograms() wrote %d histograms (skipped %d empty histograms)", nwritten, nempty));
+}
+
+//_______________________________________________________________________________________________________
+void RooUtil::Cutflow::savePassMasks()
+{
+    if (dosavepassmask and passmask_tree)
+    {
+        ofile->cd();
+        TTree* cuttable = new TTree("PassMaskCuts", "PassMaskCuts");
+        std::string name;
+        int parent;
+        cuttable->Branch("name", &name);
+        cuttable->Branch("parent", &parent);
+        for (unsigned int i = 0; i < passmask_names.size(); ++i)
+        {
+            name = passmask_names[i].Data();
+            parent = passmask_parents[i];
+            cuttable->Fill();
+        }
+        cuttable->Write();
+        delete cuttable;
+        passmask_tree->Write();
+    }
+}
+
 //_______________________________________________________________________________________________________
 void RooUtil::Cutflow::saveTTreeX()
 {
@@ -345,19 +523,31 @@ void RooUtil::Cutflow::saveTTreeX()
 //_______________________________________________________________________________________________________
 void RooUtil::Cutflow::setCut(TString cutname, std::function<bool()> pass, std::function<float()> weight)
 {
-    cuttreemap[cutname.Data()]->pass_this_cut_func = pass;
-    cuttreemap[cutname.Data()]->weight_this_cut_func = weight;
+    setCut(getCutPointer(cutname), pass, weight);
 }
 
 //_______________________________________________________________________________________________________
 void RooUtil::Cutflow::setCutSyst(TString cutname, TString syst, std::function<bool()> pass, std::function<float()> weight)
 {
-    if (cuttreemap[cutname.Data()]->systs.find(syst) == cuttreemap[cutname.Data()]->systs.end())
+    setCutSyst(getCutPointer(cutname), syst, pass, weight);
+}
+
+//_______________________________________________________________________________________________________
+void RooUtil::Cutflow::setCut(CutTree* cut, std::function<bool()> pass, std::function<float()> weight)
+{
+    cut->pass_this_cut_func = pass;
+    cut->weight_this_cut_func = weight;
+}
+
+//_______________________________________________________________________________________________________
+void RooUtil::Cutflow::setCutSyst(CutTree* cut, TString syst, std::function<bool()> pass, std::function<float()> weight)
+{
+    if (cut->systs.find(syst) == cut->systs.end())
     {
-        error(TString::Format("setCutSyst():: Did not find syst=%s from the cut=%s! Did you actually book this syst for the cut properly using addCutSyst() ?", syst.Data(), cutname.Data()));
+        error(TString::Format("setCutSyst():: Did not find syst=%s from the cut=%s! Did you actually book this syst for the cut properly using addCutSyst() ?", syst.Data(), cut->name.Data()));
     }
-    cuttreemap[cutname.Data()]->systs[syst]->pass_this_cut_func = pass;
-    cuttreemap[cutname.Data()]->systs[syst]->weight_this_cut_func = weight;
+    cut->systs[syst]->pass_this_cut_func = pass;
+    cut->systs[syst]->weight_this_cut_func = weight;
 }
 
 #else
@@ -376,12 +566,29 @@ void RooUtil::Cutflow::setCut(TString cutname, bool pass, float weight)
     tx->setBranch<bool>(cutname, pass, false, true);
     tx->setBranch<float>(cutname+"_weight", weight, false, true);
 #else
-    cuttreemap[cutname.Data()]->pass_this_cut = pass;
-    cuttreemap[cutname.Data()]->weight_this_cut = weight;
+    setCut(getCutPointer(cutname), pass, weight);
 #endif
 
 }
 
+//_______________________________________________________________________________________________________
+void RooUtil::Cutflow::setCut(CutTree* cut, bool pass, float weight)
+{
+    // Per-event setter with the cut handle obtained via getCutPointer() (i.e. no name lookup)
+#ifdef USE_TTREEX
+    if (!cut->pass_handle.valid())
+    {
+        setCut(cut->name, pass, weight); // not booked yet (or no such branch), reports the error if any
+        return;
+    }
+    cut->pass_handle.set(pass);
+    cut->weight_handle.set(weight);
+#else
+    cut->pass_this_cut = pass;
+    cut->weight_this_cut = weight;
+#endif
+}
+
 //_______________________________________________________________________________________________________
 void RooUtil::Cutflow::setCutSyst(TString cutname, TString syst, bool pass, float weight)
 {
@@ -395,11 +602,24 @@ void RooUtil::Cutflow::setCutSyst(TString cutname, TString syst, bool pass, floa
     tx->setBranch<bool>(cutname+syst, pass, false, true);
     tx->setBranch<float>(cutname+syst+"_weight", weight, false, true);
 #else
-    cuttreemap[cutname.Data()]->systs[syst]->pass_this_cut = pass;
-    cuttreemap[cutname.Data()]->systs[syst]->weight_this_cut = weight;
+    setCutSyst(getCutPointer(cutname), syst, pass, weight);
 #endif
 }
 
+//_______________________________________________________________________________________________________
+void RooUtil::Cutflow::setCutSyst(CutTree* cut, TString syst, bool pass, float weight)
+{
+    // Looks the syst up by name. For no lookup at all, set the handle obtained via getCutSystPointer() with setCut(CutTree*, ...)
+    std::map<TString, CutTree*>::iterator it = cut->systs.find(syst);
+    if (it == cut->systs.end())
+    {
+        TString msg = "Did not find syst=" + syst + " for the cut=" + cut->name + ", setCutSyst() for " + cut->name + ", " + syst;
+        printSetFunctionError(msg);
+        return;
+    }
+    setCut(it->second, pass, weight);
+}
+
 #endif // USE_CUTLAMBDA
 
 //_______________________________________________________________________________________________________
@@ -483,9 +703,105 @@ void RooUtil::Cutflow::bookEventLists()
         tx->createBranch<int>("lumi");
     if (!tx->hasBranch<unsigned long long>("evt"))
         tx->createBranch<unsigned long long>("evt");
+    // Resolve the event id variables once so that the cuts only copy the values of the passing events
+    cuttree.setEventListHandles(tx->getBranchAddress<int>("run"), tx->getBranchAddress<int>("lumi"), tx->getBranchAddress<unsigned long long>("evt"));
     iseventlistbooked = true;
 }
 
+//_______________________________________________________________________________________________________
+void RooUtil::Cutflow::writeEventLists(TString ofilename)
+{
+    if (ofilename.EndsWith(".root"))
+    {
+        TDirectory* olddir = gDirectory;
+        TFile* f = new TFile(ofilename, "recreate");
+        for (auto& pair : cuttreemap)
+            pair.second->eventlist.writeTTree(pair.first.c_str());
+        f->Close();
+        delete f;
+        olddir->cd();
+    }
+    else
+    {
+        for (auto& pair : cuttreemap)
+        {
+            if (pair.second->eventlist.size() > 0)
+                pair.second->writeEventListBinary(TString::Format("%s%s.bin", ofilename.Data(), pair.first.c_str()));
+        }
+    }
+}
+
+//_______________________________________________________________________________________________________
+void RooUtil::Cutflow::bookPassMasks()
+{
+    // Booked once per recorded sample. e.g. rebookCutflows() after editing the cuts (for replayEventCache()) keeps the masks
+    // and the cut table they were recorded with, and stops filling masks for the edited cut tree.
+    if (passmask_tree and passmask_tree->GetEntries() > 0)
+    {
+        warning("bookPassMasks():: pass masks were already recorded for the previous cut tree, keeping them and not recording the new one");
+        passmask_cuts.clear();
+        return;
+    }
+
+    // Topological order (depth first) so that a parent always comes before its children
+    passmask_cuts.clear();
+    std::vector<CutTree*> stack = {&cuttree};
+    while (stack.size() > 0)
+    {
+        CutTree* c = stack.back();
+        stack.pop_back();
+        passmask_cuts.push_back(c);
+        for (auto it = c->children.rbegin(); it != c->children.rend(); ++it)
+            stack.push_back(*it);
+    }
+    std::map<CutTree*, int> cutidx;
+    for (unsigned int i = 0; i < passmask_cuts.size(); ++i)
+        cutidx[passmask_cuts[i]] = i;
+
+    // The table of cuts (written out by savePassMasks())
+    passmask_names.clear();
+    passmask_parents.clear();
+    for (auto& c : passmask_cuts)
+    {
+        passmask_names.push_back(c->name);
+        passmask_parents.push_back(c->parent ? cutidx[c->parent] : -1);
+    }
+
+    passmask.resize((passmask_cuts.size() + 31) / 32);
+    if (passmask_tree)
+        delete passmask_tree;
+    ofile->cd();
+    passmask_tree = new TTree("PassMask", "PassMask");
+    passmask_tree->Branch("passmask", &passmask);
+    passmask_tree->Branch("wgtidx", &passmask_wgtidx);
+    passmask_tree->Branch("wgtval", &passmask_wgtval);
+    print(TString::Format("Booked pass mask output for %zu cuts", passmask_cuts.size()));
+}
+
+//_______________________________________________________________________________________________________
+void RooUtil::Cutflow::fillPassMasks()
+{
+    if (passmask_cuts.size() == 0)
+        return;
+    std::fill(passmask.begin(), passmask.end(), 0);
+    passmask_wgtidx.clear();
+    passmask_wgtval.clear();
+    for (unsigned int i = 0; i < passmask_cuts.size(); ++i)
+    {
+        CutTree* c = passmask_cuts[i];
+        if (!c->pass)
+            continue;
+        passmask[i / 32] |= 1u << (i % 32);
+        float parentweight = c->parent ? c->parent->weight : 1;
+        if (c->weight != parentweight)
+        {
+            passmask_wgtidx.push_back(i);
+            passmask_wgtval.push_back(c->weight);
+        }
+    }
+    passmask_tree->Fill();
+}
+
 //_______________________________________________________________________________________________________
 void RooUtil::Cutflow::fill()
 {
@@ -499,31 +815,51 @@ void RooUtil::Cutflow::fill()
     tx->setBranch<bool>("Root", 1); // Root is internally set
     tx->setBranch<float>("Root_weight", 1); // Root is internally set
 #else
-    cuttreemap["Root"]->pass_this_cut = 1;
-    cuttreemap["Root"]->weight_this_cut = 1;
+    cuttree.pass_this_cut = 1;
+    cuttree.weight_this_cut = 1;
 #endif
 
+    // Sample one event every profile_period for timing
+    if (doprofile)
+        profile_timing = (profile_ievent++ % profile_period == 0);
+
+    // Record the inputs of the cut tree (when replaying, the inputs were loaded from the cache instead)
+    if (doeventcache and not iseventcachereplaying)
+        eventcache.record();
+
     // Evaluate nominal selection cutflows (the non cut varying selections)
-    cuttree.evaluate(*tx, "", iseventlistbooked);
+    cuttree.evaluate(*tx, "", iseventlistbooked and not iseventcachereplaying);
 
     // Nominal cutflow
     fillCutflows();
 
+    // Compact per-event record of the nominal selection (the replayed events were already recorded)
+    if (dosavepassmask and not iseventcachereplaying)
+        fillPassMasks();
+
     // Wgt systematic variations
     for (auto& syst : systs) fillCutflows(syst);
 
-    // Fill nominal histograms
-    fillHistograms();
-
-    if (not doskipsysthist)
+    if (domultiwgthist and not doskipsysthist)
     {
-        // Wgt systematic variations
-        for (auto& syst : systs) fillHistograms(syst);
+        // Fill nominal histograms along with all the wgt systematic variations in one pass
+        fillHistogramsWithWgtVariations();
+    }
+    else
+    {
+        // Fill nominal histograms
+        fillHistograms();
+
+        if (not doskipsysthist)
+        {
+            // Wgt systematic variations
+            for (auto& syst : systs) fillHistograms(syst);
+        }
     }
 
     for (auto& cutsyst : cutsysts)
     {
-        cuttree.evaluate(*tx, cutsyst, iseventlistbooked);
+        cuttree.evaluate(*tx, cutsyst, iseventlistbooked and not iseventcachereplaying);
         fillCutflows(cutsyst, false);
         if (not doskipsysthist)
             fillHistograms(cutsyst, false);
@@ -531,7 +867,8 @@ void RooUtil::Cutflow::fill()
 
     if (tx)
     {
-        if (dosavettreex)
+        // The replayed events were already written out when they were recorded
+        if (dosavettreex and not iseventcachereplaying)
             tx->fill();
 
         tx->clear();
@@ -692,13 +1029,75 @@ void RooUtil::Cutflow::fillHistograms(TString syst, bool iswgtsyst)
 //    }
 }
 
+//_______________________________________________________________________________________________________
+void RooUtil::Cutflow::fillHistogramsWithWgtVariations()
+{
+#ifdef USE_CUTLAMBDA
+    // Evaluate the wgt systematics once per event and let the nominal histograms accumulate all the variations
+    wgtsyst_values.resize(systs.size());
+    for (unsigned int i = 0; i < systs.size(); ++i)
+        wgtsyst_values[i] = systs_funcs[systs[i]]();
+    cuttree.fillHistograms("", 1, &wgtsyst_values);
+#else
+    error("fillHistogramsWithWgtVariations():: multi-weight histogram filling is only supported with USE_CUTLAMBDA");
+#endif
+}
+
+//_______________________________________________________________________________________________________
+bool RooUtil::Cutflow::bookWgtVarHistogram(TString cut, TString syst, TString varname, TString varnamey)
+{
+    // Returns true if the histogram was attached to its nominal counterpart as a wgt variation (i.e. it should not be filled on its own)
+    if (not domultiwgthist or syst.IsNull())
+        return false;
+    std::vector<TString>::iterator it = std::find(systs.begin(), systs.end(), syst);
+    if (it == systs.end())
+        return false;
+#ifdef USE_CUTLAMBDA
+    TH1* hnominal = 0;
+    TH1* hvar = 0;
+    if (varnamey.IsNull())
+    {
+        auto nominal_it = booked_histograms.find(std::make_tuple(cut.Data(), "", varname.Data()));
+        if (nominal_it != booked_histograms.end())
+            hnominal = nominal_it->second;
+        hvar = booked_histograms[std::make_tuple(cut.Data(), syst.Data(), varname.Data())];
+    }
+    else
+    {
+        auto nominal_it = booked_2dhistograms.find(std::make_tuple(cut.Data(), "", varname.Data(), varnamey.Data()));
+        if (nominal_it != booked_2dhistograms.end())
+            hnominal = nominal_it->second;
+        hvar = booked_2dhistograms[std::make_tuple(cut.Data(), syst.Data(), varname.Data(), varnamey.Data())];
+    }
+    if (!hnominal)
+    {
+        error(TString::Format("bookWgtVarHistogram():: cut=%s, syst=%s, varname=%s, varnamey=%s nominal histogram must be booked before its wgt variations!", cut.Data(), syst.Data(), varname.Data(), varnamey.Data()));
+        return false;
+    }
+    WgtVarHist* wvh = getCutPointer(cut)->addWgtVarHist(hnominal, hvar, it - systs.begin());
+    if (wvh and wvh->variations.size() == 1) // i.e. newly created
+        wgtvar_histograms.push_back(wvh);
+    return true;
+#else
+    error("bookWgtVarHistogram():: multi-weight histogram filling is only supported with USE_CUTLAMBDA");
+    return false;
+#endif
+}
+
+//_______________________________________________________________________________________________________
+void RooUtil::Cutflow::flushWgtVarHistograms()
+{
+    for (auto& wvh : wgtvar_histograms)
+        wvh->flush();
+}
+
 //_______________________________________________________________________________________________________
 void RooUtil::Cutflow::bookHistograms(Histograms& histograms)
 {
     std::vector<TString> regions = cuttree.getEndCuts();
     for (auto& region : regions)
     {
-        std::vector<TString> cutlist = cuttree.getCutList(region);
+        std::vector<TString> cutlist = getCutList(region);
         bookHistograms(histograms, cutlist);
     }
 }
@@ -733,14 +1132,15 @@ void RooUtil::Cutflow::bookHistogram(TString cut, std::pair<TString, std::tuple<
     }
     if (booked_histograms.find(std::make_tuple(cut.Data(), syst.Data(), varname.Data())) == booked_histograms.end())
     {
-        booked_histograms[std::make_tuple(cut.Data(), syst.Data(), varname.Data())] = new THist(histname, "", nbin, min, max);
+        booked_histograms[std::make_tuple(cut.Data(), syst.Data(), varname.Data())] = dosparsehist ? new SparseHist1D(histname, nbin, min, max) : new THist(histname, "", nbin, min, max);
         booked_histograms[std::make_tuple(cut.Data(), syst.Data(), varname.Data())]->SetDirectory(0);
         booked_histograms[std::make_tuple(cut.Data(), syst.Data(), varname.Data())]->Sumw2();
         if (syst.IsNull())
         {
             booked_histograms_nominal_keys.push_back(std::make_tuple(cut.Data(), syst.Data(), varname.Data()));
         }
-        cuttreemap[cut.Data()]->addHist1D(booked_histograms[std::make_tuple(cut.Data(), syst.Data(), varname.Data())], vardef, syst);
+        if (!bookWgtVarHistogram(cut, syst, varname))
+            getCutPointer(cut)->addHist1D(booked_histograms[std::make_tuple(cut.Data(), syst.Data(), varname.Data())], vardef, syst);
     }
 }
 
@@ -765,14 +1165,15 @@ void RooUtil::Cutflow::bookVecHistogram(TString cut, std::pair<TString, std::tup
     }
     if (booked_histograms.find(std::make_tuple(cut.Data(), syst.Data(), varname.Data())) == booked_histograms.end())
     {
-        booked_histograms[std::make_tuple(cut.Data(), syst.Data(), varname.Data())] = new THist(histname, "", nbin, min, max);
+        booked_histograms[std::make_tuple(cut.Data(), syst.Data(), varname.Data())] = dosparsehist ? new SparseHist1D(histname, nbin, min, max) : new THist(histname, "", nbin, min, max);
         booked_histograms[std::make_tuple(cut.Data(), syst.Data(), varname.Data())]->SetDirectory(0);
         booked_histograms[std::make_tuple(cut.Data(), syst.Data(), varname.Data())]->Sumw2();
         if (syst.IsNull())
         {
             booked_histograms_nominal_keys.push_back(std::make_tuple(cut.Data(), syst.Data(), varname.Data()));
         }
-        cuttreemap[cut.Data()]->addHist1DVec(booked_histograms[std::make_tuple(cut.Data(), syst.Data(), varname.Data())], vardef, wgtdef, syst);
+        if (!bookWgtVarHistogram(cut, syst, varname))
+            getCutPointer(cut)->addHist1DVec(booked_histograms[std::make_tuple(cut.Data(), syst.Data(), varname.Data())], vardef, wgtdef, syst);
     }
 }
 
@@ -797,14 +1198,15 @@ void RooUtil::Cutflow::bookHistogram(TString cut, std::pair<TString, std::tuple<
         Float_t bounds[boundaries.size()];
         for (unsigned int i = 0; i < boundaries.size(); ++i)
             bounds[i] = boundaries[i];
-        booked_histograms[std::make_tuple(cut.Data(), syst.Data(), varname.Data())] = new THist(histname, "", boundaries.size()-1, bounds);
+        booked_histograms[std::make_tuple(cut.Data(), syst.Data(), varname.Data())] = dosparsehist ? new SparseHist1D(histname, boundaries.size()-1, bounds) : new THist(histname, "", boundaries.size()-1, bounds);
         booked_histograms[std::make_tuple(cut.Data(), syst.Data(), varname.Data())]->SetDirectory(0);
         booked_histograms[std::make_tuple(cut.Data(), syst.Data(), varname.Data())]->Sumw2();
         if (syst.IsNull())
         {
             booked_histograms_nominal_keys.push_back(std::make_tuple(cut.Data(), syst.Data(), varname.Data()));
         }
-        cuttreemap[cut.Data()]->addHist1D(booked_histograms[std::make_tuple(cut.Data(), syst.Data(), varname.Data())], vardef, syst);
+        if (!bookWgtVarHistogram(cut, syst, varname))
+            getCutPointer(cut)->addHist1D(booked_histograms[std::make_tuple(cut.Data(), syst.Data(), varname.Data())], vardef, syst);
     }
 }
 
@@ -830,14 +1232,15 @@ void RooUtil::Cutflow::bookVecHistogram(TString cut, std::pair<TString, std::tup
         Float_t bounds[boundaries.size()];
         for (unsigned int i = 0; i < boundaries.size(); ++i)
             bounds[i] = boundaries[i];
-        booked_histograms[std::make_tuple(cut.Data(), syst.Data(), varname.Data())] = new THist(histname, "", boundaries.size()-1, bounds);
+        booked_histograms[std::make_tuple(cut.Data(), syst.Data(), varname.Data())] = dosparsehist ? new SparseHist1D(histname, boundaries.size()-1, bounds) : new THist(histname, "", boundaries.size()-1, bounds);
         booked_histograms[std::make_tuple(cut.Data(), syst.Data(), varname.Data())]->SetDirectory(0);
         booked_histograms[std::make_tuple(cut.Data(), syst.Data(), varname.Data())]->Sumw2();
         if (syst.IsNull())
         {
             booked_histograms_nominal_keys.push_back(std::make_tuple(cut.Data(), syst.Data(), varname.Data()));
         }
-        cuttreemap[cut.Data()]->addHist1DVec(booked_histograms[std::make_tuple(cut.Data(), syst.Data(), varname.Data())], vardef, wgtdef, syst);
+        if (!bookWgtVarHistogram(cut, syst, varname))
+            getCutPointer(cut)->addHist1DVec(booked_histograms[std::make_tuple(cut.Data(), syst.Data(), varname.Data())], vardef, wgtdef, syst);
     }
 }
 
@@ -866,14 +1269,15 @@ void RooUtil::Cutflow::book2DHistogram(TString cut, std::pair<std::pair<TString,
     }
     if (booked_2dhistograms.find(std::make_tuple(cut.Data(), syst.Data(), varname.Data(), varnamey.Data())) == booked_2dhistograms.end())
     {
-        booked_2dhistograms[std::make_tuple(cut.Data(), syst.Data(), varname.Data(), varnamey.Data())] = new TH2F(histname, "", nbin, min, max, nbiny, miny, maxy);
+        booked_2dhistograms[std::make_tuple(cut.Data(), syst.Data(), varname.Data(), varnamey.Data())] = dosparsehist ? new SparseHist2D(histname, nbin, min, max, nbiny, miny, maxy) : new TH2F(histname, "", nbin, min, max, nbiny, miny, maxy);
         booked_2dhistograms[std::make_tuple(cut.Data(), syst.Data(), varname.Data(), varnamey.Data())]->SetDirectory(0);
         booked_2dhistograms[std::make_tuple(cut.Data(), syst.Data(), varname.Data(), varnamey.Data())]->Sumw2();
         if (syst.IsNull())
         {
             booked_2dhistograms_nominal_keys.push_back(std::make_tuple(cut.Data(), syst.Data(), varname.Data(), varnamey.Data()));
         }
-        cuttreemap[cut.Data()]->addHist2D(booked_2dhistograms[std::make_tuple(cut.Data(), syst.Data(), varname.Data(), varnamey.Data())], varxdef, varydef, syst);
+        if (!bookWgtVarHistogram(cut, syst, varname, varnamey))
+            getCutPointer(cut)->addHist2D(booked_2dhistograms[std::make_tuple(cut.Data(), syst.Data(), varname.Data(), varnamey.Data())], varxdef, varydef, syst);
     }
 }
 
@@ -903,14 +1307,15 @@ void RooUtil::Cutflow::book2DVecHistogram(TString cut, std::pair<std::pair<TStri
     }
     if (booked_2dhistograms.find(std::make_tuple(cut.Data(), syst.Data(), varname.Data(), varnamey.Data())) == booked_2dhistograms.end())
     {
-        booked_2dhistograms[std::make_tuple(cut.Data(), syst.Data(), varname.Data(), varnamey.Data())] = new TH2F(histname, "", nbin, min, max, nbiny, miny, maxy);
+        booked_2dhistograms[std::make_tuple(cut.Data(), syst.Data(), varname.Data(), varnamey.Data())] = dosparsehist ? new SparseHist2D(histname, nbin, min, max, nbiny, miny, maxy) : new TH2F(histname, "", nbin, min, max, nbiny, miny, maxy);
         booked_2dhistograms[std::make_tuple(cut.Data(), syst.Data(), varname.Data(), varnamey.Data())]->SetDirectory(0);
         booked_2dhistograms[std::make_tuple(cut.Data(), syst.Data(), varname.Data(), varnamey.Data())]->Sumw2();
         if (syst.IsNull())
         {
             booked_2dhistograms_nominal_keys.push_back(std::make_tuple(cut.Data(), syst.Data(), varname.Data(), varnamey.Data()));
         }
-        cuttreemap[cut.Data()]->addHist2DVec(booked_2dhistograms[std::make_tuple(cut.Data(), syst.Data(), varname.Data(), varnamey.Data())], varxdef, varydef, elemwgt, syst);
+        if (!bookWgtVarHistogram(cut, syst, varname, varnamey))
+            getCutPointer(cut)->addHist2DVec(booked_2dhistograms[std::make_tuple(cut.Data(), syst.Data(), varname.Data(), varnamey.Data())], varxdef, varydef, elemwgt, syst);
     }
 }
 //_______________________________________________________________________________________________________
@@ -940,14 +1345,15 @@ void RooUtil::Cutflow::book2DVecHistogram(TString cut, std::pair<std::pair<TStri
         Double_t xbounds[xboundaries.size()];
         for (unsigned int i = 0; i < xboundaries.size(); ++i)
             xbounds[i] = xboundaries[i];
-        booked_2dhistograms[std::make_tuple(cut.Data(), syst.Data(), varname.Data(), varnamey.Data())] = new TH2F(histname, "", xboundaries.size() - 1, xbounds, nbiny, miny, maxy);
+        booked_2dhistograms[std::make_tuple(cut.Data(), syst.Data(), varname.Data(), varnamey.Data())] = dosparsehist ? new SparseHist2D(histname, xboundaries.size() - 1, xbounds, nbiny, miny, maxy) : new TH2F(histname, "", xboundaries.size() - 1, xbounds, nbiny, miny, maxy);
         booked_2dhistograms[std::make_tuple(cut.Data(), syst.Data(), varname.Data(), varnamey.Data())]->SetDirectory(0);
         booked_2dhistograms[std::make_tuple(cut.Data(), syst.Data(), varname.Data(), varnamey.Data())]->Sumw2();
         if (syst.IsNull())
         {
             booked_2dhistograms_nominal_keys.push_back(std::make_tuple(cut.Data(), syst.Data(), varname.Data(), varnamey.Data()));
         }
-        cuttreemap[cut.Data()]->addHist2DVec(booked_2dhistograms[std::make_tuple(cut.Data(), syst.Data(), varname.Data(), varnamey.Data())], varxdef, varydef, elemwgt, syst);
+        if (!bookWgtVarHistogram(cut, syst, varname, varnamey))
+            getCutPointer(cut)->addHist2DVec(booked_2dhistograms[std::make_tuple(cut.Data(), syst.Data(), varname.Data(), varnamey.Data())], varxdef, varydef, elemwgt, syst);
     }
 }
 #else
@@ -961,7 +1367,7 @@ void RooUtil::Cutflow::bookHistogram(TString cut, std::pair<TString, std::tuple<
     TString histname = cut + syst + "__" + varname;
     if (booked_histograms.find(std::make_tuple(cut.Data(), syst.Data(), varname.Data())) == booked_histograms.end())
     {
-        booked_histograms[std::make_tuple(cut.Data(), syst.Data(), varname.Data())] = new THist(histname, "", nbin, min, max);
+        booked_histograms[std::make_tuple(cut.Data(), syst.Data(), varname.Data())] = dosparsehist ? new SparseHist1D(histname, nbin, min, max) : new THist(histname, "", nbin, min, max);
         booked_histograms[std::make_tuple(cut.Data(), syst.Data(), varname.Data())]->SetDirectory(0);
         booked_histograms[std::make_tuple(cut.Data(), syst.Data(), varname.Data())]->Sumw2();
         if (syst.IsNull())
@@ -972,7 +1378,7 @@ void RooUtil::Cutflow::bookHistogram(TString cut, std::pair<TString, std::tuple<
             error("bookHistogram():: No TTreeX has been set. Forgot to call bookCutflows()?");
         if (!tx->hasBranch<float>(varname))
             tx->createBranch<float>(varname);
-        cuttreemap[cut.Data()]->addHist1D(booked_histograms[std::make_tuple(cut.Data(), syst.Data(), varname.Data())], varname, syst);
+        getCutPointer(cut)->addHist1D(booked_histograms[std::make_tuple(cut.Data(), syst.Data(), varname.Data())], varname, syst);
     }
 }
 
@@ -987,7 +1393,7 @@ void RooUtil::Cutflow::bookHistogram(TString cut, std::pair<TString, std::vector
         Float_t bounds[boundaries.size()];
         for (unsigned int i = 0; i < boundaries.size(); ++i)
             bounds[i] = boundaries[i];
-        booked_histograms[std::make_tuple(cut.Data(), syst.Data(), varname.Data())] = new THist(histname, "", boundaries.size()-1, bounds);
+        booked_histograms[std::make_tuple(cut.Data(), syst.Data(), varname.Data())] = dosparsehist ? new SparseHist1D(histname, boundaries.size()-1, bounds) : new THist(histname, "", boundaries.size()-1, bounds);
         booked_histograms[std::make_tuple(cut.Data(), syst.Data(), varname.Data())]->SetDirectory(0);
         booked_histograms[std::make_tuple(cut.Data(), syst.Data(), varname.Data())]->Sumw2();
         if (syst.IsNull())
@@ -998,7 +1404,7 @@ void RooUtil::Cutflow::bookHistogram(TString cut, std::pair<TString, std::vector
             error("bookHistogram():: No TTreeX has been set. Forgot to call bookCutflows()?");
         if (!tx->hasBranch<float>(varname))
             tx->createBranch<float>(varname);
-        cuttreemap[cut.Data()]->addHist1D(booked_histograms[std::make_tuple(cut.Data(), syst.Data(), varname.Data())], varname, syst);
+        getCutPointer(cut)->addHist1D(booked_histograms[std::make_tuple(cut.Data(), syst.Data(), varname.Data())], varname, syst);
     }
 }
 
@@ -1016,7 +1422,7 @@ void RooUtil::Cutflow::book2DHistogram(TString cut, std::pair<std::pair<TString,
     TString histname = cut + syst + "__" + varname+"_v_"+varnamey;
     if (booked_2dhistograms.find(std::make_tuple(cut.Data(), syst.Data(), varname.Data(), varnamey.Data())) == booked_2dhistograms.end())
     {
-        booked_2dhistograms[std::make_tuple(cut.Data(), syst.Data(), varname.Data(), varnamey.Data())] = new TH2F(histname, "", nbin, min, max, nbiny, miny, maxy);
+        booked_2dhistograms[std::make_tuple(cut.Data(), syst.Data(), varname.Data(), varnamey.Data())] = dosparsehist ? new SparseHist2D(histname, nbin, min, max, nbiny, miny, maxy) : new TH2F(histname, "", nbin, min, max, nbiny, miny, maxy);
         booked_2dhistograms[std::make_tuple(cut.Data(), syst.Data(), varname.Data(), varnamey.Data())]->SetDirectory(0);
         booked_2dhistograms[std::make_tuple(cut.Data(), syst.Data(), varname.Data(), varnamey.Data())]->Sumw2();
         if (syst.IsNull())
@@ -1029,7 +1435,7 @@ void RooUtil::Cutflow::book2DHistogram(TString cut, std::pair<std::pair<TString,
             tx->createBranch<float>(varname);
         if (!tx->hasBranch<float>(varnamey))
             tx->createBranch<float>(varnamey);
-        cuttreemap[cut.Data()]->addHist2D(booked_2dhistograms[std::make_tuple(cut.Data(), syst.Data(), varname.Data(), varnamey.Data())], varname, varnamey, syst);
+        getCutPointer(cut)->addHist2D(booked_2dhistograms[std::make_tuple(cut.Data(), syst.Data(), varname.Data(), varnamey.Data())], varname, varnamey, syst);
     }
 }
 #endif
@@ -1072,7 +1478,7 @@ void RooUtil::Cutflow::bookHistogramsForCut(Histograms& histograms, TString cut)
 //_______________________________________________________________________________________________________
 void RooUtil::Cutflow::bookHistogramsForCutAndBelow(Histograms& histograms, TString cut)
 {
-    std::vector<TString> cutlist = cuttree.getCutListBelow(cut);
+    std::vector<TString> cutlist = getCutListBelow(cut);
     for (auto& c : cutlist)
     {
         bookHistogramsForCut(histograms, c);
@@ -1107,6 +1513,163 @@ void RooUtil::Cutflow::setSaveTTreeX(bool v)
     dosavettreex = v;
 }
 
+//_______________________________________________________________________________________________________
+void RooUtil::Cutflow::setMultiWeightHistograms(bool v)
+{
+    // Must be called before booking histograms
+    // The wgt systematic histograms are then filled in the same pass as the nominal ones (histogram variables are evaluated once)
+    // N.B. Histogram axes must not be extendable in this mode
+    domultiwgthist = v;
+}
+
+//_______________________________________________________________________________________________________
+void RooUtil::Cutflow::setSavePassMasks(bool v)
+{
+    // Must be called before booking cutflows
+    // Instead of one Bool_t + Float_t branch per cut (setSaveTTreeX), each event is stored as a bitset of the pass flags of all the cuts
+    // plus the weights of the passing cuts whose weight differ from their parent's.
+    // Use RooUtil::CutflowUtil::PassMaskReader to obtain yields and cutflows from the output.
+    // N.B. Only the nominal selection and weights are recorded: cut systematics and wgt systematics are not,
+    //      so the systematic cutflows cannot be re-derived from the masks.
+    dosavepassmask = v;
+}
+
+//_______________________________________________________________________________________________________
+void RooUtil::Cutflow::setEventCache(bool v)
+{
+    // Every fill() records the declared columns (cacheColumn(), cacheTTreeXVariable()) in memory.
+    // After editing the cuts (setCut(), addCut(), removeCut(), ... followed by rebookCutflows() if the regions changed)
+    // replayEventCache() re-runs the cut tree over the cached events without re-reading the ntuple.
+    // N.B. The cut and histogram lambdas must read their inputs through the columns for the replay to be meaningful.
+    // Only USE_CUTLAMBDA cuts can be replayed: in USE_TTREEX mode the pass/weight of each cut is set by the looper before fill(),
+    // so there is nothing in the cut tree to re-run.
+#ifdef USE_TTREEX
+    if (v)
+        error("setEventCache():: the event cache replay is only supported with USE_CUTLAMBDA cuts");
+#endif
+    doeventcache = v;
+}
+
+//_______________________________________________________________________________________________________
+void RooUtil::Cutflow::replayEventCache()
+{
+    // Starts the cutflows and histograms from scratch and re-fills them from the cached events
+    // The event lists are not refilled
+    if (!doeventcache)
+        error("replayEventCache():: event cache was not enabled. Call setEventCache() before the loop.");
+    resetHistograms();
+    iseventcachereplaying = true;
+    for (unsigned int ievent = 0; ievent < eventcache.nevents; ++ievent)
+    {
+        eventcache.load(ievent);
+        fill();
+    }
+    iseventcachereplaying = false;
+    print(TString::Format("Cutflow::replayEventCache() re-evaluated %u cached events", eventcache.nevents));
+}
+
+//_______________________________________________________________________________________________________
+void RooUtil::Cutflow::resetHistograms()
+{
+    for (auto& pair : cutflow_histograms) pair.second->Reset();
+    for (auto& pair : rawcutflow_histograms) pair.second->Reset();
+    for (auto& pair : booked_histograms)
+    {
+        pair.second->Reset();
+        if (SparseBins* sb = dynamic_cast<SparseBins*>(pair.second)) sb->resetBins();
+    }
+    for (auto& pair : booked_2dhistograms)
+    {
+        pair.second->Reset();
+        if (SparseBins* sb = dynamic_cast<SparseBins*>(pair.second)) sb->resetBins();
+    }
+    for (auto& wvh : wgtvar_histograms)
+        wvh->reset();
+    // The pass masks are kept: they are the per-event record of the cuts the events were read with, and replayed events are not re-recorded
+}
+
+//_______________________________________________________________________________________________________
+void RooUtil::Cutflow::rebookCutflows()
+{
+    // To be called after the cuts were edited such that the regions (end cuts) or the cuts leading to them changed
+    for (auto& pair : cutflow_histograms) delete pair.second;
+    for (auto& pair : rawcutflow_histograms) delete pair.second;
+    cutflow_histograms.clear();
+    rawcutflow_histograms.clear();
+    cutlists.clear();
+    cuttreelists.clear();
+    cutflow_booked = false;
+    bookCutflows();
+}
+
+//_______________________________________________________________________________________________________
+void RooUtil::Cutflow::setProfiling(bool v, unsigned int period)
+{
+    // Counts the evaluations and passes of every cut, and times the cut, weight and histogram filling of one event every "period" events
+    // The numbers are shown by printCuts() and used by suggestCutOrder()
+    doprofile = v;
+    profile_period = period > 0 ? period : 1;
+    for (auto& pair : cuttreemap)
+    {
+        if (doprofile and !pair.second->profile)
+            pair.second->profile = new CutProfile(&profile_timing);
+    }
+}
+
+//_______________________________________________________________________________________________________
+void RooUtil::Cutflow::suggestCutOrder()
+{
+    // Siblings are all evaluated regardless of each other, so the order that matters is the one along a chain of single child cuts.
+    // Within such a chain the expected cost is minimized by sorting by cost per evaluation / rejection (1 - pass fraction).
+    // N.B. The pass fractions are measured in the current order (i.e. conditional on the cuts above), so this is a hint assuming weakly correlated cuts.
+    if (!doprofile)
+    {
+        warning("suggestCutOrder():: profiling was not enabled. Call setProfiling() before the loop.");
+        return;
+    }
+    std::vector<CutTree*> stack = {&cuttree};
+    while (stack.size() > 0)
+    {
+        CutTree* c = stack.back();
+        stack.pop_back();
+        std::vector<CutTree*> chain;
+        CutTree* node = c;
+        while (node->parent and node->children.size() == 1 and !node->typed_chain)
+        {
+            chain.push_back(node);
+            node = node->children[0];
+        }
+        if (node->parent and !node->typed_chain and chain.size() > 0)
+            chain.push_back(node);
+        for (auto& child : node->children)
+            stack.push_back(child);
+        if (chain.size() < 2)
+            continue;
+        auto rank = [](CutTree* ct) { double rej = 1 - ct->profile->passFraction(); return rej > 0 ? ct->profile->costPerEval() / rej : 1e30; };
+        std::vector<CutTree*> sorted = chain;
+        std::stable_sort(sorted.begin(), sorted.end(), [&](CutTree* a, CutTree* b) { return rank(a) < rank(b); });
+        if (sorted == chain)
+            continue;
+        TString current = "";
+        TString suggested = "";
+        for (auto& ct : chain) current += (current.IsNull() ? "" : " -> ") + ct->name;
+        for (auto& ct : sorted) suggested += (suggested.IsNull() ? "" : " -> ") + ct->name;
+        print("suggestCutOrder():: current   order: " + current);
+        print("suggestCutOrder():: suggested order: " + suggested);
+        for (auto& ct : sorted)
+            print(TString::Format("    %s : %.3g us/eval, pass fraction %.4f", ct->name.Data(), ct->profile->costPerEval() * 1e6, ct->profile->passFraction()));
+    }
+}
+
+//_______________________________________________________________________________________________________
+void RooUtil::Cutflow::setSparseHistograms(bool v)
+{
+    // Must be called before booking histograms
+    // The booked histograms only allocate the bins that get filled, and only non-empty histograms are written out
+    // N.B. Histogram axes must not be extendable in this mode
+    dosparsehist = v;
+}
+
 //_______________________________________________________________________________________________________
 void RooUtil::Cutflow::setHistogramFilter(std::vector<std::pair<TString, TString>> hists_to_save)
 {
@@ -1175,6 +1738,11 @@ void RooUtil::Cutflow::printSetFunctionError(TString msg)
 //_______________________________________________________________________________________________________
 void RooUtil::Cutflow::setHistsAxesExtendable()
 {
+    if (dosparsehist)
+    {
+        warning("setHistsAxesExtendable():: axes cannot be made extendable with sparse histograms. Ignoring...");
+        return;
+    }
     for (auto& pair : booked_histograms)
         pair.second->SetCanExtend(TH1::kAllAxes);
 }
@@ -8,10 +8,12 @@
 #include <vector>
 #include <map>
 #include <tuple>
+#include <type_traits>
 #include "TH1.h"
 #include "TString.h"
 #include <iostream>
 #include <algorithm>
+#include <unordered_map>
 
 bool PASS();
 float UNITY();
@@ -56,7 +58,7 @@ namespace RooUtil
         public:
             CutTree cuttree;
             CutTree* last_active_cut; // when getCut is called this is set
-            std::map<TREEMAPSTRING, CutTree*> cuttreemap;
+            std::unordered_map<TREEMAPSTRING, CutTree*> cuttreemap; // name -> cut index. All cut lookups by name go through this.
             std::map<CUTFLOWMAPSTRING, THist*> cutflow_histograms;
             std::map<CUTFLOWMAPSTRING, THist*> rawcutflow_histograms;
             std::map<std::tuple<TREEMAPSTRING, TREEMAPSTRING, TREEMAPSTRING>, THist*> booked_histograms; // key is <cutname, syst, varname>
@@ -81,28 +83,76 @@ namespace RooUtil
             bool doskipsysthist;
             bool dosavettreex;
             bool cutflow_booked;
+            bool domultiwgthist;
+            std::vector<float> wgtsyst_values; // per-event values of the wgt systematics (same ordering as systs) used when domultiwgthist
+            std::vector<WgtVarHist*> wgtvar_histograms;
+            bool dosparsehist;
+            bool dosavepassmask;
+            TTree* passmask_tree;
+            std::vector<CutTree*> passmask_cuts; // all cuts in topological order (i.e. bit position in the pass mask)
+            std::vector<TString> passmask_names; // the cut table written out with the masks (names and parent indices of passmask_cuts)
+            std::vector<int> passmask_parents;
+            std::vector<unsigned int> passmask; // pass bits of the current event
+            std::vector<int> passmask_wgtidx; // cuts whose weight differs from their parent's
+            std::vector<float> passmask_wgtval;
+            bool doeventcache;
+            bool iseventcachereplaying;
+            EventCache eventcache;
+            bool doprofile;
+            bool profile_timing; // whether the current event is sampled for timing
+            unsigned int profile_period;
+            unsigned long long profile_ievent;
             Cutflow();
             Cutflow(TFile* o);
             ~Cutflow();
             void setTFile(TFile* o) { ofile = o; }
             void addToCutTreeMap(TString n);
+            void addToCutTreeMap(TString n, CutTree* c);
+            void removeFromCutTreeMap(CutTree* c);
+            CutTree* getCutPointer(TString n); // Returns the "handle" of the cut to be used for the per-event setters
+            CutTree* getCutSystPointer(CutTree* cut, TString syst); // Same for a cut systematic, set per event with setCut(CutTree*, ...)
             void setLastActiveCut(TString n);
 #ifdef USE_CUTLAMBDA
             void addCut(TString n, std::function<bool()> pass, std::function<float()> weight);
             void addCutToLastActiveCut(TString n, std::function<bool()> pass, std::function<float()> weight);
+            // Adds a chain of cuts made with makeCut() (each cut below the previous one) whose callables are not type-erased,
+            // so that the nominal evaluation of the chain is inlined. addCut() with std::function remains the general fallback.
+            // e.g. addCuts(makeCut("Presel", [&]() { return ...; }, UNITY), makeCut("TwoLep", [&]() { return ...; }, [&]() { return sf; }));
+            template <class... Cuts>
+            void addCuts(Cuts... cuts) { last_active_cut = &cuttree; addCutsToLastActiveCut(cuts...); }
+            template <class... Cuts>
+            void addCutsToLastActiveCut(Cuts... cuts)
+            {
+                std::shared_ptr<TypedCutChain<Cuts...>> chain = std::make_shared<TypedCutChain<Cuts...>>(cuts...);
+                std::vector<TString> names = {cuts.name...};
+                for (unsigned int i = 0; i < names.size(); ++i)
+                {
+                    CutTree* c = last_active_cut->addCut(names[i]);
+                    addToCutTreeMap(names[i], c);
+                    last_active_cut = c;
+                    chain->nodes.push_back(c);
+                    c->typed_chain = chain;
+                    c->typed_chain_head = (i == 0);
+                    setCut(c, [chain, i]() { return chain->passAt(i); }, [chain, i]() { return chain->weightAt(i); });
+                }
+            }
 #else
             void addCut(TString n);
             void addCutToLastActiveCut(TString n);
 #endif
             void copyAndEditCuts(TString, std::map<TString, TString>);
+            CutTree* copyCutTree(CutTree* c, CutTree* parent, std::map<TString, TString>& replacements);
             void printCuts();
             CutTree& getCut(TString n);
+            std::vector<TString> getCutList(TString n);
+            std::vector<TString> getCutListBelow(TString n);
             void removeCut(TString n);
             // void filterCuts(TString n);
             void filterCuts(std::vector<TString> ns);
             void setCutLists(std::vector<TString> regions);
             void addCutToSkipCutflowList(TString n);
             void bookCutflowTree();
+            void bindCutHandles();
             void bookCutflowHistograms();
             void bookCutflowHistograms_v1();
             void bookCutflowHistograms_v2();
@@ -110,16 +160,50 @@ namespace RooUtil
             void bookCutflows();
             void setSkipSystematicHistograms(bool=true);
             void setSaveTTreeX(bool=true);
+            void setMultiWeightHistograms(bool=true);
+            void setSparseHistograms(bool=true);
+            void setSavePassMasks(bool=true);
+            void bookPassMasks();
+            void fillPassMasks();
+            void savePassMasks();
+            void setEventCache(bool=true);
+            // The returned reference holds the value of the current event (recorded or replayed), typed after the getter
+            // e.g. const float& met = cutflow.cacheColumn("met", [&]() { return cms3.evt_pfmet(); });
+            //      cutflow.addCut("MET", [&]() { return met > 50; }, UNITY);
+            template <class Getter>
+            const typename std::decay<decltype(std::declval<Getter>()())>::type& cacheColumn(TString name, Getter getter)
+            {
+                typedef typename std::decay<decltype(getter())>::type T;
+                return eventcache.addColumn<T>(name, std::function<T()>(getter));
+            }
+            // For the variables set via setVariable()
+            template <class T=float>
+            void cacheTTreeXVariable(TString varname)
+            {
+                if (!tx)
+                    error("cacheTTreeXVariable():: No TTreeX has been set. Forgot to call bookCutflows()?");
+                eventcache.addColumn<T>(varname, [&, varname]() { return tx->getBranch<T>(varname, false); }, [&, varname](T v) { tx->setBranch<T>(varname, v, false, true); });
+            }
+            void replayEventCache();
+            void resetHistograms();
+            void rebookCutflows();
+            void setProfiling(bool=true, unsigned int period=100);
+            void suggestCutOrder();
             void saveOutput();
             void saveCutflows();
             void saveHistograms();
+            void saveSparseHistograms();
             void saveTTreeX();
 #ifdef USE_CUTLAMBDA
             void setCut    (TString cutname, std::function<bool()> pass, std::function<float()> weight);
             void setCutSyst(TString cutname, TString syst, std::function<bool()> pass, std::function<float()> weight);
+            void setCut    (CutTree* cut, std::function<bool()> pass, std::function<float()> weight);
+            void setCutSyst(CutTree* cut, TString syst, std::function<bool()> pass, std::function<float()> weight);
 #else
             void setCut(TString cutname, bool pass, float weight);
             void setCutSyst(TString cutname, TString syst, bool pass, float weight);
+            void setCut(CutTree* cut, bool pass, float weight);
+            void setCutSyst(CutTree* cut, TString syst, bool pass, float weight);
 #endif
             void addCutSyst(TString syst, std::vector<TString> pattern, std::vector<TString> vetopattern=std::vector<TString>());
 #ifdef USE_CUTLAMBDA
@@ -132,6 +216,7 @@ namespace RooUtil
             void setVariable(TString varname, float);
             void setEventID(int, int, unsigned long long);
             void bookEventLists();
+            void writeEventLists(TString ofilename); // ".root" -> one TTree per cut, otherwise ofilename is a prefix of the per-cut binary files
             void fill();
             void fillCutflows(TString syst="", bool iswgtsyst=true);
             void fillCutflow(std::vector<TString>& cutlist, THist* h, THist* hraw, float wgtsyst=1);
@@ -139,6 +224,7 @@ namespace RooUtil
             void fillCutflow_v2(std::vector<CutTree*>& cutlist, THist* h, THist* hraw, float wgtsyst=1);
             void fillCutflows_v2(TString syst="", bool iswgtsyst=true);
             void fillHistograms(TString syst="", bool iswgtsyst=true);
+            void fillHistogramsWithWgtVariations();
 #ifdef USE_CUTLAMBDA
             void bookHistogram(TString, std::pair<TString, std::tuple<unsigned, float, float, std::function<float()>>>, TString="");
             void bookVecHistogram(TString, std::pair<TString, std::tuple<unsigned, float, float, std::function<vector<float>()>, std::function<vector<float>()>>>, TString="");
@@ -152,6 +238,8 @@ namespace RooUtil
             void bookHistogram(TString, std::pair<TString, std::vector<float>>, TString="");
             void book2DHistogram(TString, std::pair<std::pair<TString, TString>, std::tuple<unsigned, float, float, unsigned, float, float>>, TString="");
 #endif
+            bool bookWgtVarHistogram(TString cut, TString syst, TString varname, TString varnamey="");
+            void flushWgtVarHistograms();
             void bookHistograms(Histograms& histograms);
             void bookHistograms(Histograms& histograms, std::vector<TString> cutlist);
             void bookHistogramsForCut(Histograms& histograms, TString);
@@ -132,3 +132,104 @@ void RooUtil::CutflowUtil::saveCutflowHistograms(std::map<CUTFLOWMAPSTRING, THis
     for (auto& cutflow : cutflows) cutflow.second->Write();
     for (auto& rawcutflow : rawcutflows) rawcutflow.second->Write();
 }
+
+//_______________________________________________________________________________________________________
+RooUtil::CutflowUtil::PassMaskReader::PassMaskReader(TFile* f, TString treename) : tree(0), passmask(0), wgtidx(0), wgtval(0)
+{
+    TTree* cuttable = (TTree*) f->Get(treename + "Cuts");
+    tree = (TTree*) f->Get(treename);
+    if (!cuttable or !tree)
+        error(TString::Format("PassMaskReader:: did not find %s and %sCuts in %s", treename.Data(), treename.Data(), f->GetName()));
+    std::string* name = 0;
+    int parent;
+    cuttable->SetBranchAddress("name", &name);
+    cuttable->SetBranchAddress("parent", &parent);
+    for (Long64_t i = 0; i < cuttable->GetEntries(); ++i)
+    {
+        cuttable->GetEntry(i);
+        cutindex[name->c_str()] = cutnames.size();
+        cutnames.push_back(name->c_str());
+        parents.push_back(parent);
+    }
+    weights.resize(cutnames.size());
+    tree->SetBranchAddress("passmask", &passmask);
+    tree->SetBranchAddress("wgtidx", &wgtidx);
+    tree->SetBranchAddress("wgtval", &wgtval);
+}
+
+//_______________________________________________________________________________________________________
+void RooUtil::CutflowUtil::PassMaskReader::getEntry(Long64_t i)
+{
+    tree->GetEntry(i);
+    // Only the weights that differ from the parent's are stored, the rest are inherited
+    weights[0] = 1;
+    unsigned int iwgt = 0;
+    for (unsigned int icut = 1; icut < cutnames.size(); ++icut)
+    {
+        if (iwgt < wgtidx->size() and (*wgtidx)[iwgt] == (int) icut)
+            weights[icut] = (*wgtval)[iwgt++];
+        else
+            weights[icut] = weights[parents[icut]];
+    }
+}
+
+//_______________________________________________________________________________________________________
+int RooUtil::CutflowUtil::PassMaskReader::getCutIndex(TString cutname)
+{
+    if (cutindex.find(cutname) == cutindex.end())
+        error(TString::Format("PassMaskReader:: Asked for %s cut, but did not find the cut", cutname.Data()));
+    return cutindex[cutname];
+}
+
+//_______________________________________________________________________________________________________
+std::vector<TString> RooUtil::CutflowUtil::PassMaskReader::getCutList(TString cutname)
+{
+    std::vector<TString> cutlist;
+    for (int i = getCutIndex(cutname); i >= 0; i = parents[i])
+        cutlist.push_back(cutnames[i]);
+    std::reverse(cutlist.begin(), cutlist.end());
+    return cutlist;
+}
+
+//_______________________________________________________________________________________________________
+std::pair<double, double> RooUtil::CutflowUtil::PassMaskReader::getYield(TString cutname)
+{
+    int icut = getCutIndex(cutname);
+    double sumw = 0;
+    double sumw2 = 0;
+    for (Long64_t i = 0; i < getEntries(); ++i)
+    {
+        getEntry(i);
+        if (!pass(icut))
+            continue;
+        sumw += weights[icut];
+        sumw2 += weights[icut] * weights[icut];
+    }
+    return std::make_pair(sumw, std::sqrt(sumw2));
+}
+
+//_______________________________________________________________________________________________________
+THist* RooUtil::CutflowUtil::PassMaskReader::makeCutflow(TString region, bool raw)
+{
+    // Same binning and labels as the cutflow histograms booked by Cutflow
+    std::vector<TString> cutlist = getCutList(region);
+    std::vector<int> idxs;
+    for (auto& cutname : cutlist)
+        idxs.push_back(getCutIndex(cutname));
+    THist* h = new THist(region + (raw ? "_rawcutflow" : "_cutflow"), "", cutlist.size(), 0, cutlist.size());
+    h->Sumw2();
+    h->SetDirectory(0);
+    for (unsigned int i = 0; i < cutlist.size(); ++i)
+        h->GetXaxis()->SetBinLabel(i+1, cutlist[i]);
+    for (Long64_t ientry = 0; ientry < getEntries(); ++ientry)
+    {
+        getEntry(ientry);
+        for (unsigned int i = 0; i < idxs.size(); ++i)
+        {
+            if (!pass(idxs[i]))
+                break;
+            h->Fill(i, raw ? 1 : weights[idxs[i]]);
+        }
+    }
+    return h;
+}
@@ -7,11 +7,19 @@
 #include <vector>
 #include <map>
 #include "TH1.h"
+#include "TH2.h"
 #include "TString.h"
 #include <iostream>
 #include <algorithm>
 #include <sys/ioctl.h>
 #include <functional>
+#include <unordered_map>
+#include <cmath>
+#include <fstream>
+#include <iterator>
+#include <memory>
+#include <deque>
+#include <chrono>
 
 //#define USE_TTREEX
 #define USE_CUTLAMBDA
@@ -65,8 +73,574 @@ namespace RooUtil
 //        void fillCutflowHistograms(CutNameListMap& cutlists, RooUtil::TTreeX& tx, std::map<TString, THist*>& cutflows, std::map<TString, THist*>& rawcutflows);
 //        void fillCutflowHistograms(std::map<TString, std::vector<TString>>& cutlists, RooUtil::TTreeX& tx, std::map<TString, THist*>& cutflows, std::map<TString, THist*>& rawcutflows);
 
+        // Reads back the per-event pass masks written by Cutflow::setSavePassMasks() to re-derive yields and cutflows offline
+        // The cuts are stored in topological order (a parent always comes before its children, index 0 is "Root")
+        // Only the nominal selection is recorded, so only nominal yields and cutflows can be re-derived (no cut or wgt systematics)
+        class PassMaskReader
+        {
+            public:
+            TTree* tree;
+            std::vector<TString> cutnames;
+            std::vector<int> parents;
+            std::map<TString, int> cutindex;
+            std::vector<unsigned int>* passmask;
+            std::vector<int>* wgtidx;
+            std::vector<float>* wgtval;
+            std::vector<float> weights; // decoded weights of the current entry
+            PassMaskReader(TFile* f, TString treename="PassMask");
+            Long64_t getEntries() { return tree->GetEntries(); }
+            void getEntry(Long64_t i);
+            int getCutIndex(TString cutname);
+            std::vector<TString> getCutList(TString cutname);
+            bool pass(int i) { return ((*passmask)[i / 32] >> (i % 32)) & 1; }
+            float weight(int i) { return weights[i]; }
+            std::pair<double, double> getYield(TString cutname);
+            THist* makeCutflow(TString region, bool raw=false);
+        };
+
     }
 
+    // Bin storage allocated on first fill (global bin -> (sumw, sumw2))
+    class SparseBins
+    {
+        public:
+            std::unordered_map<Int_t, std::pair<Double_t, Double_t>> sparsebins;
+            virtual ~SparseBins() {}
+            void addBinContent(Int_t bin, Double_t sumw, Double_t sumw2)
+            {
+                std::pair<Double_t, Double_t>& b = sparsebins[bin];
+                b.first += sumw;
+                b.second += sumw2;
+            }
+            bool isEmpty() const { return sparsebins.size() == 0; }
+            void resetBins() { sparsebins.clear(); }
+            void copyBinsTo(TH1* h) const
+            {
+                for (auto& b : sparsebins)
+                {
+                    h->SetBinContent(b.first, b.second.first);
+                    h->SetBinError(b.first, std::sqrt(b.second.second));
+                }
+            }
+    };
+
+    // Histograms for the sparse histogram backend of Cutflow. (see Cutflow::setSparseHistograms())
+    // Only the axes are booked. No dense bin array is allocated and the filled bins are kept in SparseBins.
+    // These are for filling only. Use toDense() to obtain a regular histogram to write out or to look at.
+    // The TH1 entry points that would reach the (unallocated) dense storage either go through SparseBins or abort.
+    // N.B. There is no ClassDef (RooUtil builds no dictionaries), so these must never be streamed.
+    template <class H>
+    class SparseHistBase : public H, public SparseBins
+    {
+        public:
+            void Sumw2(Bool_t = kTRUE) override {} // sumw2 is always kept
+            Double_t GetBinError(Int_t bin) const override { auto it = sparsebins.find(bin); return it == sparsebins.end() ? 0 : std::sqrt(it->second.second); }
+            void SetBinError(Int_t bin, Double_t error) override { sparsebins[bin].second = error * error; }
+            void AddBinContent(Int_t bin) override { addBinContent(bin, 1, 1); }
+            void AddBinContent(Int_t bin, Double_t w) override { addBinContent(bin, w, w * w); }
+            void Reset(Option_t* option = "") override { H::Reset(option); resetBins(); }
+            Bool_t Add(const TH1*, Double_t = 1) override { return deny("Add"); }
+            Bool_t Add(const TH1*, const TH1*, Double_t = 1, Double_t = 1) override { return deny("Add"); }
+            Bool_t Multiply(const TH1*) override { return deny("Multiply"); }
+            Bool_t Divide(const TH1*) override { return deny("Divide"); }
+            void Scale(Double_t = 1, Option_t* = "") override { deny("Scale"); }
+            Double_t Integral(Option_t* = "") const override { deny("Integral"); return 0; }
+            Long64_t Merge(TCollection*) override { deny("Merge"); return 0; }
+            TObject* Clone(const char* = "") const override { deny("Clone"); return 0; }
+            void Copy(TObject&) const override { deny("Copy"); }
+            Int_t Write(const char* = 0, Int_t = 0, Int_t = 0) override { deny("Write"); return 0; }
+            Int_t Write(const char* = 0, Int_t = 0, Int_t = 0) const override { deny("Write"); return 0; }
+        protected:
+            Double_t RetrieveBinContent(Int_t bin) const override { auto it = sparsebins.find(bin); return it == sparsebins.end() ? 0 : it->second.first; }
+            void UpdateBinContent(Int_t bin, Double_t content) override { sparsebins[bin].first = content; }
+            Bool_t deny(const char* fname) const
+            {
+                RooUtil::error(TString::Format("SparseHist::%s():: %s is a sparse histogram without dense bin storage. Use toDense() first.", fname, this->GetName()));
+                return kFALSE;
+            }
+    };
+
+    class SparseHist1D : public SparseHistBase<THist>
+    {
+        public:
+            using THist::Fill;
+            SparseHist1D(TString n, Int_t nbins, Double_t xlow, Double_t xup) { SetName(n); fXaxis.Set(nbins, xlow, xup); fNcells = nbins + 2; }
+            SparseHist1D(TString n, Int_t nbins, const Float_t* xbins) { SetName(n); fXaxis.Set(nbins, xbins); fNcells = nbins + 2; }
+            Int_t Fill(Double_t x) override { return Fill(x, 1); }
+            Int_t Fill(Double_t x, Double_t w) override
+            {
+                Int_t bin = fXaxis.FindFixBin(x);
+                addBinContent(bin, w, w * w);
+                fEntries++;
+                return bin;
+            }
+            THist* toDense() const
+            {
+                THist* h = 0;
+                if (fXaxis.GetXbins()->GetSize())
+                    h = new THist(GetName(), GetTitle(), fXaxis.GetNbins(), fXaxis.GetXbins()->GetArray());
+                else
+                    h = new THist(GetName(), GetTitle(), fXaxis.GetNbins(), fXaxis.GetXmin(), fXaxis.GetXmax());
+                h->SetDirectory(0);
+                h->Sumw2();
+                copyBinsTo(h);
+                h->ResetStats();
+                h->SetEntries(fEntries);
+                return h;
+            }
+    };
+
+    class SparseHist2D : public SparseHistBase<TH2F>
+    {
+        public:
+            using TH2F::Fill;
+            SparseHist2D(TString n, Int_t nbinsx, Double_t xlow, Double_t xup, Int_t nbinsy, Double_t ylow, Double_t yup) { SetName(n); fXaxis.Set(nbinsx, xlow, xup); fYaxis.Set(nbinsy, ylow, yup); fNcells = (nbinsx + 2) * (nbinsy + 2); }
+            SparseHist2D(TString n, Int_t nbinsx, const Double_t* xbins, Int_t nbinsy, Double_t ylow, Double_t yup) { SetName(n); fXaxis.Set(nbinsx, xbins); fYaxis.Set(nbinsy, ylow, yup); fNcells = (nbinsx + 2) * (nbinsy + 2); }
+            Int_t Fill(Double_t x, Double_t y) override { return Fill(x, y, 1); }
+            Int_t Fill(Double_t x, Double_t y, Double_t w) override
+            {
+                Int_t bin = GetBin(fXaxis.FindFixBin(x), fYaxis.FindFixBin(y));
+                addBinContent(bin, w, w * w);
+                fEntries++;
+                return bin;
+            }
+            TH2F* toDense() const
+            {
+                TH2F* h = 0;
+                bool xvar = fXaxis.GetXbins()->GetSize();
+                bool yvar = fYaxis.GetXbins()->GetSize();
+                if (xvar and yvar)
+                    h = new TH2F(GetName(), GetTitle(), fXaxis.GetNbins(), fXaxis.GetXbins()->GetArray(), fYaxis.GetNbins(), fYaxis.GetXbins()->GetArray());
+                else if (xvar)
+                    h = new TH2F(GetName(), GetTitle(), fXaxis.GetNbins(), fXaxis.GetXbins()->GetArray(), fYaxis.GetNbins(), fYaxis.GetXmin(), fYaxis.GetXmax());
+                else if (yvar)
+                    h = new TH2F(GetName(), GetTitle(), fXaxis.GetNbins(), fXaxis.GetXmin(), fXaxis.GetXmax(), fYaxis.GetNbins(), fYaxis.GetXbins()->GetArray());
+                else
+                    h = new TH2F(GetName(), GetTitle(), fXaxis.GetNbins(), fXaxis.GetXmin(), fXaxis.GetXmax(), fYaxis.GetNbins(), fYaxis.GetXmin(), fYaxis.GetXmax());
+                h->SetDirectory(0);
+                h->Sumw2();
+                copyBinsTo(h);
+                h->ResetStats();
+                h->SetEntries(fEntries);
+                return h;
+            }
+    };
+
+    // Holds the weight variations of a booked histogram in one contiguous (ncells x nvariations) buffer.
+    // The nominal histogram is filled as usual and the returned global bin is used to accumulate all the variations at once.
+    // The per-variation histograms are only filled at the end via flush(). (i.e. axes must not be extendable)
+    // If the nominal is a sparse histogram (SparseBins) the variations are accumulated per filled bin instead (bin -> nvariations block).
+    class WgtVarHist
+    {
+        public:
+            TH1* nominal;
+            std::vector<TH1*> variations;
+            std::vector<unsigned int> varidxs; // index of the variation in the per-event weight variation vector
+            std::vector<double> sumw;
+            std::vector<double> sumw2;
+            std::unordered_map<Int_t, std::vector<double>> sparseblocks; // bin -> (sumw x nvariations, sumw2 x nvariations)
+            std::vector<double> nentries;
+            unsigned int ncells;
+            bool issparse;
+            WgtVarHist(TH1* h) : nominal(h), ncells(h->GetNcells()), issparse(dynamic_cast<SparseBins*>(h) != 0) {}
+            void addVariation(TH1* h, unsigned int varidx)
+            {
+                variations.push_back(h);
+                varidxs.push_back(varidx);
+                nentries.resize(variations.size(), 0);
+            }
+            void reset()
+            {
+                std::fill(sumw.begin(), sumw.end(), 0);
+                std::fill(sumw2.begin(), sumw2.end(), 0);
+                sparseblocks.clear();
+                std::fill(nentries.begin(), nentries.end(), 0);
+            }
+            void fill(int bin, float weight, const std::vector<float>& wgtvars)
+            {
+                if (bin < 0 or (unsigned int) bin >= ncells)
+                    return;
+                const unsigned int nvar = variations.size();
+                double* sw = 0;
+                double* sw2 = 0;
+                if (issparse)
+                {
+                    std::vector<double>& block = sparseblocks[bin];
+                    if (block.size() == 0)
+                        block.resize(2 * nvar, 0);
+                    sw = &block[0];
+                    sw2 = &block[nvar];
+                }
+                else
+                {
+                    // The buffer is allocated on first fill so that never filled histograms do not cost memory
+                    if (sumw.size() == 0)
+                    {
+                        sumw.resize(ncells * nvar, 0);
+                        sumw2.resize(ncells * nvar, 0);
+                    }
+                    sw = &sumw[bin * nvar];
+                    sw2 = &sumw2[bin * nvar];
+                }
+                for (unsigned int i = 0; i < nvar; ++i)
+                {
+                    double w = weight * wgtvars[varidxs[i]];
+                    sw[i] += w;
+                    sw2[i] += w * w;
+                    nentries[i] += 1;
+                }
+            }
+            void flush()
+            {
+                if (sumw.size() == 0 and sparseblocks.size() == 0)
+                    return;
+                const unsigned int nvar = variations.size();
+                for (unsigned int i = 0; i < nvar; ++i)
+                {
+                    TH1* h = variations[i];
+                    SparseBins* sparse = dynamic_cast<SparseBins*>(h);
+                    double entries = h->GetEntries() + nentries[i];
+                    auto addbin = [&](Int_t bin, double sw, double sw2)
+                    {
+                        if (sw == 0 and sw2 == 0)
+                            return;
+                        if (sparse)
+                        {
+                            sparse->addBinContent(bin, sw, sw2);
+                            return;
+                        }
+                        double err = h->GetBinError(bin);
+                        h->SetBinContent(bin, h->GetBinContent(bin) + sw);
+                        h->SetBinError(bin, std::sqrt(err * err + sw2));
+                    };
+                    if (issparse)
+                    {
+                        for (auto& block : sparseblocks)
+                            addbin(block.first, block.second[i], block.second[nvar + i]);
+                    }
+                    else
+                    {
+                        for (unsigned int bin = 0; bin < ncells; ++bin)
+                            addbin(bin, sumw[bin * nvar + i], sumw2[bin * nvar + i]);
+                    }
+                    if (!sparse)
+                        h->ResetStats();
+                    h->SetEntries(entries);
+                    nentries[i] = 0;
+                }
+                std::fill(sumw.begin(), sumw.end(), 0);
+                std::fill(sumw2.begin(), sumw2.end(), 0);
+                sparseblocks.clear();
+            }
+    };
+
+    // Columnar cache of the per-event inputs of the cut tree (see Cutflow::setEventCache())
+    // Each column has a getter that is read when recording and optionally a setter that puts the cached value back when replaying.
+    // The current value of a column stays at a fixed address, so cut lambdas can read it by reference both when recording and replaying.
+    // Columns keep the type of their getter, so ints, ids and event numbers round-trip exactly.
+    class EventCache
+    {
+        public:
+            class Column
+            {
+                public:
+                    TString name;
+                    virtual ~Column() {}
+                    virtual void record() = 0;
+                    virtual void load(unsigned int ievent) = 0;
+                    virtual void clear() = 0;
+            };
+            template <class T>
+            class TypedColumn : public Column
+            {
+                public:
+                    std::function<T()> getter;
+                    std::function<void(T)> setter;
+                    std::vector<T> data;
+                    T value;
+                    TypedColumn() : value() {}
+                    void record() { value = getter(); data.push_back(value); }
+                    void load(unsigned int ievent) { value = data[ievent]; if (setter) setter(value); }
+                    void clear() { data.clear(); }
+            };
+            std::vector<std::unique_ptr<Column>> columns;
+            unsigned int nevents;
+            EventCache() : nevents(0) {}
+            template <class T>
+            const T& addColumn(TString name, std::function<T()> getter, std::function<void(T)> setter=nullptr)
+            {
+                for (auto& column : columns)
+                {
+                    if (column->name != name)
+                        continue;
+                    TypedColumn<T>* typed = dynamic_cast<TypedColumn<T>*>(column.get());
+                    if (!typed)
+                        error(TString::Format("EventCache::addColumn():: column %s already exists with a different type", name.Data()));
+                    return typed->value;
+                }
+                if (nevents > 0)
+                    error(TString::Format("EventCache::addColumn():: cannot add column %s after events have been recorded", name.Data()));
+                TypedColumn<T>* column = new TypedColumn<T>();
+                column->name = name;
+                column->getter = getter;
+                column->setter = setter;
+                columns.push_back(std::unique_ptr<Column>(column));
+                return column->value;
+            }
+            void record()
+            {
+                for (auto& column : columns)
+                    column->record();
+                nevents++;
+            }
+            void load(unsigned int ievent)
+            {
+                for (auto& column : columns)
+                    column->load(ievent);
+            }
+            void clear()
+            {
+                for (auto& column : columns)
+                    column->clear();
+                nevents = 0;
+            }
+    };
+
+    // Columnar event list of a cut. The (run, lumi, evt) of the passing events are appended to three columns
+    // through pointers to the event id variables that are resolved once (see Cutflow::bookEventLists()),
+    // so recording an event is just three push_backs and no branch name lookup.
+    // At the end the columns are sorted together and written out delta-encoded.
+    class CutEventList
+    {
+        public:
+            const int* run_ptr;
+            const int* lumi_ptr;
+            const unsigned long long* evt_ptr;
+            std::vector<int> runs;
+            std::vector<int> lumis;
+            std::vector<unsigned long long> evts;
+            bool issorted;
+            CutEventList() : run_ptr(0), lumi_ptr(0), evt_ptr(0), issorted(true) {}
+            void setHandles(const int* r, const int* l, const unsigned long long* e) { run_ptr = r; lumi_ptr = l; evt_ptr = e; }
+            void record()
+            {
+                if (!run_ptr)
+                    return;
+                add(*run_ptr, *lumi_ptr, *evt_ptr);
+            }
+            void add(int run, int lumi, unsigned long long evt)
+            {
+                if (issorted and runs.size() > 0)
+                    issorted = not lessThan(run, lumi, evt, runs.size() - 1);
+                runs.push_back(run);
+                lumis.push_back(lumi);
+                evts.push_back(evt);
+            }
+            unsigned int size() const { return runs.size(); }
+            void clear() { runs.clear(); lumis.clear(); evts.clear(); issorted = true; }
+            bool lessThan(int run, int lumi, unsigned long long evt, unsigned int i) const
+            {
+                if (run != runs[i]) return run < runs[i];
+                if (lumi != lumis[i]) return lumi < lumis[i];
+                return evt < evts[i];
+            }
+            void sort()
+            {
+                if (issorted)
+                    return;
+                std::vector<unsigned int> idx(size());
+                for (unsigned int i = 0; i < idx.size(); ++i)
+                    idx[i] = i;
+                std::sort(idx.begin(), idx.end(), [&](unsigned int a, unsigned int b) { return lessThan(runs[a], lumis[a], evts[a], b); });
+                std::vector<int> sruns(size());
+                std::vector<int> slumis(size());
+                std::vector<unsigned long long> sevts(size());
+                for (unsigned int i = 0; i < idx.size(); ++i)
+                {
+                    sruns[i] = runs[idx[i]];
+                    slumis[i] = lumis[idx[i]];
+                    sevts[i] = evts[idx[i]];
+                }
+                runs.swap(sruns);
+                lumis.swap(slumis);
+                evts.swap(sevts);
+                issorted = true;
+            }
+            // Binary format: "RUEVTLST", uint64 number of events, then the three columns one after another as varints
+            // run  : zigzag(run - previous run)
+            // lumi : zigzag(lumi - previous lumi) if same run, zigzag(lumi) otherwise
+            // evt  : evt - previous evt if same run and lumi, evt otherwise
+            void writeBinary(TString ofilename)
+            {
+                sort();
+                std::ofstream outFile(ofilename.Data(), std::ios::binary);
+                if (!outFile)
+                {
+                    error(TString::Format("CutEventList::writeBinary():: failed to open %s", ofilename.Data()));
+                    return;
+                }
+                std::string buf = "RUEVTLST";
+                putVarint(buf, size());
+                for (unsigned int i = 0; i < size(); ++i)
+                    putVarint(buf, zigzag((long long) runs[i] - (i > 0 ? runs[i-1] : 0)));
+                for (unsigned int i = 0; i < size(); ++i)
+                    putVarint(buf, zigzag((long long) lumis[i] - ((i > 0 and runs[i] == runs[i-1]) ? lumis[i-1] : 0)));
+                for (unsigned int i = 0; i < size(); ++i)
+                    putVarint(buf, evts[i] - ((i > 0 and runs[i] == runs[i-1] and lumis[i] == lumis[i-1]) ? evts[i-1] : 0));
+                outFile.write(buf.data(), buf.size());
+                outFile.close();
+            }
+            bool readBinary(TString ifilename)
+            {
+                // The list is left empty if the file cannot be read
+                clear();
+                std::ifstream inFile(ifilename.Data(), std::ios::binary);
+                if (!inFile)
+                {
+                    warning(TString::Format("CutEventList::readBinary():: failed to open %s", ifilename.Data()));
+                    return false;
+                }
+                std::string buf((std::istreambuf_iterator<char>(inFile)), std::istreambuf_iterator<char>());
+                if (inFile.bad())
+                {
+                    warning(TString::Format("CutEventList::readBinary():: failed to read %s", ifilename.Data()));
+                    return false;
+                }
+                if (buf.compare(0, 8, "RUEVTLST") != 0)
+                {
+                    warning(TString::Format("CutEventList::readBinary():: %s is not an event list file", ifilename.Data()));
+                    return false;
+                }
+                // Every event takes at least one byte per column, which bounds n before anything is allocated
+                size_t pos = 8;
+                unsigned long long n = 0;
+                if (!getVarint(buf, pos, n) or n > (buf.size() - pos) / 3)
+                {
+                    warning(TString::Format("CutEventList::readBinary():: %s is truncated or corrupt", ifilename.Data()));
+                    return false;
+                }
+                runs.resize(n);
+                lumis.resize(n);
+                evts.resize(n);
+                bool ok = true;
+                unsigned long long v = 0;
+                for (unsigned int i = 0; ok and i < n; ++i)
+                {
+                    ok = getVarint(buf, pos, v);
+                    runs[i] = (i > 0 ? runs[i-1] : 0) + unzigzag(v);
+                }
+                for (unsigned int i = 0; ok and i < n; ++i)
+                {
+                    ok = getVarint(buf, pos, v);
+                    lumis[i] = ((i > 0 and runs[i] == runs[i-1]) ? lumis[i-1] : 0) + unzigzag(v);
+                }
+                for (unsigned int i = 0; ok and i < n; ++i)
+                {
+                    ok = getVarint(buf, pos, v);
+                    evts[i] = ((i > 0 and runs[i] == runs[i-1] and lumis[i] == lumis[i-1]) ? evts[i-1] : 0) + v;
+                }
+                if (!ok or pos != buf.size())
+                {
+                    clear();
+                    warning(TString::Format("CutEventList::readBinary():: %s is truncated or corrupt", ifilename.Data()));
+                    return false;
+                }
+                return true;
+            }
+            // Writes a TTree with the sorted run, lumi, evt columns to the current directory (ROOT compresses the sorted columns well)
+            void writeTTree(TString treename)
+            {
+                sort();
+                TTree* t = new TTree(treename, treename);
+                int run;
+                int lumi;
+                unsigned long long evt;
+                t->Branch("run", &run);
+                t->Branch("lumi", &lumi);
+                t->Branch("evt", &evt);
+                for (unsigned int i = 0; i < size(); ++i)
+                {
+                    run = runs[i];
+                    lumi = lumis[i];
+                    evt = evts[i];
+                    t->Fill();
+                }
+                t->Write();
+                delete t;
+            }
+            static unsigned long long zigzag(long long v) { return ((unsigned long long) v << 1) ^ (unsigned long long) (v >> 63); }
+            static long long unzigzag(unsigned long long v) { return (long long) (v >> 1) ^ -(long long) (v & 1); }
+            static void putVarint(std::string& buf, unsigned long long v)
+            {
+                while (v >= 0x80)
+                {
+                    buf.push_back((char) (v | 0x80));
+                    v >>= 7;
+                }
+                buf.push_back((char) v);
+            }
+            // Returns false if the varint runs past the end of buf or is longer than 64 bits
+            static bool getVarint(const std::string& buf, size_t& pos, unsigned long long& v)
+            {
+                v = 0;
+                for (int shift = 0; pos < buf.size() and shift < 64; shift += 7)
+                {
+                    unsigned char byte = buf[pos++];
+                    v |= (unsigned long long) (byte & 0x7f) << shift;
+                    if (!(byte & 0x80))
+                        return true;
+                }
+                return false;
+            }
+    };
+
+    // Per cut statistics of the profiling mode of Cutflow (see Cutflow::setProfiling())
+    // The counts are exact, the times are only measured on the sampled events and scaled up to all evaluations.
+    class CutProfile
+    {
+        public:
+            const bool* timing; // whether the current event is sampled for timing (shared by all the cuts)
+            unsigned long long nevals;
+            unsigned long long npass;
+            unsigned long long ntimed;
+            double time_cut;
+            double time_weight;
+            double time_hist;
+            CutProfile(const bool* t) : timing(t), nevals(0), npass(0), ntimed(0), time_cut(0), time_weight(0), time_hist(0) {}
+            void count(bool pass) { nevals++; npass += pass; }
+            double passFraction() const { return nevals ? (double) npass / nevals : 0; }
+            double scale() const { return ntimed ? (double) nevals / ntimed : 0; }
+            double timeCut() const { return time_cut * scale(); }
+            double timeWeight() const { return time_weight * scale(); }
+            double timeHist() const { return time_hist * scale(); }
+            double costPerEval() const { return ntimed ? (time_cut + time_weight) / ntimed : 0; }
+            static double now() { return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count(); }
+    };
+
+    // Cut whose pass and weight callables are kept as their concrete (e.g. lambda) types. Create with makeCut() and add with Cutflow::addCuts()
+    template <class PassF, class WeightF>
+    struct TypedCut
+    {
+        TString name;
+        PassF pass;
+        WeightF weight;
+    };
+
+    template <class PassF, class WeightF>
+    TypedCut<PassF, WeightF> makeCut(TString name, PassF pass, WeightF weight) { return TypedCut<PassF, WeightF>{name, pass, weight}; }
+
+    // Type-erased interface of TypedCutChain. One virtual call evaluates a whole chain of typed cuts.
+    class CutTree;
+    class CutChainBase
+    {
+        public:
+            std::vector<CutTree*> nodes; // the cut tree nodes of the chain (i-th node is the i-th cut), truncated by Cutflow::removeCut()
+            virtual ~CutChainBase() {}
+            virtual void evaluate(bool aggregated_pass, float aggregated_weight) = 0;
+            virtual bool passAt(unsigned int i) = 0;
+            virtual float weightAt(unsigned int i) = 0;
+    };
+
     class CutTree
     {
         public:
@@ -85,6 +659,14 @@ namespace RooUtil
             float weight_this_cut;
             std::function<bool()> pass_this_cut_func;
             std::function<float()> weight_this_cut_func;
+            std::shared_ptr<CutChainBase> typed_chain; // set if this cut was added via Cutflow::addCuts()
+            bool typed_chain_head; // the first node of typed_chain evaluates the whole chain
+            CutProfile* profile; // set in the profiling mode (see Cutflow::setProfiling())
+#ifdef USE_TTREEX
+            // The pass and weight branches of this cut, resolved when the cutflow tree is booked (see Cutflow::bindCutHandles())
+            RooUtil::BranchHandle<bool> pass_handle;
+            RooUtil::BranchHandle<float> weight_handle;
+#endif
 //            std::vector<TString> hists1d;
 //            std::vector<std::tuple<TString, TString>> hists2d;
 #ifdef USE_CUTLAMBDA
@@ -92,19 +674,32 @@ namespace RooUtil
             std::map<TString, std::vector<std::tuple<THist*, std::function<std::vector<float>()>, std::function<std::vector<float>()>>>> hists1dvec;
             std::map<TString, std::vector<std::tuple<TH2F*, std::function<float()>, std::function<float()>>>> hists2d;
             std::map<TString, std::vector<std::tuple<TH2F*, std::function<std::vector<float>()>, std::function<std::vector<float>()>, std::function<std::vector<float>()>>>> hists2dvec;
+            // Weight variations of the "Nominal" histograms (same ordering as hists1d["Nominal"] etc., null if the histogram has none)
+            std::vector<WgtVarHist*> wgtvarhists1d;
+            std::vector<WgtVarHist*> wgtvarhists1dvec;
+            std::vector<WgtVarHist*> wgtvarhists2d;
+            std::vector<WgtVarHist*> wgtvarhists2dvec;
 #else
             std::map<TString, std::vector<std::tuple<THist*, TString>>> hists1d;
             std::map<TString, std::vector<std::tuple<TH2F*, TString, TString>>> hists2d;
 #endif
-            std::vector<std::tuple<int, int, unsigned long long>> eventlist;
-            CutTree(TString n) : name(n), parent(0), pass(false), weight(0) {}
+            CutEventList eventlist;
+            CutTree(TString n) : name(n), parent(0), pass(false), weight(0), typed_chain_head(false), profile(0) {}
             ~CutTree()
             {
+                if (profile)
+                    delete profile;
                 for (auto& child : children)
                 {
                     if (child)
                         delete child;
                 }
+#ifdef USE_CUTLAMBDA
+                for (auto& wvh : wgtvarhists1d   ) if (wvh) delete wvh;
+                for (auto& wvh : wgtvarhists1dvec) if (wvh) delete wvh;
+                for (auto& wvh : wgtvarhists2d   ) if (wvh) delete wvh;
+                for (auto& wvh : wgtvarhists2dvec) if (wvh) delete wvh;
+#endif
             }
             void printCuts(int indent=0, std::vector<int> multichild=std::vector<int>())
             {
@@ -116,7 +711,7 @@ namespace RooUtil
                     TString header = "Cut name";
                     int extra = colsize - header.Length();
                     for (int i = 0; i < extra; ++i) header += " ";
-                    header += "|pass|weight|systs";
+                    header += profile ? "|pass|weight|nevals|passfrac|t_cut[s]|t_wgt[s]|t_hist[s]|systs" : "|pass|weight|systs";
                     print(header);
                     TString delimiter = "";
                     for (int i = 0; i < w.ws_col-10; ++i) delimiter += "=";
@@ -141,6 +736,8 @@ namespace RooUtil
                     msg += " ";
                 //msg += TString::Format("| %d | %.5f|", pass, weight);
                 msg += TString::Format("| %d | %f|", pass, weight);
+                if (profile)
+                    msg += TString::Format(" %llu | %.4f | %.3f | %.3f | %.3f |", profile->nevals, profile->passFraction(), profile->timeCut(), profile->timeWeight(), profile->timeHist());
                 for (auto& key : systs)
                 {
                     msg += key.first + " ";
@@ -156,33 +753,33 @@ namespace RooUtil
             void printEventList()
             {
                 print(TString::Format("Print event list for the cut = %s", name.Data()));
-                for (auto& eventid : eventlist)
+                for (unsigned int i = 0; i < eventlist.size(); ++i)
                 {
-                    int run = std::get<0>(eventid);
-                    int lumi = std::get<1>(eventid);
-                    unsigned long long evt = std::get<2>(eventid);
-                    TString msg = TString::Format("%d:%d:%llu", run, lumi, evt);
+                    TString msg = TString::Format("%d:%d:%llu", eventlist.runs[i], eventlist.lumis[i], eventlist.evts[i]);
                     std::cout << msg << std::endl;
                 }
             }
             void writeEventList(TString ofilename)
             {
                 std::ofstream outFile(ofilename);
-                for (auto& tuple : eventlist)
-                {
-                    int run = std::get<0>(tuple);
-                    int lumi = std::get<1>(tuple);
-                    unsigned long long evt = std::get<2>(tuple);
-                    outFile << run << ":" << lumi << ":" << evt << std::endl;
-                }
+                for (unsigned int i = 0; i < eventlist.size(); ++i)
+                    outFile << eventlist.runs[i] << ":" << eventlist.lumis[i] << ":" << eventlist.evts[i] << std::endl;
                 outFile.close();
             }
-            void addCut(TString n)
+            void writeEventListBinary(TString ofilename) { eventlist.writeBinary(ofilename); }
+            void setEventListHandles(const int* run, const int* lumi, const unsigned long long* evt)
+            {
+                eventlist.setHandles(run, lumi, evt);
+                for (auto& child : children)
+                    child->setEventListHandles(run, lumi, evt);
+            }
+            CutTree* addCut(TString n)
             {
                 CutTree* obj = new CutTree(n);
                 obj->parent = this;
                 obj->parents.push_back(this);
                 children.push_back(obj);
+                return obj;
             }
             void addSyst(TString syst)
             {
@@ -204,31 +801,80 @@ namespace RooUtil
             void addHist1D(THist* h, std::function<float()> var, TString syst)
             {
                 if (syst.IsNull())
+                {
                     hists1d["Nominal"].push_back(std::make_tuple(h, var));
+                    wgtvarhists1d.push_back(0);
+                }
                 else
                     hists1d[syst].push_back(std::make_tuple(h, var));
             }
             void addHist1DVec(THist* h, std::function<std::vector<float>()> var, std::function<std::vector<float>()> wgt, TString syst)
             {
                 if (syst.IsNull())
+                {
                     hists1dvec["Nominal"].push_back(std::make_tuple(h, var, wgt));
+                    wgtvarhists1dvec.push_back(0);
+                }
                 else
                     hists1dvec[syst].push_back(std::make_tuple(h, var, wgt));
             }
             void addHist2D(TH2F* h, std::function<float()> varx, std::function<float()> vary, TString syst)
             {
                 if (syst.IsNull())
+                {
                     hists2d["Nominal"].push_back(std::make_tuple(h, varx, vary));
+                    wgtvarhists2d.push_back(0);
+                }
                 else
                     hists2d[syst].push_back(std::make_tuple(h, varx, vary));
             }
             void addHist2DVec(TH2F* h, std::function<std::vector<float>()> varx, std::function<std::vector<float>()> vary, std::function<std::vector<float>()> elemwgt, TString syst)
             {
                 if (syst.IsNull())
+                {
                     hists2dvec["Nominal"].push_back(std::make_tuple(h, varx, vary, elemwgt));
+                    wgtvarhists2dvec.push_back(0);
+                }
                 else
                     hists2dvec[syst].push_back(std::make_tuple(h, varx, vary, elemwgt));
             }
+            // Slot of the WgtVarHist of the nominal histogram "hnominal" in one of the hists maps (0 if it is not in there)
+            template <class HistMap>
+            static WgtVarHist** findWgtVarHist(HistMap& hists, std::vector<WgtVarHist*>& wgtvarhists, TH1* hnominal)
+            {
+                auto it = hists.find("Nominal");
+                if (it == hists.end())
+                    return 0;
+                for (unsigned int i = 0; i < it->second.size(); ++i)
+                    if (std::get<0>(it->second[i]) == hnominal)
+                        return &wgtvarhists[i];
+                return 0;
+            }
+            // Attach "hvar" as a weight variation of the already booked nominal histogram "hnominal"
+            // Returns the WgtVarHist object holding the variations (created on first call)
+            WgtVarHist* addWgtVarHist(TH1* hnominal, TH1* hvar, unsigned int varidx)
+            {
+                WgtVarHist** wvh = findWgtVarHist(hists1d, wgtvarhists1d, hnominal);
+                if (!wvh) wvh = findWgtVarHist(hists1dvec, wgtvarhists1dvec, hnominal);
+                if (!wvh) wvh = findWgtVarHist(hists2d, wgtvarhists2d, hnominal);
+                if (!wvh) wvh = findWgtVarHist(hists2dvec, wgtvarhists2dvec, hnominal);
+                if (!wvh)
+                {
+                    RooUtil::error(TString::Format("addWgtVarHist():: Asked to add weight variation %s to the cut %s, but did not find the nominal histogram %s", hvar->GetName(), name.Data(), hnominal->GetName()));
+                    return 0;
+                }
+                if (!(*wvh))
+                    *wvh = new WgtVarHist(hnominal);
+                (*wvh)->addVariation(hvar, varidx);
+                return *wvh;
+            }
+            void flushWgtVarHists()
+            {
+                for (auto& wvh : wgtvarhists1d   ) if (wvh) wvh->flush();
+                for (auto& wvh : wgtvarhists1dvec) if (wvh) wvh->flush();
+                for (auto& wvh : wgtvarhists2d   ) if (wvh) wvh->flush();
+                for (auto& wvh : wgtvarhists2dvec) if (wvh) wvh->flush();
+            }
 #else
             void addHist1D(THist* h, TString var, TString syst)
             {
@@ -400,10 +1046,49 @@ namespace RooUtil
                 {
                     if (cutsystname.IsNull())
                     {
-                        if (pass_this_cut_func)
+                        if (typed_chain)
+                        {
+                            // The head evaluates the whole chain inline and sets pass and weight of all its nodes
+                            if (typed_chain_head)
+                            {
+                                if (profile and *profile->timing)
+                                {
+                                    double t0 = CutProfile::now();
+                                    typed_chain->evaluate(aggregated_pass, aggregated_weight);
+                                    profile->time_cut += CutProfile::now() - t0;
+                                    profile->ntimed++;
+                                }
+                                else
+                                {
+                                    typed_chain->evaluate(aggregated_pass, aggregated_weight);
+                                }
+                            }
+                            if (profile)
+                                profile->count(pass);
+                            if (!pass)
+                                return;
+                        }
+                        else if (pass_this_cut_func)
                         {
-                            pass = pass_this_cut_func() && aggregated_pass;
-                            weight = weight_this_cut_func() * aggregated_weight;
+                            if (profile and *profile->timing)
+                            {
+                                double t0 = CutProfile::now();
+                                bool p = pass_this_cut_func();
+                                double t1 = CutProfile::now();
+                                float w = weight_this_cut_func();
+                                profile->time_weight += CutProfile::now() - t1;
+                                profile->time_cut += t1 - t0;
+                                profile->ntimed++;
+                                pass = p && aggregated_pass;
+                                weight = w * aggregated_weight;
+                            }
+                            else
+                            {
+                                pass = pass_this_cut_func() && aggregated_pass;
+                                weight = weight_this_cut_func() * aggregated_weight;
+                            }
+                            if (profile)
+                                profile->count(pass);
                             if (!pass)
                                 return;
                         }
@@ -454,12 +1139,7 @@ namespace RooUtil
                     }
                 }
                 if (doeventlist and pass and cutsystname.IsNull())
-                {
-                    if (tx.hasBranch<int>("run") && tx.hasBranch<int>("lumi") && tx.hasBranch<unsigned long long>("evt"))
-                    {
-                        eventlist.push_back(std::make_tuple(tx.getBranch<int>("run"), tx.getBranch<int>("lumi"), tx.getBranch<unsigned long long>("evt")));
-                    }
-                }
+                    eventlist.record();
                 for (auto& child : children)
                     child->evaluate_use_lambda(tx, cutsystname, doeventlist, pass, weight);
             }
@@ -499,12 +1179,7 @@ namespace RooUtil
                     }
                 }
                 if (doeventlist and pass and cutsystname.IsNull())
-                {
-                    if (tx.hasBranch<int>("run") && tx.hasBranch<int>("lumi") && tx.hasBranch<unsigned long long>("evt"))
-                    {
-                        eventlist.push_back(std::make_tuple(tx.getBranch<int>("run"), tx.getBranch<int>("lumi"), tx.getBranch<unsigned long long>("evt")));
-                    }
-                }
+                    eventlist.record();
                 for (auto& child : children)
                     child->evaluate_use_internal_variable(tx, cutsystname, doeventlist, pass, weight);
             }
@@ -543,26 +1218,13 @@ namespace RooUtil
                     }
                 }
                 if (doeventlist and pass and cutsystname.IsNull())
-                {
-                    if (tx.hasBranch<int>("run") && tx.hasBranch<int>("lumi") && tx.hasBranch<unsigned long long>("evt"))
-                    {
-                        eventlist.push_back(std::make_tuple(tx.getBranch<int>("run"), tx.getBranch<int>("lumi"), tx.getBranch<unsigned long long>("evt")));
-                    }
-                }
+                    eventlist.record();
                 for (auto& child : children)
                     child->evaluate_use_ttreex(tx, cutsystname, doeventlist, pass, weight);
             }
             void sortEventList()
             {
-                std::sort(eventlist.begin(), eventlist.end(),
-                        [](const std::tuple<int, int, unsigned long long>& a, const std::tuple<int, int, unsigned long long>& b)
-                        {
-                            if (std::get<0>(a) != std::get<0>(b)) return std::get<0>(a) < std::get<0>(b);
-                            else if (std::get<1>(a) != std::get<1>(b)) return std::get<1>(a) < std::get<1>(b);
-                            else if (std::get<2>(a) != std::get<2>(b)) return std::get<2>(a) < std::get<2>(b);
-                            else return true;
-                        }
-                        );
+                eventlist.sort();
             }
             void clearEventList()
             {
@@ -570,54 +1232,69 @@ namespace RooUtil
             }
             void addEventList(int run, int lumi, unsigned long long evt)
             {
-                eventlist.push_back(std::make_tuple(run, lumi, evt));
+                eventlist.add(run, lumi, evt);
             }
 #ifdef USE_CUTLAMBDA
-            void fillHistograms(TString syst, float extrawgt)
+            void fillHistograms(TString syst, float extrawgt, const std::vector<float>* wgtvars=0)
             {
                 // If the cut didn't pass then stop
                 if (!pass)
                     return;
 
+                // If the weight variations are provided, the nominal histograms also accumulate all the weight variations at once
+                bool dowgtvar = wgtvars and syst.IsNull();
+
+                double t0 = (profile and *profile->timing) ? CutProfile::now() : -1;
+
                 if (hists1d.size() != 0 or hists2d.size() != 0 or hists2dvec.size() != 0 or hists1dvec.size() != 0)
                 {
                     TString systkey = syst.IsNull() ? "Nominal" : syst;
-                    for (auto& tuple : hists1d[systkey])
+                    std::vector<std::tuple<THist*, std::function<float()>>>& h1ds = hists1d[systkey];
+                    for (unsigned int ih = 0; ih < h1ds.size(); ++ih)
                     {
-                        THist* h = std::get<0>(tuple);
-                        std::function<float()> vardef = std::get<1>(tuple);
-                        h->Fill(vardef(), weight * extrawgt);
+                        THist* h = std::get<0>(h1ds[ih]);
+                        std::function<float()>& vardef = std::get<1>(h1ds[ih]);
+                        int bin = h->Fill(vardef(), weight * extrawgt);
+                        if (dowgtvar and wgtvarhists1d[ih])
+                            wgtvarhists1d[ih]->fill(bin, weight * extrawgt, *wgtvars);
                     }
-                    for (auto& tuple : hists2d[systkey])
+                    std::vector<std::tuple<TH2F*, std::function<float()>, std::function<float()>>>& h2ds = hists2d[systkey];
+                    for (unsigned int ih = 0; ih < h2ds.size(); ++ih)
                     {
-                        TH2F* h = std::get<0>(tuple);
-                        std::function<float()> varxdef = std::get<1>(tuple);
-                        std::function<float()> varydef = std::get<2>(tuple);
-                        h->Fill(varxdef(), varydef(), weight * extrawgt);
+                        TH2F* h = std::get<0>(h2ds[ih]);
+                        std::function<float()>& varxdef = std::get<1>(h2ds[ih]);
+                        std::function<float()>& varydef = std::get<2>(h2ds[ih]);
+                        int bin = h->Fill(varxdef(), varydef(), weight * extrawgt);
+                        if (dowgtvar and wgtvarhists2d[ih])
+                            wgtvarhists2d[ih]->fill(bin, weight * extrawgt, *wgtvars);
                     }
-                    for (auto& tuple : hists1dvec[systkey])
+                    std::vector<std::tuple<THist*, std::function<std::vector<float>()>, std::function<std::vector<float>()>>>& h1dvecs = hists1dvec[systkey];
+                    for (unsigned int ih = 0; ih < h1dvecs.size(); ++ih)
                     {
-                        THist* h = std::get<0>(tuple);
-                        std::function<std::vector<float>()> vardef = std::get<1>(tuple);
-                        std::function<std::vector<float>()> wgtdef = std::get<2>(tuple);
+                        THist* h = std::get<0>(h1dvecs[ih]);
+                        std::function<std::vector<float>()>& vardef = std::get<1>(h1dvecs[ih]);
+                        std::function<std::vector<float>()>& wgtdef = std::get<2>(h1dvecs[ih]);
+                        WgtVarHist* wvh = dowgtvar ? wgtvarhists1dvec[ih] : 0;
                         std::vector<float> varx = vardef();
                         std::vector<float> elemwgts;
                         if (wgtdef)
                             elemwgts = wgtdef();
                         for (unsigned int i = 0; i < varx.size(); ++i)
                         {
-                            if (wgtdef)
-                                h->Fill(varx[i], weight * extrawgt * elemwgts[i]);
-                            else
-                                h->Fill(varx[i], weight * extrawgt);
+                            float w = wgtdef ? weight * extrawgt * elemwgts[i] : weight * extrawgt;
+                            int bin = h->Fill(varx[i], w);
+                            if (wvh)
+                                wvh->fill(bin, w, *wgtvars);
                         }
                     }
-                    for (auto& tuple : hists2dvec[systkey])
+                    std::vector<std::tuple<TH2F*, std::function<std::vector<float>()>, std::function<std::vector<float>()>, std::function<std::vector<float>()>>>& h2dvecs = hists2dvec[systkey];
+                    for (unsigned int ih = 0; ih < h2dvecs.size(); ++ih)
                     {
-                        TH2F* h = std::get<0>(tuple);
-                        std::function<std::vector<float>()> varxdef = std::get<1>(tuple);
-                        std::function<std::vector<float>()> varydef = std::get<2>(tuple);
-                        std::function<std::vector<float>()> wgtdef  = std::get<3>(tuple);
+                        TH2F* h = std::get<0>(h2dvecs[ih]);
+                        std::function<std::vector<float>()>& varxdef = std::get<1>(h2dvecs[ih]);
+                        std::function<std::vector<float>()>& varydef = std::get<2>(h2dvecs[ih]);
+                        std::function<std::vector<float>()>& wgtdef  = std::get<3>(h2dvecs[ih]);
+                        WgtVarHist* wvh = dowgtvar ? wgtvarhists2dvec[ih] : 0;
                         std::vector<float> varx = varxdef();
                         std::vector<float> vary = varydef();
                         if (varx.size() != vary.size())
@@ -631,15 +1308,17 @@ namespace RooUtil
                             elemwgts = wgtdef();
                         for (unsigned int i = 0; i < varx.size(); ++i)
                         {
-                            if (wgtdef)
-                                h->Fill(varx[i], vary[i], weight * extrawgt * elemwgts[i]);
-                            else
-                                h->Fill(varx[i], vary[i], weight * extrawgt);
+                            float w = wgtdef ? weight * extrawgt * elemwgts[i] : weight * extrawgt;
+                            int bin = h->Fill(varx[i], vary[i], w);
+                            if (wvh)
+                                wvh->fill(bin, w, *wgtvars);
                         }
                     }
                 }
+                if (t0 >= 0)
+                    profile->time_hist += CutProfile::now() - t0;
                 for (auto& child : children)
-                    child->fillHistograms(syst, extrawgt);
+                    child->fillHistograms(syst, extrawgt, wgtvars);
             }
 #else
             void fillHistograms(RooUtil::TTreeX& tx, TString syst, float extrawgt)
@@ -697,6 +1376,42 @@ namespace RooUtil
             }
 #endif
     };
+
+    // Chain of typed cuts (each one applied on top of the previous one) stored in a std::tuple so that the evaluation is inlined
+    // The per-cut passAt()/weightAt() are used as the std::function fallback (e.g. for the cut systematics)
+    template <class... Cuts>
+    class TypedCutChain : public CutChainBase
+    {
+        public:
+            std::tuple<Cuts...> cuts;
+            TypedCutChain(Cuts... c) : cuts(c...) {}
+            void evaluate(bool aggregated_pass, float aggregated_weight) override { evaluateFrom<0>(aggregated_pass, aggregated_weight); }
+            bool passAt(unsigned int i) override { return passAt<0>(i); }
+            float weightAt(unsigned int i) override { return weightAt<0>(i); }
+        private:
+            template <size_t I>
+            typename std::enable_if<(I < sizeof...(Cuts))>::type evaluateFrom(bool aggregated_pass, float aggregated_weight)
+            {
+                if (I >= nodes.size())
+                    return;
+                CutTree* node = nodes[I];
+                node->pass = std::get<I>(cuts).pass() && aggregated_pass;
+                node->weight = std::get<I>(cuts).weight() * aggregated_weight;
+                if (!node->pass)
+                    return;
+                evaluateFrom<I+1>(node->pass, node->weight);
+            }
+            template <size_t I>
+            typename std::enable_if<(I == sizeof...(Cuts))>::type evaluateFrom(bool, float) {}
+            template <size_t I>
+            typename std::enable_if<(I < sizeof...(Cuts)), bool>::type passAt(unsigned int i) { return i == I ? std::get<I>(cuts).pass() : passAt<I+1>(i); }
+            template <size_t I>
+            typename std::enable_if<(I == sizeof...(Cuts)), bool>::type passAt(unsigned int) { return false; }
+            template <size_t I>
+            typename std::enable_if<(I < sizeof...(Cuts)), float>::type weightAt(unsigned int i) { return i == I ? std::get<I>(cuts).weight() : weightAt<I+1>(i); }
+            template <size_t I>
+            typename std::enable_if<(I == sizeof...(Cuts)), float>::type weightAt(unsigned int) { return 0; }
+    };
 }
 
 #endif
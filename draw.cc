@@ -1,5 +1,23 @@
 #include "draw.h"
 
+#include "TInterpreter.h"
+#include "TH2F.h"
+#include "TLeaf.h"
+#include "TBranch.h"
+#include "TFile.h"
+#include "TMD5.h"
+#include "TFriendElement.h"
+#include "TList.h"
+#include "TSystem.h"
+#include "TEntryList.h"
+#include "TEventList.h"
+
+#include <set>
+#include <sstream>
+#include <memory>
+#include <algorithm>
+#include <ctime>
+
 using namespace RooUtil::StringUtil;
 using namespace RooUtil;
 
@@ -148,10 +166,11 @@ RooUtil::DrawUtil::Cuts RooUtil::DrawUtil::compileCuts(RooUtil::DrawUtil::Cuts c
 
 //##################################################################################################################################
 // From a list of "DrawExpr" (just a struct with three TStrings) perform parallel ttree::draw.
-std::map<TString, TH1*> RooUtil::DrawUtil::drawHistograms(TChain* c, RooUtil::DrawUtil::DrawExprs exprs)
+std::map<TString, TH1*> RooUtil::DrawUtil::drawHistograms(TChain* c, RooUtil::DrawUtil::DrawExprs exprs, unsigned int nthreads)
 {
     std::map<TString, TH1*> ret_hists;
     TMultiDrawTreePlayer* p = RooUtil::FileUtil::createTMulti(c);
+    p->setNumberOfThreads(nthreads);
     int nentries = c->GetEntries();
     // Sanity check book keeping. Users cannot book SAME HISTOGRAM TWICE.
     std::vector<TString> histnames;
@@ -176,6 +195,426 @@ std::map<TString, TH1*> RooUtil::DrawUtil::drawHistograms(TChain* c, RooUtil::Dr
     return ret_hists;
 }
 
+//##################################################################################################################################
+// Compiled alternative to drawHistograms(TChain*, DrawExprs).
+// The draws are turned into one C++ function (one pass over the chain, each distinct selection evaluated once per entry) that is
+// compiled through Cling and fills the histograms directly. Only expressions that mean the same thing in C++ as in TTreeFormula
+// are compiled, and they are evaluated in double like TTreeFormula (branches are read into doubles, integer literals are
+// rewritten as double literals, entries are scaled by the tree weight): arithmetic on scalar branches, explicitly indexed std::vector branches (an index out of range drops the entry for
+// that draw, as TTreeFormula does), and a few math functions. Everything else ($ functions, aliases, leaf-list arrays, implicit
+// loops over vectors, ...) is handed to drawHistograms. Histogram names, binnings and errors are the same as drawHistograms.
+
+static const char* jit_functions[] = {"abs", "fabs", "sqrt", "exp", "log", "log10", "pow", "sin", "cos", "tan", "asin", "acos", "atan",
+                                      "atan2", "sinh", "cosh", "tanh", "floor", "ceil", "min", "max"};
+
+// C++ type of a branch usable in compiled draws, or "" if it cannot be
+static TString getJitBranchType(TChain* c, TString name, bool& isvector)
+{
+    TBranch* branch = c->GetBranch(name);
+    if (!branch)
+        return "";
+    TString classname = branch->GetClassName();
+    if (classname.BeginsWith("vector<"))
+    {
+        TString inner = TString(classname(7, classname.Length() - 8)).Strip(TString::kBoth);
+        if (inner != "float" && inner != "double" && inner != "int" && inner != "unsigned int" && inner != "short" && inner != "unsigned short"
+                && inner != "long" && inner != "unsigned long" && inner != "long long" && inner != "unsigned long long" && inner != "char" && inner != "bool")
+            return "";
+        isvector = true;
+        return "std::" + classname;
+    }
+    if (classname != "" || branch->GetListOfLeaves()->GetEntries() != 1)
+        return "";
+    TLeaf* leaf = (TLeaf*) branch->GetListOfLeaves()->At(0);
+    if (leaf->GetLeafCount() || leaf->GetLenStatic() != 1)
+        return "";
+    isvector = false;
+    return leaf->GetTypeName();
+}
+
+// Collects the branches used by a TTreeFormula expression into branches (name -> (type, isvector)). Returns false if the
+// expression cannot be compiled as C++ as it is.
+static bool scanJitExpression(TChain* c, TString expr, std::map<TString, std::pair<TString, bool>>& branches)
+{
+    std::string s = expr.Data();
+    size_t i = 0;
+    while (i < s.size())
+    {
+        char ch = s[i];
+        if (ch == '$' || ch == '^' || ch == '"' || ch == '\'' || ch == '@' || ch == '#' || ch == '{' || ch == ';' || ch == '?' || ch == '%')
+            return false;
+        // a lone "=" is a comparison in TTreeFormula, and bitwise operators would not compile on doubles
+        bool paired = (i + 1 < s.size() && s[i + 1] == ch) || (i > 0 && s[i - 1] == ch);
+        if (ch == '=' && !paired && (i == 0 || (s[i - 1] != '<' && s[i - 1] != '>' && s[i - 1] != '!')))
+            return false;
+        if ((ch == '&' || ch == '|') && !paired)
+            return false;
+        if (isdigit(ch) || (ch == '.' && i + 1 < s.size() && isdigit(s[i + 1])))
+        {
+            size_t start = i;
+            ++i;
+            while (i < s.size() && (isalnum(s[i]) || s[i] == '.' || ((s[i] == '+' || s[i] == '-') && (s[i - 1] == 'e' || s[i - 1] == 'E'))))
+                ++i;
+            // hex and suffixed integer literals have no double spelling in toJitExpression
+            TString literal = s.substr(start, i - start);
+            if (literal.Contains("x") || literal.Contains("X") || literal.EndsWith("u") || literal.EndsWith("U") || literal.EndsWith("l") || literal.EndsWith("L"))
+                return false;
+            continue;
+        }
+        if (ch == '.') // member access
+            return false;
+        if (!isalpha(ch) && ch != '_')
+        {
+            ++i;
+            continue;
+        }
+        size_t start = i;
+        while (i < s.size())
+        {
+            if (isalnum(s[i]) || s[i] == '_') ++i;
+            else if (s.compare(i, 2, "::") == 0) i += 2;
+            else break;
+        }
+        TString name = s.substr(start, i - start);
+        size_t next = s.find_first_not_of(" \t", i);
+        char nextch = next == std::string::npos ? 0 : s[next];
+        if (nextch == '(')
+        {
+            if (!name.BeginsWith("TMath::") && std::find(std::begin(jit_functions), std::end(jit_functions), name) == std::end(jit_functions))
+                return false;
+            continue;
+        }
+        if (name == "true" || name == "false")
+            continue;
+        if (c->GetAlias(name))
+            return false;
+        bool isvector = false;
+        TString type = getJitBranchType(c, name, isvector);
+        if (type == "" || isvector != (nextch == '['))
+            return false;
+        branches[name] = std::make_pair(type, isvector);
+    }
+    return true;
+}
+
+// Rewrites an expression accepted by scanJitExpression so that it is evaluated in double as TTreeFormula does:
+// integer literals get a trailing "." (1/2 is 0.5, not 0). Branches are read into double locals by the generated code.
+static TString toJitExpression(TString expr)
+{
+    std::string s = expr.Data();
+    std::string out;
+    size_t i = 0;
+    while (i < s.size())
+    {
+        if (isalpha(s[i]) || s[i] == '_')
+        {
+            size_t start = i;
+            while (i < s.size() && (isalnum(s[i]) || s[i] == '_' || s[i] == ':'))
+                ++i;
+            out += s.substr(start, i - start);
+            continue;
+        }
+        if (isdigit(s[i]) || (s[i] == '.' && i + 1 < s.size() && isdigit(s[i + 1])))
+        {
+            size_t start = i;
+            ++i;
+            while (i < s.size() && (isalnum(s[i]) || s[i] == '.' || ((s[i] == '+' || s[i] == '-') && (s[i - 1] == 'e' || s[i - 1] == 'E'))))
+                ++i;
+            std::string literal = s.substr(start, i - start);
+            out += literal;
+            if (literal.find_first_not_of("0123456789") == std::string::npos)
+                out += ".";
+            continue;
+        }
+        out += s[i++];
+    }
+    return out;
+}
+
+// Splits "y:x" into its variables, leaving "::" alone
+static std::vector<TString> splitJitVarexp(TString varexp)
+{
+    std::vector<TString> vars;
+    std::string s = varexp.Data();
+    size_t start = 0;
+    for (size_t i = 0; i < s.size(); ++i)
+    {
+        if (s[i] != ':')
+            continue;
+        if ((i + 1 < s.size() && s[i + 1] == ':') || (i > 0 && s[i - 1] == ':'))
+            continue;
+        vars.push_back(TString(s.substr(start, i - start)).Strip(TString::kBoth));
+        start = i + 1;
+    }
+    vars.push_back(TString(s.substr(start)).Strip(TString::kBoth));
+    return vars;
+}
+
+// Parses "var>>name(nbins,lo,hi)" or "y:x>>name(nbx,xlo,xhi,nby,ylo,yhi)". Returns false for anything else.
+static bool parseJitDrawCmd(TString cmd, std::vector<TString>& vars, TString& histname, std::vector<double>& bins, bool& append)
+{
+    Ssiz_t pos = cmd.Index(">>");
+    if (pos == kNPOS)
+        return false;
+    vars = splitJitVarexp(cmd(0, pos));
+    TString target = TString(cmd(pos + 2, cmd.Length() - pos - 2)).Strip(TString::kBoth);
+    append = target.BeginsWith("+");
+    if (append)
+        target = TString(target(1, target.Length() - 1)).Strip(TString::kBoth);
+    Ssiz_t open = target.Index("(");
+    if (open == kNPOS || !target.EndsWith(")"))
+        return false;
+    histname = TString(target(0, open)).Strip(TString::kBoth);
+    bins.clear();
+    for (auto& bin : split(target(open + 1, target.Length() - open - 2), ","))
+    {
+        if (!TString(bin.Strip(TString::kBoth)).IsFloat())
+            return false;
+        bins.push_back(bin.Atof());
+    }
+    return histname != "" && ((vars.size() == 1 && bins.size() == 3) || (vars.size() == 2 && bins.size() == 6));
+}
+
+std::map<TString, TH1*> RooUtil::DrawUtil::drawHistogramsCompiled(TChain* c, RooUtil::DrawUtil::DrawExprs exprs)
+{
+    std::map<TString, TH1*> ret_hists;
+    Long64_t nentries = c->GetEntries();
+    if (nentries <= 0)
+        return ret_hists;
+
+    // Sort out what can be compiled
+    DrawExprs compiled;
+    DrawExprs interpreted;
+    std::vector<std::vector<TString>> compiled_vars;
+    std::vector<TH1*> hists;
+    std::vector<bool> hists_booked; // booked here, i.e. not an existing ">>+" target the caller accumulated into
+    std::vector<TString> histnames;
+    std::map<TString, std::pair<TString, bool>> branches;
+    for (auto& expr : exprs)
+    {
+        TString histname;
+        std::vector<TString> vars;
+        std::vector<double> bins;
+        bool append;
+        std::map<TString, std::pair<TString, bool>> exprbranches;
+        bool ok = parseJitDrawCmd(expr.cmd, vars, histname, bins, append)
+            && scanJitExpression(c, expr.cut, exprbranches) && scanJitExpression(c, expr.wgt, exprbranches);
+        for (auto& var : vars)
+            ok = ok && scanJitExpression(c, var, exprbranches);
+        if (!ok)
+        {
+            interpreted.push_back(expr);
+            continue;
+        }
+        if (std::find(histnames.begin(), histnames.end(), histname) != histnames.end())
+            error(Form("You have booked same histograms! Please fix this problem. offending histname=%s", histname.Data()));
+        histnames.push_back(histname);
+
+        // Book the histogram the way TSelectorDraw does with the "goffe" option of drawHistograms
+        TH1* hist = dynamic_cast<TH1*>(gDirectory->Get(histname));
+        if (hist && (!append || hist->GetDimension() != (int) vars.size()))
+        {
+            delete hist;
+            hist = 0;
+        }
+        bool booked = !hist;
+        if (!hist)
+        {
+            TString title = Form("%s {(%s)*(%s)}", TString(expr.cmd(0, expr.cmd.Index(">>"))).Data(), expr.cut.Data(), expr.wgt.Data());
+            if (vars.size() == 1)
+                hist = new TH1F(histname, title, (int) bins[0], bins[1], bins[2]);
+            else
+                hist = new TH2F(histname, title, (int) bins[0], bins[1], bins[2], (int) bins[3], bins[4], bins[5]);
+            hist->Sumw2();
+        }
+        compiled.push_back(expr);
+        compiled_vars.push_back(vars);
+        hists.push_back(hist);
+        hists_booked.push_back(booked);
+        branches.insert(exprbranches.begin(), exprbranches.end());
+    }
+
+    if (compiled.size() > 0)
+    {
+        // Distinct selections, each evaluated once per entry
+        std::vector<TString> sels;
+        std::vector<size_t> sel_index;
+        for (auto& expr : compiled)
+        {
+            TString sel = Form("(%s)*(%s)", expr.cut.IsWhitespace() ? "1." : toJitExpression(expr.cut).Data(), expr.wgt.IsWhitespace() ? "1." : toJitExpression(expr.wgt).Data());
+            auto it = std::find(sels.begin(), sels.end(), sel);
+            sel_index.push_back(it - sels.begin());
+            if (it == sels.end())
+                sels.push_back(sel);
+        }
+
+        std::ostringstream code;
+        code << "#pragma cling optimize(3)\n";
+        code << "namespace RooUtilJit {\n";
+        code << "void FUNCNAME(TTree* rooutil_jit_tree, TH1** rooutil_jit_hists, Long64_t rooutil_jit_nentries) {\n";
+        code << "    bool rooutil_jit_invalid = false;\n";
+        for (auto& branch : branches)
+        {
+            const char* name = branch.first.Data();
+            const char* type = branch.second.first.Data();
+            if (branch.second.second)
+                code << "    " << type << "* " << name << "__ptr = 0;\n";
+            else
+                code << "    " << type << " " << name << "__raw = 0;\n";
+            code << "    TBranch* " << name << "__branch = 0;\n";
+            code << "    rooutil_jit_tree->SetBranchAddress(\"" << name << "\", &" << name << (branch.second.second ? "__ptr" : "__raw") << ", &" << name << "__branch);\n";
+        }
+        code << "    for (Long64_t rooutil_jit_entry = 0; rooutil_jit_entry < rooutil_jit_nentries; ++rooutil_jit_entry) {\n";
+        code << "        Long64_t rooutil_jit_local = rooutil_jit_tree->LoadTree(rooutil_jit_entry);\n";
+        code << "        if (rooutil_jit_local < 0) break;\n";
+        for (auto& branch : branches)
+        {
+            const char* name = branch.first.Data();
+            code << "        " << name << "__branch->GetEntry(rooutil_jit_local);\n";
+            if (branch.second.second)
+                code << "        Vec<" << branch.second.first << " > " << name << "(" << name << "__ptr, rooutil_jit_invalid);\n";
+            else
+                code << "        double " << name << " = " << name << "__raw;\n";
+        }
+        // TSelectorDraw scales every entry by the weight of the tree it comes from
+        code << "        double rooutil_jit_weight = rooutil_jit_tree->GetWeight();\n";
+        for (size_t isel = 0; isel < sels.size(); ++isel)
+        {
+            code << "        rooutil_jit_invalid = false;\n";
+            code << "        double rooutil_jit_sel" << isel << " = " << sels[isel] << " * rooutil_jit_weight;\n";
+            code << "        if (rooutil_jit_invalid) rooutil_jit_sel" << isel << " = 0;\n";
+        }
+        for (size_t idraw = 0; idraw < compiled.size(); ++idraw)
+        {
+            const std::vector<TString>& vars = compiled_vars[idraw];
+            code << "        if (rooutil_jit_sel" << sel_index[idraw] << " != 0) {\n";
+            code << "            rooutil_jit_invalid = false;\n";
+            if (vars.size() == 1)
+            {
+                code << "            double rooutil_jit_x = " << toJitExpression(vars[0]) << ";\n";
+                code << "            if (!rooutil_jit_invalid) rooutil_jit_hists[" << idraw << "]->Fill(rooutil_jit_x, rooutil_jit_sel" << sel_index[idraw] << ");\n";
+            }
+            else
+            {
+                code << "            double rooutil_jit_y = " << toJitExpression(vars[0]) << ";\n";
+                code << "            double rooutil_jit_x = " << toJitExpression(vars[1]) << ";\n";
+                code << "            if (!rooutil_jit_invalid) ((TH2*) rooutil_jit_hists[" << idraw << "])->Fill(rooutil_jit_x, rooutil_jit_y, rooutil_jit_sel" << sel_index[idraw] << ");\n";
+            }
+            code << "        }\n";
+        }
+        code << "    }\n";
+        code << "    rooutil_jit_tree->ResetBranchAddresses();\n";
+        for (auto& branch : branches)
+            if (branch.second.second)
+                code << "    delete " << branch.first << "__ptr;\n";
+        code << "}\n";
+        code << "}\n";
+
+        // Declared once per distinct set of draws
+        static std::set<TString> declared;
+        TString funcname = Form("draw_%zx", std::hash<std::string>()(code.str()));
+        TString source = code.str();
+        source.ReplaceAll("FUNCNAME", funcname);
+        if (!declared.count(funcname))
+        {
+            static bool support_declared = false;
+            if (!support_declared)
+            {
+                gInterpreter->Declare(
+                        "#include \"TTree.h\"\n"
+                        "#include \"TH1.h\"\n"
+                        "#include \"TH2.h\"\n"
+                        "#include \"TMath.h\"\n"
+                        "#include <cmath>\n"
+                        "#include <vector>\n"
+                        "namespace RooUtilJit {\n"
+                        "template <class T> struct Vec {\n"
+                        "    const T* v; bool& invalid;\n"
+                        "    Vec(const T* v_, bool& invalid_) : v(v_), invalid(invalid_) {}\n"
+                        "    double operator[](long i) const { if (i < 0 || i >= (long) v->size()) { invalid = true; return 0; } return (*v)[i]; }\n"
+                        "};\n"
+                        "inline double abs(double x) { return std::fabs(x); }\n"
+                        "inline double fabs(double x) { return std::fabs(x); }\n"
+                        "inline double sqrt(double x) { return std::sqrt(x); }\n"
+                        "inline double exp(double x) { return std::exp(x); }\n"
+                        "inline double log(double x) { return std::log(x); }\n"
+                        "inline double log10(double x) { return std::log10(x); }\n"
+                        "inline double pow(double x, double y) { return std::pow(x, y); }\n"
+                        "inline double sin(double x) { return std::sin(x); }\n"
+                        "inline double cos(double x) { return std::cos(x); }\n"
+                        "inline double tan(double x) { return std::tan(x); }\n"
+                        "inline double asin(double x) { return std::asin(x); }\n"
+                        "inline double acos(double x) { return std::acos(x); }\n"
+                        "inline double atan(double x) { return std::atan(x); }\n"
+                        "inline double atan2(double y, double x) { return std::atan2(y, x); }\n"
+                        "inline double sinh(double x) { return std::sinh(x); }\n"
+                        "inline double cosh(double x) { return std::cosh(x); }\n"
+                        "inline double tanh(double x) { return std::tanh(x); }\n"
+                        "inline double floor(double x) { return std::floor(x); }\n"
+                        "inline double ceil(double x) { return std::ceil(x); }\n"
+                        "inline double min(double x, double y) { return x < y ? x : y; }\n"
+                        "inline double max(double x, double y) { return x > y ? x : y; }\n"
+                        "}\n");
+                support_declared = true;
+            }
+            if (!gInterpreter->Declare(source))
+                warning("Failed to compile the draws, drawing them through TTreeFormula instead");
+            else
+                declared.insert(funcname);
+        }
+
+        // The content the ">>+" targets had is restored if the compiled code fails midway
+        std::vector<std::unique_ptr<TH1>> snapshots(hists.size());
+        TInterpreter::EErrorCode status = TInterpreter::kFatal; // until it ran without error
+        if (declared.count(funcname))
+        {
+            for (size_t idraw = 0; idraw < hists.size(); ++idraw)
+            {
+                if (hists_booked[idraw])
+                    continue;
+                snapshots[idraw].reset((TH1*) hists[idraw]->Clone());
+                snapshots[idraw]->SetDirectory(0);
+            }
+            print(Form("Filling %zu histograms from %zu distinct selections with compiled code", compiled.size(), sels.size()));
+            RooUtil::start();
+            gInterpreter->ProcessLine(Form("RooUtilJit::%s((TTree*)0x%lx, (TH1**)0x%lx, %lld);", funcname.Data(), (ULong_t) c, (ULong_t) hists.data(), nentries), &status);
+            RooUtil::end();
+            if (status != TInterpreter::kNoError)
+                warning("Failed to run the compiled draws, drawing them through TTreeFormula instead");
+        }
+        if (status == TInterpreter::kNoError)
+        {
+            for (size_t idraw = 0; idraw < compiled.size(); ++idraw)
+                ret_hists[histnames[idraw]] = hists[idraw];
+        }
+        else
+        {
+            // Only the histograms booked here are dropped (drawHistograms books them again), the others go back to what the caller had
+            for (size_t idraw = 0; idraw < hists.size(); ++idraw)
+            {
+                if (hists_booked[idraw])
+                {
+                    delete hists[idraw];
+                }
+                else if (snapshots[idraw])
+                {
+                    hists[idraw]->Reset();
+                    hists[idraw]->Add(snapshots[idraw].get());
+                }
+            }
+            interpreted.insert(interpreted.end(), compiled.begin(), compiled.end());
+        }
+    }
+
+    if (interpreted.size() > 0)
+    {
+        print(Form("Drawing %zu histograms through TTreeFormula", interpreted.size()));
+        std::map<TString, TH1*> interpreted_hists = drawHistograms(c, interpreted);
+        ret_hists.insert(interpreted_hists.begin(), interpreted_hists.end());
+    }
+    return ret_hists;
+}
+
 void RooUtil::DrawUtil::printHistDefs(HistDefs histdefs) { for (auto& h : histdefs) h.print(); }
 void RooUtil::DrawUtil::printCuts(Cuts cuts) { for (auto& c : cuts) c.print(); }
 void RooUtil::DrawUtil::printDrawExprs(DrawExprs exprs) { for (auto& e : exprs) e.print(); }
@@ -184,34 +623,330 @@ void RooUtil::DrawUtil::printDrawExprs(DrawExprs exprs) { for (auto& e : exprs)
 //==================================================================================================================================
 //==================================================================================================================================
 
-std::map<TString, TH1*> RooUtil::DrawUtil::drawHistograms(TChain* c, json& j, TString prefix, bool nowgt)
+//##################################################################################################################################
+// On-disk histogram cache for drawHistograms(TChain*, json&, ...)
+//
+// Each draw is stored as "<cachedir>/<md5>.root" holding a single histogram named "hist".
+// The md5 is taken over the chain's inputs (tree name, every file with its size and modification time,
+// the chain weight, the entry or event list, the aliases and the friend trees with their files) and the
+// varexp, binning, cut and weight stripped of whitespace outside of string literals. The histogram name
+// is not part of the key so renaming a histogram reuses its cached content. Any change in the inputs
+// invalidates every entry.
+//
+// Entries are never overwritten, so the directory is pruned after every drawHistograms call: the least
+// recently used entries (a hit refreshes the modification time) are removed until the directory is under
+// the size set with setDrawCacheMaxSize, and temporary files left over by crashed jobs are removed after a day.
+//
+
+static double drawcache_maxgb = 10;
+
+//__________________________________________________________________________________________________________________________________
+void RooUtil::DrawUtil::setDrawCacheMaxSize(double maxgb)
+{
+    drawcache_maxgb = maxgb;
+}
+
+//__________________________________________________________________________________________________________________________________
+static TString getEntryListSignature(TTree* t)
+{
+    // The entries themselves are hashed, as lists are commonly rebuilt under the same name
+    TMD5 md5;
+    Long64_t n = 0;
+    if (TEntryList* elist = t->GetEntryList())
+    {
+        n = elist->GetN();
+        for (Long64_t i = 0; i < n; ++i)
+        {
+            Long64_t entry = elist->GetEntry(i);
+            md5.Update((const UChar_t*) &entry, sizeof(entry));
+        }
+    }
+    else if (TEventList* evlist = t->GetEventList())
+    {
+        n = evlist->GetN();
+        md5.Update((const UChar_t*) evlist->GetList(), n * sizeof(Long64_t));
+    }
+    else
+    {
+        return "";
+    }
+    md5.Final();
+    return Form(";entrylist:%lld:%s", n, md5.AsString());
+}
+
+//__________________________________________________________________________________________________________________________________
+static TString getDrawCacheInputSignature(TChain* c)
+{
+    // Returns an empty string if any of the inputs cannot be stat'ed, which disables the cache
+    TString signature = c->GetName();
+    TObjArray* files = c->GetListOfFiles();
+    for (int ifile = 0; ifile < files->GetEntries(); ++ifile)
+    {
+        TString path = files->At(ifile)->GetTitle();
+        FileStat_t stat;
+        if (gSystem->GetPathInfo(path, stat) != 0)
+        {
+            warning(Form("Could not stat %s, the draw cache is disabled for this chain", path.Data()), __FUNCTION__);
+            return "";
+        }
+        signature += Form(";%s:%lld:%ld", path.Data(), stat.fSize, stat.fMtime);
+    }
+
+    // A global chain weight overrides the tree weights (which come with the files) in every fill
+    if (c->TestBit(TChain::kGlobalWeight))
+        signature += Form(";weight:%.17g", c->GetWeight());
+    signature += getEntryListSignature(c);
+
+    // The aliases and friends change what the expressions evaluate to
+    if (TList* aliases = c->GetListOfAliases())
+    {
+        for (TObject* alias : *aliases)
+            signature += Form(";alias:%s=%s", alias->GetName(), alias->GetTitle());
+    }
+    if (TList* friends = c->GetListOfFriends())
+    {
+        for (TObject* obj : *friends)
+        {
+            TFriendElement* fe = (TFriendElement*) obj;
+            signature += Form(";friend:%s:%s", fe->GetName(), fe->GetTitle());
+            if (TChain* fc = dynamic_cast<TChain*>(fe->GetTree()))
+            {
+                TString fsignature = getDrawCacheInputSignature(fc);
+                if (fsignature.IsNull())
+                    return "";
+                signature += "{" + fsignature + "}";
+            }
+            else if (TString(fe->GetTitle()).Length() > 0)
+            {
+                FileStat_t stat;
+                if (gSystem->GetPathInfo(fe->GetTitle(), stat) != 0)
+                {
+                    warning(Form("Could not stat friend file %s, the draw cache is disabled for this chain", fe->GetTitle()), __FUNCTION__);
+                    return "";
+                }
+                signature += Form(":%lld:%ld", stat.fSize, stat.fMtime);
+            }
+        }
+    }
+    return signature;
+}
+
+//__________________________________________________________________________________________________________________________________
+static TString normalizeDrawCacheExpr(const TString& expr)
+{
+    // Whitespace inside string literals (e.g. "name == \"a b\"") is significant and kept
+    TString normalized;
+    char quote = 0;
+    for (Ssiz_t i = 0; i < expr.Length(); ++i)
+    {
+        char ch = expr[i];
+        if (quote)
+        {
+            if (ch == '\\' and i + 1 < expr.Length())
+            {
+                normalized += ch;
+                normalized += expr[++i];
+                continue;
+            }
+            if (ch == quote)
+                quote = 0;
+        }
+        else if (ch == '"' or ch == '\'')
+        {
+            quote = ch;
+        }
+        else if (ch == ' ' or ch == '\t')
+        {
+            continue;
+        }
+        normalized += ch;
+    }
+    return normalized;
+}
+
+//__________________________________________________________________________________________________________________________________
+static TString getDrawCacheKey(const TString& signature, const TString& cmd, const TString& sel, const TString& wgt)
+{
+    // Returns an empty string for draws that cannot be cached (no target histogram or appending with ">>+")
+    Ssiz_t pos = cmd.Index(">>");
+    if (pos == kNPOS || cmd(pos + 2) == '+')
+        return "";
+    TString varexp = cmd(0, pos);
+    TString target = cmd(pos + 2, cmd.Length());
+    Ssiz_t binpos = target.Index("(");
+    TString bins = binpos == kNPOS ? TString("") : TString(target(binpos, target.Length()));
+    TString content = Form("%s\n%s\n%s\n%s\n%s",
+            signature.Data(),
+            normalizeDrawCacheExpr(varexp).Data(),
+            normalizeDrawCacheExpr(bins).Data(),
+            normalizeDrawCacheExpr(sel).Data(),
+            normalizeDrawCacheExpr(wgt).Data());
+    TMD5 md5;
+    md5.Update((const UChar_t*) content.Data(), content.Length());
+    md5.Final();
+    return md5.AsString();
+}
+
+//__________________________________________________________________________________________________________________________________
+static TH1* readDrawCache(const TString& path, const TString& histname)
+{
+    if (gSystem->AccessPathName(path))
+        return 0;
+    Long_t now = time(0);
+    gSystem->Utime(path, now, now); // marks the entry as recently used for pruneDrawCache
+    TDirectory* outdir = gDirectory;
+    TDirectory::TContext ctx;
+    TFile* f = TFile::Open(path);
+    if (!f || f->IsZombie())
+    {
+        delete f;
+        return 0;
+    }
+    TH1* h = 0;
+    TH1* cached = dynamic_cast<TH1*>(f->Get("hist"));
+    if (cached)
+    {
+        if (TObject* old = outdir->Get(histname))
+            delete old;
+        h = (TH1*) cached->Clone(histname);
+        h->SetDirectory(outdir);
+    }
+    f->Close();
+    delete f;
+    return h;
+}
+
+//__________________________________________________________________________________________________________________________________
+static void writeDrawCache(const TString& path, TH1* h)
+{
+    // Written to a temporary file and then renamed so that concurrent jobs never see a partial entry
+    TString tmppath = Form("%s.%d.tmp", path.Data(), gSystem->GetPid());
+    {
+        TDirectory::TContext ctx;
+        TFile f(tmppath, "RECREATE");
+        if (f.IsZombie())
+        {
+            warning(Form("Could not write the draw cache entry %s", path.Data()), __FUNCTION__);
+            return;
+        }
+        h->Write("hist");
+        f.Close();
+    }
+    if (gSystem->Rename(tmppath, path) != 0)
+        gSystem->Unlink(tmppath);
+}
+
+//__________________________________________________________________________________________________________________________________
+static void pruneDrawCache(const TString& cachedir)
+{
+    struct Entry
+    {
+        TString path;
+        Long64_t size;
+        Long_t mtime;
+    };
+    std::vector<Entry> entries;
+    Long64_t total = 0;
+    Long_t now = time(0);
+    void* dir = gSystem->OpenDirectory(cachedir);
+    if (!dir)
+        return;
+    while (const char* name = gSystem->GetDirEntry(dir))
+    {
+        TString fname = name;
+        bool istmp = fname.EndsWith(".tmp");
+        if (!istmp and !fname.EndsWith(".root"))
+            continue;
+        TString path = cachedir + "/" + fname;
+        FileStat_t stat;
+        if (gSystem->GetPathInfo(path, stat) != 0)
+            continue;
+        if (istmp)
+        {
+            if (now - stat.fMtime > 24 * 3600)
+                gSystem->Unlink(path);
+            continue;
+        }
+        entries.push_back({path, stat.fSize, stat.fMtime});
+        total += stat.fSize;
+    }
+    gSystem->FreeDirectory(dir);
+
+    Long64_t maxbytes = (Long64_t) (drawcache_maxgb * 1024 * 1024 * 1024);
+    if (total <= maxbytes)
+        return;
+    std::sort(entries.begin(), entries.end(), [](const Entry& a, const Entry& b) { return a.mtime < b.mtime; });
+    size_t nremoved = 0;
+    for (auto& e : entries)
+    {
+        if (total <= maxbytes)
+            break;
+        if (gSystem->Unlink(e.path) == 0)
+        {
+            total -= e.size;
+            nremoved++;
+        }
+    }
+    print(Form("Removed the %zu least recently used entries of the draw cache in %s", nremoved, cachedir.Data()));
+}
+
+//__________________________________________________________________________________________________________________________________
+std::map<TString, TH1*> RooUtil::DrawUtil::drawHistograms(TChain* c, json& j, TString prefix, bool nowgt, TString cachedir, unsigned int nthreads)
 {
     std::map<TString, TH1*> ret_hists;
     TMultiDrawTreePlayer* p = RooUtil::FileUtil::createTMulti(c);
+    p->setNumberOfThreads(nthreads);
     std::vector<TString> cmds;
     std::vector<TString> sels;
     std::vector<TString> wgts;
     std::tie(cmds, sels, wgts) = getDrawExprs(j);
     int nentries = c->GetEntries();
+    TString signature = cachedir.IsNull() ? TString("") : getDrawCacheInputSignature(c);
+    if (!signature.IsNull())
+        gSystem->mkdir(cachedir, kTRUE);
+    std::vector<TString> queued_histnames;
+    std::vector<TString> queued_keys;
+    size_t ncached = 0;
     for (size_t ith = 0; ith < cmds.size(); ++ith)
     {
         TString cmd = Form(cmds[ith].Data(), prefix.Data());
         TString sel = sels[ith].Data();
         TString wgt = nowgt ? "1" : wgts[ith].Data();
+        TString histname = Form(split(split(cmds[ith], ">>")[1], "(")[0], prefix.Data());
+        TString key = signature.IsNull() ? TString("") : getDrawCacheKey(signature, cmd, sel, wgt);
+        if (!key.IsNull())
+        {
+            if (TH1* h = readDrawCache(cachedir + "/" + key + ".root", histname))
+            {
+                ret_hists[histname] = h;
+                ncached++;
+                continue;
+            }
+        }
         p->queueDraw(
                 cmd.Data(),
                 Form("(%s)*(%s)", sel.Data(), wgt.Data()),
                 "goffe",
                 nentries);
+        queued_histnames.push_back(histname);
+        queued_keys.push_back(key);
     }
-    p->execute();
-    for (size_t ith = 0; ith < cmds.size(); ++ith)
+    if (!signature.IsNull())
+        print(Form("Took %zu of %zu histograms from the draw cache in %s", ncached, cmds.size(), cachedir.Data()));
+    if (queued_histnames.size())
+        p->execute();
+    for (size_t ith = 0; ith < queued_histnames.size(); ++ith)
     {
-        TString histname = Form(split(split(cmds[ith], ">>")[1], "(")[0], prefix.Data());
-        TH1* h = RooUtil::FileUtil::get(histname);
+        TH1* h = RooUtil::FileUtil::get(queued_histnames[ith]);
         if (h)
-            ret_hists[histname] = h;
+        {
+            ret_hists[queued_histnames[ith]] = h;
+            if (!queued_keys[ith].IsNull())
+                writeDrawCache(cachedir + "/" + queued_keys[ith] + ".root", h);
+        }
     }
+    if (!signature.IsNull())
+        pruneDrawCache(cachedir);
     return ret_hists;
 }
 
@@ -87,10 +87,14 @@ namespace RooUtil
         void printHistDefs(HistDefs histdefs);
         void printCuts(Cuts cuts);
         void printDrawExprs(DrawExprs exprs);
-        std::map<TString, TH1*> drawHistograms(TChain* c, DrawExprs exprs);
+        // nthreads is passed to TMultiDrawTreePlayer::setNumberOfThreads (1 = serial, 0 = all cores)
+        std::map<TString, TH1*> drawHistograms(TChain* c, DrawExprs exprs, unsigned int nthreads=1);
+        std::map<TString, TH1*> drawHistogramsCompiled(TChain* c, DrawExprs exprs);
         // =========================================================================================================
         DrawExprTool::tripleVecTStr getDrawExprs(json& j);
-        std::map<TString, TH1*> drawHistograms(TChain*, json&, TString="", bool=false);
+        std::map<TString, TH1*> drawHistograms(TChain*, json&, TString="", bool=false, TString cachedir="", unsigned int nthreads=1);
+        // Size the draw cache directory (cachedir above) is pruned to after every drawHistograms call, least recently used entries first
+        void setDrawCacheMaxSize(double maxgb=10);
     }
 }
 
@@ -3,71 +3,515 @@
 
 #include "fileutil.h"
 
-TChain* RooUtil::FileUtil::createTChain(TString name, TString inputs)
+#include "TFile.h"
+#include "TTree.h"
+#include "TROOT.h"
+#include "TSystem.h"
+#include "TMD5.h"
+#include "TChainElement.h"
+#include "TRegexp.h"
+
+#include <fstream>
+#include <iomanip>
+#include <thread>
+#include <atomic>
+#include <algorithm>
+#include <functional>
+#include <tuple>
+#include <ctime>
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+
+// Runs fn(i) for every i in [0, n) on up to nthreads threads
+static void parallelFor(size_t n, unsigned nthreads, std::function<void(size_t)> fn)
 {
-    using namespace std;
+    std::atomic<size_t> next(0);
+    auto worker = [&]()
+    {
+        for (size_t i = next++; i < n; i = next++)
+            fn(i);
+    };
+    nthreads = std::min<size_t>(nthreads, n);
+    std::vector<std::thread> threads;
+    for (unsigned ithread = 1; ithread < nthreads; ++ithread)
+        threads.emplace_back(worker);
+    worker();
+    for (auto& thread : threads)
+        thread.join();
+}
 
-    // hadoopmap to bypass some of the broken files
-    ifstream infile("hadoopmap.txt");
-    std::map<TString, TString> _map;
-    if (infile.good())
+// Node-local read-through cache of remote inputs (see setLocalCache)
+static TString localcache_dir;
+static Long64_t localcache_maxbytes = 0;
+static std::vector<TString> localcache_prefixes;
+
+// Takes a flock (LOCK_EX or LOCK_SH, optionally | LOCK_NB) on the given lock file.
+// Returns the descriptor to pass to unlockFile, or -1 on failure.
+static int lockFile(TString lockpath, int operation)
+{
+    for (;;)
     {
-        ifstream mapfile;
-        mapfile.open( "hadoopmap.txt" );
-        std::string line, oldpath, newpath;
-        while ( std::getline( mapfile, line ) ) 
+        int fd = open(lockpath.Data(), O_RDWR | O_CREAT, 0664);
+        if (fd < 0)
+            return -1;
+        if (flock(fd, operation) != 0)
         {
-            mapfile >> oldpath >> newpath;
-            TString oldpath_tstr = oldpath.c_str();
-            TString newpath_tstr = newpath.c_str();
-            _map[oldpath_tstr] = newpath_tstr;
+            close(fd);
+            return -1;
         }
+        // Eviction unlinks the lock file of an entry while holding it, so a lock taken on the unlinked file protects nothing: retry on the new one
+        struct stat fdstat, pathstat;
+        if (fstat(fd, &fdstat) == 0 && stat(lockpath.Data(), &pathstat) == 0 && fdstat.st_ino == pathstat.st_ino && fdstat.st_dev == pathstat.st_dev)
+            return fd;
+        close(fd);
     }
+}
+
+static void unlockFile(int fd)
+{
+    if (fd < 0)
+        return;
+    flock(fd, LOCK_UN);
+    close(fd);
+}
+
+TChain* RooUtil::FileUtil::createTChain(TString name, TString inputs, InputPolicy policy, TString manifest)
+{
+    // hadoopmap to bypass some of the broken files
+    std::map<TString, TString> _map = getHadoopMap();
 
-    // globbing if the provided path is only a directory
-    // It will check via looking at the last character == "/"
-    if (inputs.EndsWith("/"))
+    std::vector<TString> files = resolveInputs(inputs);
+
+    std::vector<TString> paths;
+    std::vector<Long64_t> nentries; // -1 if not known yet
+
+    if (policy == kNoValidation)
+    {
+        for (auto& ff : files)
+        {
+            TString filepath = ff;
+            if ( _map.find( ff ) != _map.end() )
+                filepath = _map[ff];
+            paths.push_back(filepath);
+            nentries.push_back(-1);
+        }
+    }
+    else
     {
-        std::string pattern = TString::Format("%s/*.root", inputs.Data()).Data();
-        inputs = RooUtil::StringUtil::join(glob(pattern));
+        // Open every input concurrently before any event processing so that broken files show up here rather than deep in the loop
+        std::vector<InputStatus> statuses = validateInputs(name, files, _map);
+
+        if (!manifest.IsNull())
+            writeInputManifest(statuses, name, manifest);
+
+        int nbad = 0;
+        for (auto& s : statuses)
+        {
+            if (!s.good())
+            {
+                nbad++;
+                RooUtil::warning(Form("Bad input %s (%s)", s.input.Data(), s.status.Data()), __FUNCTION__);
+                continue;
+            }
+            paths.push_back(s.path);
+            nentries.push_back(s.nentries);
+        }
+
+        if (nbad && policy == kAbortOnBadInputs)
+            RooUtil::error(Form("%d of %zu inputs are bad", nbad, statuses.size()), __FUNCTION__);
+        else if (nbad)
+            RooUtil::warning(Form("Skipped %d of %zu inputs", nbad, statuses.size()), __FUNCTION__);
     }
 
-    if (inputs.Contains("*"))
+    // Serve remote inputs from the node-local cache if one is set (see setLocalCache), one file at a time as the chain opens them
+    TChain* chain = isLocalCacheEnabled() ? new CachedChain(name) : new TChain(name);
+    for (size_t i = 0; i < paths.size(); ++i)
     {
-        std::string pattern = inputs.Data();
-        inputs = RooUtil::StringUtil::join(glob(pattern));
+        if (nentries[i] < 0)
+        {
+            RooUtil::print(Form("Adding %s", paths[i].Data()));
+            chain->Add(paths[i]);
+        }
+        else
+        {
+            RooUtil::print(Form("Adding %s (%lld entries)", paths[i].Data(), nentries[i]));
+            chain->Add(paths[i], nentries[i]); // entries are known now so the chain does not reopen the file to count them
+        }
     }
+    return chain;
+}
+
+std::map<TString, TString> RooUtil::FileUtil::getHadoopMap(TString mappath)
+{
+    // Each line holds "<oldpath> <newpath>"
+    std::map<TString, TString> _map;
+    std::ifstream mapfile(mappath.Data());
+    std::string oldpath, newpath;
+    while (mapfile >> oldpath >> newpath)
+        _map[oldpath.c_str()] = newpath.c_str();
+    return _map;
+}
 
-    TChain* chain = new TChain(name);
+std::vector<TString> RooUtil::FileUtil::resolveInputs(TString inputs)
+{
     inputs = inputs.ReplaceAll("\"",""); // In case some rogue " or ' is left over
     inputs = inputs.ReplaceAll("\'",""); // In case some rogue " or ' is left over
     char hostnamestupid[100];
     gethostname(hostnamestupid, 100);
     TString hostname(hostnamestupid);
     std::cout << ">>> Hostname is " << hostname << std::endl;  
-    bool useXrootd = inputs.BeginsWith("/store/");
-    // if (useXrootd and hostname.Contains("t2.ucsd.edu"))
-    // {
-    //     if (inputs.Contains("/hadoop/cms"))
-    //         inputs.ReplaceAll("/hadoop/cms", "root://redirector.t2.ucsd.edu/");
-    //     else
-    //         inputs.ReplaceAll("/store", "root://redirector.t2.ucsd.edu//store");
-    // }
-    // else
-    if (useXrootd)
-    {
-        inputs.ReplaceAll("/store", "root://xcache-redirector.t2.ucsd.edu:2042//store");
-    }
-    std::cout << "inputs : " << inputs.Data() << std::endl;
-    for (auto& ff : RooUtil::StringUtil::split(inputs, ","))
-    {
-        TString filepath = ff;
-        if ( _map.find( ff ) != _map.end() )
-            filepath = _map[ff];
-        RooUtil::print(Form("Adding %s", filepath.Data()));
-        chain->Add(filepath);
+    std::vector<TString> files;
+    for (auto& input : RooUtil::StringUtil::split(inputs, ","))
+    {
+        // globbing if the provided path is only a directory
+        // It will check via looking at the last character == "/"
+        if (input.EndsWith("/"))
+            input += "*.root";
+        // Wildcards are expanded here, rather than left to TChain::Add, so that every matching file is validated on its own
+        for (auto& file : expandWildcard(input))
+        {
+            bool useXrootd = file.BeginsWith("/store/");
+            // if (useXrootd and hostname.Contains("t2.ucsd.edu"))
+            // {
+            //     if (file.Contains("/hadoop/cms"))
+            //         file.ReplaceAll("/hadoop/cms", "root://redirector.t2.ucsd.edu/");
+            //     else
+            //         file.ReplaceAll("/store", "root://redirector.t2.ucsd.edu//store");
+            // }
+            // else
+            if (useXrootd)
+            {
+                file.ReplaceAll("/store", "root://xcache-redirector.t2.ucsd.edu:2042//store");
+            }
+            files.push_back(file);
+        }
     }
-    return chain;
+    std::cout << "inputs : " << RooUtil::StringUtil::join(files).Data() << std::endl;
+    return files;
+}
+
+std::vector<TString> RooUtil::FileUtil::expandWildcard(TString path)
+{
+    if (!path.MaybeWildcard())
+        return {path};
+
+    std::vector<TString> files;
+    if (!path.Contains("://"))
+    {
+        try
+        {
+            files = glob(path.Data());
+        }
+        catch (const std::runtime_error&)
+        {
+        }
+    }
+    else
+    {
+        // Remote: like TChain::Add, only the file name may hold wildcards and the directory is listed through the TSystem of the protocol
+        TString dirname = gSystem->GetDirName(path);
+        TString basename = gSystem->BaseName(path);
+        TRegexp re(basename, kTRUE);
+        if (void* dir = gSystem->OpenDirectory(dirname))
+        {
+            while (const char* entry = gSystem->GetDirEntry(dir))
+            {
+                TString name = entry;
+                Ssiz_t len = 0;
+                if (name.Index(re, &len) == 0 && len == name.Length())
+                    files.push_back(dirname + "/" + name);
+            }
+            gSystem->FreeDirectory(dir);
+        }
+        std::sort(files.begin(), files.end());
+    }
+
+    // No match: kept as is, so that the input validation reports it (and TChain::Add ignores it, as it would have)
+    if (files.empty())
+    {
+        RooUtil::warning(Form("No file matches %s", path.Data()), __FUNCTION__);
+        files.push_back(path);
+    }
+    return files;
+}
+
+RooUtil::FileUtil::InputStatus RooUtil::FileUtil::validateInput(TString path, TString treename)
+{
+    InputStatus s;
+    s.input = path;
+    s.path = path;
+    s.nentries = 0;
+    TFile* f = TFile::Open(path);
+    if (!f)
+        s.status = "cannot open";
+    else if (f->IsZombie())
+        s.status = "zombie";
+    else
+    {
+        TTree* t = dynamic_cast<TTree*>(f->Get(treename));
+        if (!t)
+            s.status = Form("no tree %s", treename.Data());
+        else if ((s.nentries = t->GetEntries()) <= 0)
+            s.status = "no entries";
+        else
+            s.status = "ok";
+    }
+    delete f;
+    return s;
+}
+
+std::vector<RooUtil::FileUtil::InputStatus> RooUtil::FileUtil::validateInputs(TString treename, const std::vector<TString>& inputs, const std::map<TString, TString>& hadoopmap)
+{
+    ROOT::EnableThreadSafety();
+    std::vector<InputStatus> statuses(inputs.size());
+    // Opening is dominated by (remote) I/O latency, so use at least a handful of threads even on small machines
+    unsigned nthreads = std::max(8u, std::thread::hardware_concurrency());
+    parallelFor(inputs.size(), nthreads, [&](size_t i)
+    {
+        // The hadoopmap replacement is tried first as it is there to bypass known broken files, then the original
+        std::vector<TString> candidates;
+        auto it = hadoopmap.find(inputs[i]);
+        if (it != hadoopmap.end())
+            candidates.push_back(it->second);
+        if (candidates.empty() || candidates[0] != inputs[i])
+            candidates.push_back(inputs[i]);
+        std::vector<TString> reasons;
+        for (auto& candidate : candidates)
+        {
+            InputStatus s = validateInput(candidate, treename);
+            s.input = inputs[i];
+            statuses[i] = s;
+            if (s.good())
+                break;
+            reasons.push_back(Form("%s: %s", candidate.Data(), s.status.Data()));
+        }
+        if (!statuses[i].good())
+            statuses[i].status = RooUtil::StringUtil::join(reasons, "; ", 0);
+    });
+    return statuses;
+}
+
+void RooUtil::FileUtil::writeInputManifest(const std::vector<InputStatus>& statuses, TString treename, TString manifest)
+{
+    json j;
+    j["tree"] = treename.Data();
+    j["files"] = json::array();
+    for (auto& s : statuses)
+    {
+        json f;
+        f["input"] = s.input.Data();
+        f["path"] = s.path.Data();
+        f["status"] = s.status.Data();
+        f["nentries"] = s.nentries;
+        j["files"].push_back(f);
+    }
+    std::ofstream ofile(manifest.Data());
+    if (!ofile.good())
+    {
+        RooUtil::warning(Form("Could not write the input manifest %s", manifest.Data()), __FUNCTION__);
+        return;
+    }
+    ofile << std::setw(4) << j << std::endl;
+    RooUtil::print(Form("Wrote the input manifest to %s", manifest.Data()));
+}
+
+void RooUtil::FileUtil::setLocalCache(TString dir, double maxgb, TString prefixes)
+{
+    localcache_dir = dir;
+    localcache_maxbytes = (Long64_t) (maxgb * 1e9);
+    localcache_prefixes = RooUtil::StringUtil::split(prefixes, ",");
+    if (localcache_dir.IsNull())
+        return;
+    if (gSystem->mkdir(localcache_dir, kTRUE) != 0 && gSystem->AccessPathName(localcache_dir))
+        RooUtil::error(Form("Could not create the local cache directory %s", localcache_dir.Data()), __FUNCTION__);
+    RooUtil::print(Form("Caching inputs starting with %s in %s (up to %.1f GB)", prefixes.Data(), localcache_dir.Data(), maxgb));
+}
+
+bool RooUtil::FileUtil::isLocalCacheEnabled()
+{
+    return !localcache_dir.IsNull();
+}
+
+TString RooUtil::FileUtil::getLocalCopy(TString path, int& lockfd)
+{
+    lockfd = -1;
+    if (!isLocalCacheEnabled())
+        return path;
+    bool cacheable = false;
+    for (auto& prefix : localcache_prefixes)
+        if (path.BeginsWith(prefix))
+            cacheable = true;
+    if (!cacheable)
+        return path;
+
+    // The remote size and modification time are part of the key so that a rewritten input is fetched again.
+    // If the remote file cannot be stat'ed the key is the path alone, i.e. the input is assumed to be immutable.
+    TString key = path;
+    FileStat_t remotestat;
+    Long64_t remotesize = 0; // unknown
+    if (gSystem->GetPathInfo(path, remotestat) == 0)
+    {
+        key += Form(":%lld:%ld", remotestat.fSize, remotestat.fMtime);
+        remotesize = remotestat.fSize;
+    }
+    TMD5 md5;
+    md5.Update((const UChar_t*) key.Data(), key.Length());
+    md5.Final();
+    TString basename = path(path.Last('/') + 1, path.Length()); // not gSystem->BaseName, which returns a shared buffer
+    TString localpath = Form("%s/%s_%s", localcache_dir.Data(), md5.AsString(), basename.Data());
+    TString lockpath = localpath + ".lock";
+
+    // A copy is handed out with a shared lock on its lock file, held until releaseLocalCopy, and eviction skips every locked entry.
+    // It is fetched under the exclusive lock, which makes a second process on the node wait for the first one's copy instead of fetching the file again.
+    // flock cannot upgrade or downgrade atomically, so an entry evicted in between is fetched again (a few times at most).
+    for (int attempt = 0; attempt < 3; ++attempt)
+    {
+        int fd = lockFile(lockpath, LOCK_SH);
+        if (fd < 0)
+        {
+            RooUtil::warning(Form("Could not lock %s, reading %s remotely", lockpath.Data(), path.Data()), __FUNCTION__);
+            return path;
+        }
+        if (!gSystem->AccessPathName(localpath))
+        {
+            // The modification time is the LRU clock (atime is unreliable on noatime mounts)
+            Long_t now = (Long_t) time(0);
+            gSystem->Utime(localpath, now, now);
+            lockfd = fd;
+            return localpath;
+        }
+        unlockFile(fd);
+
+        fd = lockFile(lockpath, LOCK_EX);
+        if (fd < 0)
+        {
+            RooUtil::warning(Form("Could not lock %s, reading %s remotely", lockpath.Data(), path.Data()), __FUNCTION__);
+            return path;
+        }
+        if (gSystem->AccessPathName(localpath))
+        {
+            if (!evictLocalCache(remotesize))
+            {
+                unlockFile(fd);
+                RooUtil::warning(Form("The local cache is full with copies in use, reading %s remotely", path.Data()), __FUNCTION__);
+                return path;
+            }
+            TString tmppath = Form("%s.%d.tmp", localpath.Data(), gSystem->GetPid());
+            if (!TFile::Cp(path, tmppath, kFALSE) || gSystem->Rename(tmppath, localpath) != 0)
+            {
+                gSystem->Unlink(tmppath);
+                unlockFile(fd);
+                RooUtil::warning(Form("Could not copy %s into the local cache, reading it remotely", path.Data()), __FUNCTION__);
+                return path;
+            }
+            RooUtil::print(Form("Cached %s as %s", path.Data(), localpath.Data()));
+        }
+        unlockFile(fd);
+    }
+    RooUtil::warning(Form("%s kept being evicted from the local cache, reading it remotely", path.Data()), __FUNCTION__);
+    return path;
+}
+
+void RooUtil::FileUtil::releaseLocalCopy(int lockfd)
+{
+    unlockFile(lockfd);
+}
+
+bool RooUtil::FileUtil::evictLocalCache(Long64_t needed)
+{
+    // Evicts the least recently used copies until another "needed" bytes fit under the bound.
+    // Returns false if they do not fit because the remaining copies are in use.
+    if (!isLocalCacheEnabled())
+        return true;
+    int fd = lockFile(localcache_dir + "/.evict.lock", LOCK_EX);
+    if (fd < 0)
+        RooUtil::warning(Form("Could not lock %s/.evict.lock, evicting without it", localcache_dir.Data()), __FUNCTION__);
+    // Temporary copies left behind by jobs that died while fetching (a live copy is written to continuously).
+    // The live ones count towards the total, so concurrent fetches do not all claim the same free space (only partially, as they are still growing).
+    const Long_t staletmpage = 24 * 3600;
+    Long_t now = (Long_t) time(0);
+    std::vector<std::tuple<Long_t, Long64_t, TString>> entries; // (mtime, size, path)
+    Long64_t total = needed;
+    for (auto& name : getFilePathsInDirectory(localcache_dir))
+    {
+        if (name.BeginsWith(".") || name.EndsWith(".lock"))
+            continue;
+        TString entrypath = localcache_dir + "/" + name;
+        FileStat_t stat;
+        if (gSystem->GetPathInfo(entrypath, stat) != 0)
+            continue;
+        if (name.EndsWith(".tmp"))
+        {
+            if (now - stat.fMtime > staletmpage && gSystem->Unlink(entrypath) == 0)
+                RooUtil::print(Form("Removed the stale temporary copy %s from the local cache", entrypath.Data()));
+            else
+                total += stat.fSize;
+            continue;
+        }
+        entries.push_back(std::make_tuple(stat.fMtime, stat.fSize, entrypath));
+        total += stat.fSize;
+    }
+    // Least recently used first. Removing a file another process has open is safe, it keeps reading the unlinked inode.
+    std::sort(entries.begin(), entries.end());
+    for (auto& entry : entries)
+    {
+        if (total <= localcache_maxbytes)
+            break;
+        // Skip entries that are being fetched or are handed out to a chain in any process on the node
+        int entryfd = lockFile(std::get<2>(entry) + ".lock", LOCK_EX | LOCK_NB);
+        if (entryfd < 0)
+            continue;
+        // The lock file goes with its entry. A process already waiting on it notices (see lockFile) and takes the new one.
+        if (gSystem->Unlink(std::get<2>(entry)) == 0)
+        {
+            total -= std::get<1>(entry);
+            gSystem->Unlink(std::get<2>(entry) + ".lock");
+            RooUtil::print(Form("Evicted %s from the local cache", std::get<2>(entry).Data()));
+        }
+        unlockFile(entryfd);
+    }
+    unlockFile(fd);
+    return total <= localcache_maxbytes;
+}
+
+RooUtil::FileUtil::CachedChain::~CachedChain()
+{
+    releaseLocalCopy(lockfd);
+}
+
+Long64_t RooUtil::FileUtil::CachedChain::LoadTree(Long64_t entry)
+{
+    // Same search as TChain::LoadTree, which opens the file found here right after (and comes back here for the next one if the entry counts were unknown)
+    if (entry >= 0 && fNtrees > 0 && !(fTreeNumber >= 0 && entry >= fTreeOffset[fTreeNumber] && entry < fTreeOffset[fTreeNumber + 1]))
+    {
+        int treenum = 0;
+        while (treenum < fNtrees && entry >= fTreeOffset[treenum + 1])
+            ++treenum;
+        if (treenum < fNtrees && treenum != lockedtree)
+            fetch(treenum);
+    }
+    return TChain::LoadTree(entry);
+}
+
+void RooUtil::FileUtil::CachedChain::fetch(int treenum)
+{
+    // The previous copy is handed back (an open file survives its eviction) and its element points to the remote file again
+    if (lockedtree >= 0)
+    {
+        ((TChainElement*) fFiles->At(lockedtree))->SetTitle(lockedremote);
+        releaseLocalCopy(lockfd);
+        lockfd = -1;
+        lockedtree = -1;
+    }
+    TChainElement* element = (TChainElement*) fFiles->At(treenum);
+    TString remote = element->GetTitle();
+    TString local = getLocalCopy(remote, lockfd);
+    if (lockfd < 0)
+        return;
+    element->SetTitle(local);
+    lockedtree = treenum;
+    lockedremote = remote;
 }
 
 TMultiDrawTreePlayer* RooUtil::FileUtil::createTMulti(TChain* t)
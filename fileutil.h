@@ -28,7 +28,54 @@ namespace RooUtil
 {
     namespace FileUtil
     {
-        TChain* createTChain(TString, TString);
+        // What createTChain does with inputs that fail to open, are zombies, lack the tree or have no entries
+        enum InputPolicy
+        {
+            kNoValidation,  // add every input as is (no files are opened up front)
+            kSkipBadInputs, // drop bad inputs with a warning
+            kAbortOnBadInputs, // abort if any input is bad
+        };
+        struct InputStatus
+        {
+            TString input; // path as given (after globbing and xcache rewriting)
+            TString path; // path actually used (may come from hadoopmap.txt)
+            TString status; // "ok" or the reasons the candidates were rejected
+            Long64_t nentries;
+            bool good() const { return status == "ok"; }
+        };
+        TChain* createTChain(TString, TString, InputPolicy=kNoValidation, TString manifest="");
+        std::map<TString, TString> getHadoopMap(TString="hadoopmap.txt");
+        // Splits the comma separated inputs and expands directories (ending with "/") and wildcards into one path per file
+        std::vector<TString> resolveInputs(TString);
+        std::vector<TString> expandWildcard(TString path);
+        InputStatus validateInput(TString path, TString treename);
+        std::vector<InputStatus> validateInputs(TString treename, const std::vector<TString>& inputs, const std::map<TString, TString>& hadoopmap);
+        void writeInputManifest(const std::vector<InputStatus>&, TString treename, TString manifest);
+        // Optional node-local cache: createTChain returns a CachedChain, which copies inputs starting with one of the (comma separated) prefixes
+        // into dir as it opens them and reads them from there, evicting the least recently used copies to keep dir under maxgb.
+        // When the copies in use (by any process on the node) leave no room, the input is read remotely. An empty dir disables it.
+        // Copies are keyed on the remote path, size and modification time (the path alone, i.e. an immutable input, if it cannot be stat'ed).
+        // N.B. Without input validation the entry counts are unknown, and GetEntries() fetches every input in turn to count them.
+        void setLocalCache(TString dir, double maxgb=50, TString prefixes="root://");
+        bool isLocalCacheEnabled();
+        // Returns the local copy (fetching it if needed) with a shared lock that keeps it from being evicted until releaseLocalCopy(lockfd),
+        // or path itself (lockfd = -1) if it is not cached
+        TString getLocalCopy(TString path, int& lockfd);
+        void releaseLocalCopy(int lockfd);
+        bool evictLocalCache(Long64_t needed=0);
+        // TChain that fetches each input into the local cache right before opening it, and hands it back when moving to the next one
+        class CachedChain : public TChain
+        {
+            public:
+            CachedChain(const char* name) : TChain(name) {}
+            ~CachedChain();
+            Long64_t LoadTree(Long64_t entry) override;
+            private:
+            void fetch(int treenum);
+            int lockfd = -1;
+            int lockedtree = -1;
+            TString lockedremote;
+        };
         TMultiDrawTreePlayer* createTMulti(TChain*);
         TMultiDrawTreePlayer* createTMulti(TString, TString);
         TH1* get(TString);
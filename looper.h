@@ -438,6 +438,7 @@ bool RooUtil::Looper<TREECLASS>::nextTree()
         // Reset the event index as we got a new ttree
         indexOfEventInTTree = 0;
         // Set the ttree to the TREECLASS
+        // (classes from makeCMS3ClassFiles.C cache the binding per branch list, so files of the same schema rebind cheaply)
         treeclass->Init( ttree );
 
         // If skimming create the skim tree after the treeclass inits it.
@@ -28,12 +28,16 @@ usage(){
     echo ""
     echo "Usage:"
     echo ""
-    echo ${green}"  > sh $(basename $0) [-f] [-h] [-x] ROOTFILE TTREENAME CLASSNAME [NAMESPACENAME=tas] [CLASSINSTANCENAME=cms3] "${reset}
+    echo ${green}"  > sh $(basename $0) [-f] [-h] [-x] [-b BRANCHES] [-o OPTIONALBRANCHES] ROOTFILE TTREENAME CLASSNAME [NAMESPACENAME=tas] [CLASSINSTANCENAME=cms3] "${reset}
     echo ""
     echo ""
     echo ${green}" -h ${reset}: print this message"
     echo ${green}" -f ${reset}: force run this script"
-    echo ${green}" -x ${reset}: create additional looper template files (i.e. process.cc, Makefile)"
+    echo ${green}" -x ${reset}: create additional looper template files (i.e. process.cc, Makefile, and a precompiled header for RooUtil)"
+    echo ${green}" -b ${reset}: only generate accessors for the given branches: a comma separated list of names or wildcard patterns"
+    echo "     (e.g. 'nMuon,Muon_*,MET_pt') or a file listing them one per line. Counters of selected arrays are added automatically."
+    echo ${green}" -o ${reset}: branches that may be missing from some input files (same syntax as -b). They read as zero, false or empty"
+    echo "     where they are missing. Accessing any other branch that is missing from the current file stops the job."
     echo ""
     echo ${green}" ROOTFILE          ${reset}= Path to the root file that holds an example TTree that you wish to study."
     echo ${green}" TREENAME          ${reset}= The TTree object TKey name in the ROOTFILE"
@@ -50,10 +54,12 @@ usage(){
 }
 
 # Command-line opts
-while getopts ":fxh" OPTION; do
+while getopts ":fxhb:o:" OPTION; do
   case $OPTION in
     f) FORCE=true;;
     x) GENERATEEXTRACODE=true;;
+    b) BRANCHES=$OPTARG;;
+    o) OPTIONALBRANCHES=$OPTARG;;
     h) usage;;
     :) usage;;
   esac
@@ -90,6 +96,8 @@ e_arrow "RooUtil::  ROOTFILE=$ROOTFILE"
 e_arrow "RooUtil::  TREENAME=$TTREENAME"
 e_arrow "RooUtil::  MAKECLASSNAME=$MAKECLASSNAME"
 e_arrow "RooUtil::  TREEINSTANCENAME=$TREEINSTANCENAME"
+e_arrow "RooUtil::  BRANCHES=$BRANCHES"
+e_arrow "RooUtil::  OPTIONALBRANCHES=$OPTIONALBRANCHES"
 e_arrow "RooUtil:: =========================================="
 e_arrow "RooUtil:: "
 
@@ -97,6 +105,8 @@ e_arrow "RooUtil:: "
 e_arrow "RooUtil:: Generating ${MAKECLASSNAME}.cc/h file which can load the TTree content from ${ROOTFILE}:${TREENAME} ..."
 
 ROOTFILE=$('cd' $(dirname ${ROOTFILE}); pwd)/$(basename $1)
+if [ -n "${BRANCHES}" ] && [ -f "${BRANCHES}" ]; then BRANCHES=$('cd' $(dirname ${BRANCHES}); pwd)/$(basename ${BRANCHES}); fi
+if [ -n "${OPTIONALBRANCHES}" ] && [ -f "${OPTIONALBRANCHES}" ]; then OPTIONALBRANCHES=$('cd' $(dirname ${OPTIONALBRANCHES}); pwd)/$(basename ${OPTIONALBRANCHES}); fi
 
 # Check whether the file already exists
 if [ -e ${MAKECLASSNAME}.cc ]; then
@@ -124,7 +134,7 @@ source $DIR/root.sh ""
 
 if [ -e $DIR/makeCMS3ClassFiles.C ]; then
   echo "running makeCMS3ClassFiles.C"
-  root -l -b -q $DIR/makeCMS3ClassFiles.C\(\"${ROOTFILE}\",\"${TTREENAME}\",\"${MAKECLASSNAME}\",\"${NAMESPACENAME}\",\"${TREEINSTANCENAME}\"\)  &> /dev/null
+  root -l -b -q $DIR/makeCMS3ClassFiles.C\(\"${ROOTFILE}\",\"${TTREENAME}\",\"${MAKECLASSNAME}\",\"${NAMESPACENAME}\",\"${TREEINSTANCENAME}\",false,\"${BRANCHES}\",\"${OPTIONALBRANCHES}\"\)  &> /dev/null
 fi
 
 if [ $? -eq 0 ]; then
@@ -574,6 +584,17 @@ if [ "$GENERATEEXTRACODE" == true ]; then
 
     fi
 
+    #
+    # Create the precompiled header for RooUtil (built by the Makefile below)
+    #
+    if [ -e rooutil_pch.h ]; then
+        e_error "RooUtil:: rooutil_pch.h already exists. We will leave it alone. Erase it if you want to override"
+    else
+        echo "// Headers shared by every translation unit of the looper, precompiled by the Makefile into rooutil_pch.h.gch" >  rooutil_pch.h
+        echo "#include \"rooutil.h\""                                                                                          >> rooutil_pch.h
+        echo "#include \"cxxopts.h\""                                                                                          >> rooutil_pch.h
+    fi
+
     #
     # Create Makefile
     #
@@ -606,11 +627,17 @@ if [ "$GENERATEEXTRACODE" == true ]; then
         echo '$(EXE): $(OBJECTS) '${MAKECLASSNAME}'.o'                                                                                                      >> Makefile
         echo '	$(LD) $(CXXFLAGS) $(LDFLAGS) $(OBJECTS) $(ROOTLIBS) $(EXTRAFLAGS) -o $@'                                                                    >> Makefile
         echo ''                                                                                                                                             >> Makefile
-        echo '%.o: %.cc'                                                                                                                                    >> Makefile
-        echo '	$(CC) $(CFLAGS) $(EXTRACFLAGS) $< -c -o $@'                                                                                                 >> Makefile
+        echo '# RooUtil headers are parsed once into a precompiled header and force-included in every object'                                               >> Makefile
+        echo 'PCH         = rooutil_pch.h'                                                                                                                  >> Makefile
+        echo ''                                                                                                                                             >> Makefile
+        echo '$(PCH).gch: $(PCH)'                                                                                                                           >> Makefile
+        echo '	$(CC) $(CFLAGS) $(EXTRACFLAGS) -x c++-header $< -o $@'                                                                                      >> Makefile
+        echo ''                                                                                                                                             >> Makefile
+        echo '%.o: %.cc $(PCH).gch'                                                                                                                         >> Makefile
+        echo '	$(CC) $(CFLAGS) $(EXTRACFLAGS) -include $(PCH) -Winvalid-pch $< -c -o $@'                                                                   >> Makefile
         echo ''                                                                                                                                             >> Makefile
         echo 'clean:'                                                                                                                                       >> Makefile
-        echo '	rm -f $(OBJECTS) $(EXE)'                                                                                                                    >> Makefile
+        echo '	rm -f $(OBJECTS) $(EXE) $(PCH).gch'                                                                                                         >> Makefile
     fi
 
     #echo "	sh rooutil/makeclass.sh -f -x TEMPLATE_TREE_PATH ${TTREENAME} ${MAKECLASSNAME} ${NAMESPACENAME} ${TREEINSTANCENAME}  > /dev/null 2>&1"  >> Makefile
@@ -13,13 +13,21 @@
 #include "TH1.h"
 #include "TVirtualMonitoring.h"
 #include "TTreeCache.h"
+#include "TChain.h"
+#include "TChainElement.h"
+#include "TObjArray.h"
 
 #include <limits>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <deque>
 
 //ClassImp(TMultiDrawTreePlayer)
 
 TMultiDrawTreePlayer::TMultiDrawTreePlayer():
-    TTreePlayer() {
+    TTreePlayer(),
+    m_nthreads(1) {
     // Empty
 }
 
@@ -122,7 +130,7 @@ bool TMultiDrawTreePlayer::queueDraw(const char* varexp0, const char* selection,
    data.firstentry = firstentry;
    data.options = option;
 
-   data.selector.reset(new TSelectorMultiDraw());
+   data.selector.reset(new TSelectorMultiDraw(&m_formulacache));
    data.selector->SetInputList(data.input.get());
 
    m_draws.push_back(data);
@@ -253,10 +261,46 @@ bool TMultiDrawTreePlayer::queueDraw(const char* varexp0, const char* selection,
 }
 
 
+// Runs one entry through every queued draw covering it. Returns false if one of the selectors aborts the whole loop.
+static bool processEntry(std::vector<DrawData>& draws, Long64_t entry, Long64_t localEntry, bool& skipToNextFile) {
+    bool abort = false;
+    for (auto& data: draws) {
+        bool process = (data.selector->GetAbort() != TSelector::kAbortProcess &&
+                (data.selector->Version() != 0 || data.selector->GetStatus() != -1)) ? true : false;
+
+        if ((entry < data.firstentry) || (entry >= (data.firstentry + data.nentries)))
+            process = false;
+
+        if (! process)
+            continue;
+
+        bool useCutFill = data.selector->Version() == 0;
+
+        if(useCutFill) {
+            if (data.selector->ProcessCut(localEntry))
+                data.selector->ProcessFill(localEntry); //<==call user analysis function
+        } else {
+            data.selector->Process(localEntry);        //<==call user analysis function
+        }
+
+        if (data.selector->GetAbort() == TSelector::kAbortProcess)
+            abort = true;
+
+        if (data.selector->GetAbort() == TSelector::kAbortFile) {
+            skipToNextFile = true;
+            data.selector->ResetAbort();
+        }
+    }
+    return !abort;
+}
+
 bool TMultiDrawTreePlayer::execute() {
     if (m_draws.empty())
         return false;
 
+    if (m_nthreads != 1 && canExecuteInParallel())
+        return executeParallel();
+
     // Process this tree executing the code in the specified selector.
     // The return value is -1 in case of error and TSelector::GetStatus() in
     // in case of success.
@@ -391,35 +435,8 @@ bool TMultiDrawTreePlayer::execute() {
             }
         }
 
-        bool abort = false;
         bool skipToNextFile = false;
-        for (auto& data: m_draws) {
-            bool process = (data.selector->GetAbort() != TSelector::kAbortProcess &&
-                    (data.selector->Version() != 0 || data.selector->GetStatus() != -1)) ? true : false;
-
-            if ((entry < data.firstentry) || (entry >= (data.firstentry + data.nentries)))
-                process = false;
-
-            if (! process)
-                continue;
-
-            bool useCutFill = data.selector->Version() == 0;
-
-            if(useCutFill) {
-                if (data.selector->ProcessCut(localEntry))
-                    data.selector->ProcessFill(localEntry); //<==call user analysis function
-            } else {
-                data.selector->Process(localEntry);        //<==call user analysis function
-            }
-
-            if (data.selector->GetAbort() == TSelector::kAbortProcess)
-                abort = true;
-
-            if (data.selector->GetAbort() == TSelector::kAbortFile) {
-                skipToNextFile = true;
-                data.selector->ResetAbort();
-            }
-        }
+        bool abort = !processEntry(m_draws, entry, localEntry, skipToNextFile);
 
         if (gMonitoringWriter)
             gMonitoringWriter->SendProcessingProgress((entry-firstentry),TFile::GetFileBytesRead()-readbytesatstart,kTRUE);
@@ -475,6 +492,308 @@ bool TMultiDrawTreePlayer::execute() {
         gMonitoringWriter->SendProcessingStatus("DONE");
 
     m_draws.clear();
+    m_formulacache.clear();
+
+    return res;
+}
+
+// True if the draw command books its histogram with fixed binning, i.e. "y:x>>h(nx,xlo,xhi,ny,ylo,yhi)" (not appending with ">>+").
+// Without it every thread would create its histogram with its own automatic limits (or not at all, for a pre-booked target)
+// and the histograms could not be merged.
+static bool hasExplicitBinning(const TString& varexp) {
+    Ssiz_t pos = varexp.Index(">>");
+    TString target = TString(varexp(pos + 2, varexp.Length() - pos - 2)).Strip(TString::kBoth);
+    if (target.BeginsWith("+"))
+        return false;
+    Ssiz_t open = target.Index("(");
+    if (open == kNPOS || !target.EndsWith(")"))
+        return false;
+    int ndim = 1;
+    for (Ssiz_t i = 0; i < pos; ++i)
+        if (varexp[i] == ':' && !(i + 1 < pos && varexp[i + 1] == ':') && !(i > 0 && varexp[i - 1] == ':'))
+            ++ndim;
+    std::unique_ptr<TObjArray> bins(TString(target(open + 1, target.Length() - open - 2)).Tokenize(","));
+    if (bins->GetEntries() != 3 * ndim)
+        return false;
+    for (int idim = 0; idim < ndim; ++idim) {
+        TString nbins = TString(bins->At(3 * idim)->GetName()).Strip(TString::kBoth);
+        TString lo = TString(bins->At(3 * idim + 1)->GetName()).Strip(TString::kBoth);
+        TString hi = TString(bins->At(3 * idim + 2)->GetName()).Strip(TString::kBoth);
+        if (!nbins.IsFloat() || !lo.IsFloat() || !hi.IsFloat() || lo.Atof() >= hi.Atof()) // lo >= hi means automatic limits
+            return false;
+    }
+    return true;
+}
+
+// Parallel execution is limited to draws into explicitly binned histograms from a tree that can be reopened in every thread
+bool TMultiDrawTreePlayer::canExecuteInParallel() const {
+    if (fTree->GetEventList() || fTree->GetEntryList())
+        return false;
+    if (fTree->GetListOfFriends() && fTree->GetListOfFriends()->GetSize() > 0)
+        return false;
+    if (!fTree->InheritsFrom(TChain::Class()) && !fTree->GetCurrentFile())
+        return false;
+    // The threads number the entries of the files they open from the tree offsets, i.e. every file's entry count must be known
+    // up front (e.g. a chain from RooUtil::FileUtil::createTChain with input validation), as counting would open every file once more
+    if (fTree->InheritsFrom(TChain::Class()) && fTree->GetEntriesFast() == TTree::kMaxEntries)
+        return false;
+
+    for (auto& data: m_draws) {
+        TString varexp = data.input->FindObject("varexp")->GetTitle();
+        Ssiz_t pos = varexp.Index(">>");
+        if (pos == kNPOS || TString(varexp(0, pos)).Strip(TString::kBoth).Length() == 0 || !hasExplicitBinning(varexp))
+            return false;
+        TString opt = data.options;
+        opt.ToLower();
+        if (opt.Contains("para") || opt.Contains("candle") || opt.Contains("gl5d") || opt.Contains("entrylist"))
+            return false;
+    }
+    return true;
+}
+
+// Entry ranges [first, last) of the clusters of the loaded tree of the chain (starting at chain entry offset) overlapping [firstentry, lastentry),
+// in chain entry numbers
+static std::vector<std::pair<Long64_t, Long64_t>> getClusterRanges(TTree* tree, Long64_t offset, Long64_t firstentry, Long64_t lastentry) {
+    std::vector<std::pair<Long64_t, Long64_t>> ranges;
+    Long64_t treeentries = tree->GetEntries();
+    TTree::TClusterIterator clusters = tree->GetClusterIterator(std::max(firstentry - offset, (Long64_t) 0));
+    Long64_t start;
+    while ((start = clusters()) < treeentries && offset + start < lastentry)
+        ranges.push_back(std::make_pair(std::max(offset + start, firstentry), std::min(offset + clusters.GetNextEntry(), lastentry)));
+    return ranges;
+}
+
+// Suffixes the name of the histogram a draw command fills, i.e. "pt>>h(10,0,100)" -> "pt>>h_suffix(10,0,100)"
+static TString renameTarget(const TString& varexp, const TString& suffix) {
+    Ssiz_t start = varexp.Index(">>") + 2;
+    if (start < varexp.Length() && varexp[start] == '+')
+        ++start;
+    Ssiz_t end = varexp.Index("(", start);
+    if (end == kNPOS)
+        end = varexp.Length();
+    TString name = TString(varexp(start, end - start)).Strip(TString::kBoth);
+    return TString(varexp(0, start)) + name + suffix + TString(varexp(end, varexp.Length() - end));
+}
+
+// Worker of the parallel execution: its own copy of the chain and of every queued selector
+struct DrawWorker {
+    std::unique_ptr<TChain>       chain;
+    std::vector<DrawData>         draws;
+    std::unique_ptr<NotifyProxier> notifier;
+};
+
+bool TMultiDrawTreePlayer::executeParallel() {
+    // Same as execute(), except that the tree clusters are handed out to a pool of threads. Thread 0 uses this player's tree
+    // and selectors, the others read a copy of the chain through copies of the selectors, each filling its own histograms,
+    // and the histograms are merged back into the ones of thread 0 at the end.
+    ROOT::EnableThreadSafety();
+
+    Long64_t firstentry = std::numeric_limits<Long64_t>::max();
+    Long64_t lastentry = 0;
+    for (auto& data: m_draws) {
+        firstentry = std::min(firstentry, data.firstentry);
+        lastentry = std::max(lastentry, data.firstentry + data.nentries);
+    }
+    Long64_t nentries = GetEntriesToProcess(firstentry, lastentry - firstentry);
+
+    lastentry = firstentry + nentries;
+    unsigned int nthreads = m_nthreads > 0 ? m_nthreads : std::max(std::thread::hardware_concurrency(), 1u);
+    nthreads = (unsigned int) std::max(std::min((Long64_t) nthreads, nentries), (Long64_t) 1);
+
+    // Chain entry offsets of the files (known, see canExecuteInParallel)
+    std::vector<Long64_t> offsets;
+    if (TChain* chain = dynamic_cast<TChain*>(fTree))
+        offsets.assign(chain->GetTreeOffset(), chain->GetTreeOffset() + chain->GetNtrees() + 1);
+    else
+        offsets = {0, fTree->GetEntries()};
+
+    // Thread 0
+    fTree->LoadTree(firstentry);
+    for (auto& data: m_draws) {
+        data.selector->SetOption(data.options.c_str());
+        data.selector->Begin(fTree);       //<===call user initialization function
+        data.selector->SlaveBegin(fTree);  //<===call user initialization function
+        if (data.selector->Version() >= 2)
+            data.selector->Init(fTree);
+        data.selector->Notify();
+    }
+    NotifyProxier notifyProxier(m_draws);
+    fTree->SetNotify(&notifyProxier);
+
+    // Threads 1..n-1 (booked here, in the calling thread, so that the formulas are compiled and the histograms are created serially)
+    std::vector<DrawWorker> workers(nthreads);
+    for (unsigned int iworker = 1; iworker < nthreads; ++iworker) {
+        DrawWorker& worker = workers[iworker];
+        worker.chain.reset(new TChain(fTree->GetName()));
+        if (TChain* chain = dynamic_cast<TChain*>(fTree)) {
+            TIter next(chain->GetListOfFiles());
+            while (TChainElement* element = (TChainElement*) next())
+                worker.chain->AddFile(element->GetTitle(), element->GetEntries(), element->GetName());
+        } else {
+            worker.chain->AddFile(fTree->GetCurrentFile()->GetName(), fTree->GetEntries(), fTree->GetName());
+        }
+        if (fTree->GetListOfAliases()) {
+            TIter next(fTree->GetListOfAliases());
+            while (TObject* alias = next())
+                worker.chain->SetAlias(alias->GetName(), alias->GetTitle());
+        }
+        if (fTree->GetCacheSize() > 0)
+            worker.chain->SetCacheSize(fTree->GetCacheSize());
+        // TSelectorDraw multiplies every fill by the tree weight. A weight set on the chain ("global"), or on a single tree in memory,
+        // is the one to use in the copy too; the weights stored with the trees in the files come along with the files.
+        TChain* chain = dynamic_cast<TChain*>(fTree);
+        if (!chain || chain->TestBit(TChain::kGlobalWeight))
+            worker.chain->SetWeight(fTree->GetWeight(), "global");
+        worker.chain->LoadTree(firstentry);
+
+        for (auto& data: m_draws) {
+            DrawData copy;
+            copy.input.reset(new TList());
+            copy.input->Add(new TNamed("varexp", renameTarget(data.input->FindObject("varexp")->GetTitle(), Form("_mdworker%u", iworker)).Data()));
+            copy.input->Add(new TNamed("selection", data.input->FindObject("selection")->GetTitle()));
+            copy.firstentry = data.firstentry;
+            copy.nentries = data.nentries;
+            copy.options = data.options;
+            copy.selector.reset(new TSelectorMultiDraw(&m_formulacache));
+            copy.selector->SetInputList(copy.input.get());
+            copy.selector->SetOption(copy.options.c_str());
+            copy.selector->Begin(worker.chain.get());
+            copy.selector->SlaveBegin(worker.chain.get());
+            if (copy.selector->Version() >= 2)
+                copy.selector->Init(worker.chain.get());
+            copy.selector->Notify();
+            worker.draws.push_back(copy);
+        }
+        worker.notifier.reset(new NotifyProxier(worker.draws));
+        worker.chain->SetNotify(worker.notifier.get());
+    }
+
+    RooUtil::print( Form("Start EventLooping using TMultiDrawTreePlayer with %u threads", nthreads) );
+    RooUtil::start();
+    TBenchmark* bmark = new TBenchmark();
+    bmark->Start("benchmark");
+    RooUtil::print( Form("Total events to loop over = %lld", nentries) );
+
+    // The files are handed out in order. The thread that takes a file opens it, finds its clusters, keeps the first one
+    // and queues the others for whichever thread runs out of work first.
+    std::mutex queuemutex;
+    std::deque<std::pair<Long64_t, Long64_t>> queue;
+    size_t nextfile = 0;
+    std::atomic<Long64_t> nprocessed(0);
+    std::atomic<unsigned int> nfinished(0);
+    std::atomic<bool> abort(false);
+    auto work = [&](unsigned int iworker) {
+        TTree* tree = iworker == 0 ? fTree : workers[iworker].chain.get();
+        std::vector<DrawData>& draws = iworker == 0 ? m_draws : workers[iworker].draws;
+        while (!abort) {
+            std::pair<Long64_t, Long64_t> cluster;
+            size_t ifile = offsets.size();
+            {
+                std::lock_guard<std::mutex> lock(queuemutex);
+                if (!queue.empty()) {
+                    cluster = queue.front();
+                    queue.pop_front();
+                } else if (nextfile + 1 < offsets.size()) {
+                    ifile = nextfile++;
+                } else {
+                    break;
+                }
+            }
+            if (ifile < offsets.size()) {
+                if (offsets[ifile + 1] <= firstentry || offsets[ifile] >= lastentry)
+                    continue;
+                if (tree->LoadTree(std::max(offsets[ifile], firstentry)) < 0)
+                    continue;
+                std::vector<std::pair<Long64_t, Long64_t>> ranges = getClusterRanges(tree->GetTree(), offsets[ifile], firstentry, lastentry);
+                if (ranges.empty())
+                    continue;
+                cluster = ranges[0];
+                std::lock_guard<std::mutex> lock(queuemutex);
+                queue.insert(queue.end(), ranges.begin() + 1, ranges.end());
+            }
+            for (Long64_t entry = cluster.first; entry < cluster.second && !abort; ++entry) {
+                Long64_t localEntry = tree->LoadTree(entry);
+                if (localEntry < 0)
+                    break;
+                // kAbortFile only skips the rest of the cluster here
+                bool skipToNextFile = false;
+                if (!processEntry(draws, entry, localEntry, skipToNextFile))
+                    abort = true;
+                ++nprocessed;
+                if (skipToNextFile)
+                    break;
+            }
+        }
+        ++nfinished;
+    };
+    std::vector<std::thread> threads;
+    for (unsigned int iworker = 0; iworker < nthreads; ++iworker)
+        threads.emplace_back(work, iworker);
+
+    // Progress, from the calling thread
+    std::chrono::time_point<std::chrono::system_clock> t_first = std::chrono::system_clock::now();
+    while (nfinished < nthreads) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(500));
+        if (isatty(1) && nentries > 0) {
+            double dt_total = ((std::chrono::duration<double>)(std::chrono::system_clock::now() - t_first)).count();
+            Long64_t ndone = nprocessed;
+            float pct = (float)ndone/(nentries*0.01);
+            float prate = ndone/dt_total;
+            float peta = prate > 0 ? (nentries-ndone)/prate : 0;
+            printf("\015\033[32m ---> \033[1m\033[31m%4.1f%% \033[34m [%.2f kHz, ETA: %.0f s] \033[0m\033[32m  <---\033[0m\015 ", pct, prate/1000.0, peta);
+            fflush(stdout);
+        }
+    }
+    for (auto& thread: threads)
+        thread.join();
+
+    RooUtil::end();
+
+    using namespace std;
+    bmark->Stop("benchmark");
+    cout << endl;
+    cout << "------------------------------" << endl;
+    cout << "CPU  Time:	" << Form( "%.01f", bmark->GetCpuTime("benchmark")  ) << endl;
+    cout << "Real Time:	" << Form( "%.01f", bmark->GetRealTime("benchmark") ) << endl;
+    cout << endl;
+    delete bmark;
+
+    fTree->SetNotify(0); // Detach the selector from the tree.
+    for (unsigned int iworker = 1; iworker < nthreads; ++iworker)
+        workers[iworker].chain->SetNotify(0);
+
+    bool res = true;
+    for (size_t idraw = 0; idraw < m_draws.size(); ++idraw) {
+        DrawData& data = m_draws[idraw];
+        bool process = (data.selector->GetAbort() != TSelector::kAbortProcess &&
+                (data.selector->Version() != 0 || data.selector->GetStatus() != -1)) ? true : false;
+
+        if (! process)
+            continue;
+
+        data.selector->SlaveTerminate();   //<==call user termination function
+        data.selector->Terminate();        //<==call user termination function
+        Long64_t nselected = data.selector->GetStatus();
+
+        TH1* hist = dynamic_cast<TH1*>(data.selector->GetObject());
+        TList copies;
+        for (unsigned int iworker = 1; iworker < nthreads; ++iworker) {
+            TSelectorDraw* copy = workers[iworker].draws[idraw].selector.get();
+            copy->SlaveTerminate();
+            copy->Terminate();
+            nselected += copy->GetStatus();
+            if (copy->GetObject())
+                copies.Add(copy->GetObject());
+        }
+        if (hist && copies.GetSize() > 0)
+            hist->Merge(&copies);
+        copies.Delete();
+        res &= (nselected != 0);
+    }
+
+    fSelectorUpdate = 0;
+    m_draws.clear();
+    m_formulacache.clear();
 
     return res;
 }
@@ -43,6 +43,7 @@
 #include <chrono>
 #include <ctime>
 #include <numeric>
+#include <utility>
 
 class TVirtualIndex;
 
@@ -83,6 +84,11 @@ private:
 
 protected:
    std::vector<DrawData> m_draws;
+   unsigned int m_nthreads;
+   TFormulaValueCache m_formulacache; // values of the distinct cuts and weights of the queued draws at the current entry
+
+   bool canExecuteInParallel() const;
+   bool executeParallel();
 
 public:
    TMultiDrawTreePlayer();
@@ -91,6 +97,11 @@ public:
    virtual bool queueDraw(const char* varexp, const char* selection, Option_t *option = "", Long64_t nentries = 1000000000, Long64_t firstentry = 0);
    virtual bool execute();
 
+   // Number of threads execute() spreads the tree clusters over (1 = serial in the calling thread, which is the default, 0 = all cores).
+   // Each thread reads its own copy of the chain with its own selectors, and the histograms are merged at the end.
+   // The draws run serially anyway unless every one of them books its histogram with explicit binning, e.g. "pt>>h(50,0,250)".
+   void setNumberOfThreads(unsigned int nthreads) { m_nthreads = nthreads; }
+
 };
 
 #endif
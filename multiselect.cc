@@ -1,15 +1,156 @@
 #include "multiselect.h"
 #include <TTreeFormula.h>
+#include <TTreeFormulaManager.h>
+
+#include <cctype>
+#include <cstring>
+
+std::shared_ptr<TFormulaValueCache::Value> TFormulaValueCache::get(TTree* tree, const char* expression) {
+    std::shared_ptr<Value>& value = m_values[std::make_pair(tree, std::string(expression))];
+    if (!value) {
+        value.reset(new Value());
+        value->entry = -1;
+        value->value = 0;
+    }
+    return value;
+}
+
+TSharedTreeFormula::TSharedTreeFormula(const char* name, const char* expression, TTree* tree):
+    TTreeFormula(name, expression, tree),
+    m_factor(0) {
+    // Empty
+}
+
+TSharedTreeFormula::~TSharedTreeFormula() {
+    delete m_factor;
+}
+
+bool TSharedTreeFormula::isShareable() {
+    return GetNdim() > 0 && GetMultiplicity() == 0 && !IsString() && !EvalClass();
+}
+
+Double_t TSharedTreeFormula::EvalInstance(Int_t i, const char* stringStack[]) {
+    if (i != 0 || !m_value)
+        return TTreeFormula::EvalInstance(i, stringStack);
+
+    Long64_t entry = GetTree()->GetReadEntry();
+    if (m_value->entry != entry) {
+        m_value->value = TTreeFormula::EvalInstance(0, stringStack);
+        m_value->entry = entry;
+    }
+    Double_t value = m_value->value;
+    // the remaining factors are not evaluated for entries that fail a cut
+    if (m_factor && value != 0)
+        value *= m_factor->EvalInstance(0, stringStack);
+    return value;
+}
+
+void TSharedTreeFormula::UpdateFormulaLeaves() {
+    TTreeFormula::UpdateFormulaLeaves();
+    if (m_factor)
+        m_factor->UpdateFormulaLeaves();
+}
+
+// Splits a selection written as a product of parenthesized factors, "(A)*(B)*...", as drawHistograms queues "(cut)*(wgt)".
+// Any other selection is returned as its only factor.
+std::vector<std::string> TSelectorMultiDraw::splitFactors(const char* selection) {
+    std::string s(selection);
+    std::vector<std::string> factors;
+    size_t i = 0;
+    while (true) {
+        while (i < s.size() && isspace(s[i])) i++;
+        if (i == s.size() || s[i] != '(')
+            return {s};
+        size_t open = i;
+        int depth = 0;
+        char quote = 0;
+        for (; i < s.size(); i++) {
+            if (quote) {
+                if (s[i] == quote) quote = 0;
+            } else if (s[i] == '"' || s[i] == '\'') {
+                quote = s[i];
+            } else if (s[i] == '(') {
+                depth++;
+            } else if (s[i] == ')' && --depth == 0) {
+                break;
+            }
+        }
+        if (i == s.size())
+            return {s};
+        factors.push_back(s.substr(open + 1, i - open - 1));
+        i++;
+        while (i < s.size() && isspace(s[i])) i++;
+        if (i == s.size())
+            return factors;
+        if (s[i] != '*')
+            return {s};
+        i++;
+    }
+}
+
+// Compiles the selection of a draw, once. A product of factors gets one formula per factor, so that a cut shared across
+// weights, or a weight shared across cuts, is evaluated once per entry for all the draws. Only scalar, numerical factors are
+// shared; otherwise the selection is compiled as a whole. Returns 0 if the selection does not compile.
+TTreeFormula* TSelectorMultiDraw::compileSelection(const char* selection) {
+    std::vector<std::string> factors = splitFactors(selection);
+    if (factors.size() > 1) {
+        std::vector<TSharedTreeFormula*> formulas;
+        bool shareable = true;
+        for (size_t i = 0; i < factors.size() && shareable; i++) {
+            formulas.push_back(new TSharedTreeFormula("Selection", factors[i].c_str(), fTree));
+            shareable = formulas.back()->isShareable();
+        }
+        if (shareable) {
+            for (size_t i = 0; i < formulas.size(); i++) {
+                formulas[i]->share(m_cache->get(fTree, factors[i].c_str()));
+                if (i + 1 < formulas.size())
+                    formulas[i]->multiplyBy(formulas[i + 1]);
+                formulas[i]->SetQuickLoad(false);
+                fManager->Add(formulas[i]);
+            }
+            return formulas[0];
+        }
+        for (TSharedTreeFormula* formula: formulas)
+            delete formula;
+    }
+
+    TSharedTreeFormula* formula = new TSharedTreeFormula("Selection", selection, fTree);
+    if (!formula->GetNdim()) {
+        delete formula;
+        return 0;
+    }
+    if (formula->isShareable())
+        formula->share(m_cache->get(fTree, selection));
+    fManager->Add(formula);
+    return formula;
+}
 
 Bool_t TSelectorMultiDraw::CompileVariables(const char *varexp/* = ""*/, const char *selection/* = ""*/) {
-    Bool_t ret = TSelectorDraw::CompileVariables(varexp, selection);
+    // With a cache the selection is compiled here rather than by TSelectorDraw, so that it is not compiled twice
+    bool ownselection = m_cache && selection && strlen(selection);
+    Bool_t ret = TSelectorDraw::CompileVariables(varexp, ownselection ? "" : selection);
+
+    if (ret && ownselection) {
+        fSelect = compileSelection(selection);
+        if (!fSelect) {
+            ClearFormula();
+            return kFALSE;
+        }
+        // as TSelectorDraw::CompileVariables does, now with the selection among the formulas
+        fManager->Sync();
+        if (fManager->GetMultiplicity() == -1)
+            fTree->SetBit(TTree::kForceRead);
+        if (fManager->GetMultiplicity() >= 1)
+            fMultiplicity = fManager->GetMultiplicity();
+    }
 
     // Disable quick load on all formulas
     if (fSelect)
         fSelect->SetQuickLoad(false);
 
     for (size_t i = 0; i < (size_t) fDimension; i++) {
-        fVar[i]->SetQuickLoad(false);
+        if (fVar[i])
+            fVar[i]->SetQuickLoad(false);
     }
 
     return ret;
@@ -3,11 +3,62 @@
 #define ROOT_TSelectorMultiDraw
 
 #include "TSelectorDraw.h"
+#include "TTreeFormula.h"
+
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+// Value of a formula at the current entry, shared by every formula with the same expression on the same tree, so that the
+// draws queued in one TMultiDrawTreePlayer evaluate each distinct cut or weight once per entry
+class TFormulaValueCache {
+    public:
+        struct Value {
+            Long64_t entry;
+            Double_t value;
+        };
+
+        std::shared_ptr<Value> get(TTree* tree, const char* expression);
+        size_t size() const { return m_values.size(); }
+        void clear() { m_values.clear(); }
+
+    private:
+        std::map<std::pair<TTree*, std::string>, std::shared_ptr<Value>> m_values;
+};
+
+// Selection formula of a draw. Its value is shared through the cache if share() was called (scalar, numerical formulas only),
+// and is multiplied by the next factor of the selection if any (the factor is owned by this formula).
+class TSharedTreeFormula: public TTreeFormula {
+    public:
+        TSharedTreeFormula(const char* name, const char* expression, TTree* tree);
+        virtual ~TSharedTreeFormula();
+
+        bool isShareable();
+        void share(std::shared_ptr<TFormulaValueCache::Value> value) { m_value = value; }
+        void multiplyBy(TSharedTreeFormula* factor) { m_factor = factor; }
+
+        using TTreeFormula::EvalInstance;
+        virtual Double_t EvalInstance(Int_t i = 0, const char* stringStack[] = 0) override;
+        virtual void UpdateFormulaLeaves() override;
+
+    private:
+        std::shared_ptr<TFormulaValueCache::Value> m_value;
+        TSharedTreeFormula* m_factor;
+};
 
 class TSelectorMultiDraw: public TSelectorDraw {
+    public:
+        TSelectorMultiDraw(TFormulaValueCache* cache = 0): m_cache(cache) {}
+
     protected:
         virtual Bool_t CompileVariables(const char *varexp="", const char *selection="");
 
+        TTreeFormula* compileSelection(const char* selection);
+        static std::vector<std::string> splitFactors(const char* selection);
+
+        TFormulaValueCache* m_cache;
+
 //    public:
 //        ClassDef(TSelectorMultiDraw, 1);  //A specialized TSelector for multi-drawing
 };
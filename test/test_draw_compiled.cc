@@ -0,0 +1,82 @@
+// DrawUtil::drawHistogramsCompiled fills the same histograms as DrawUtil::drawHistograms for the same DrawExprs
+
+#include "testutil.h"
+#include "draw.h"
+
+#include "TChain.h"
+#include "TFile.h"
+#include "TRandom3.h"
+#include "TTree.h"
+
+using RooUtil::Test::check;
+using RooUtil::Test::sameHistograms;
+
+static void writeInput(TString path, int seed, int nevents, double treeweight)
+{
+    TFile f(path, "recreate");
+    TTree t("t", "t");
+    t.SetWeight(treeweight); // stored with the tree, applied unless the chain has a global weight
+    int n;
+    float x;
+    std::vector<float> v;
+    t.Branch("n", &n);
+    t.Branch("x", &x);
+    t.Branch("v", &v);
+    TRandom3 rnd(seed);
+    for (int i = 0; i < nevents; ++i)
+    {
+        n = rnd.Integer(7);
+        x = rnd.Uniform(0, 100);
+        v.clear();
+        for (int j = 0; j < n % 4; ++j) // 0 to 3 elements, so that v[2] is often out of range
+            v.push_back(rnd.Uniform(0, 100));
+        t.Fill();
+    }
+    t.Write();
+}
+
+static RooUtil::DrawUtil::DrawExprs getDrawExprs(TString suffix)
+{
+    return {
+        // integer division: TTreeFormula evaluates n/2 in double
+        {"n/2>>intdiv" + suffix + "(14,0,3.5)", "1", "1"},
+        {"x>>intdivcut" + suffix + "(20,0,100)", "n/2 > 1", "3/2"},
+        // out-of-range vector indices drop the entry, in the variables and in the selection
+        {"v[2]>>vidx" + suffix + "(20,0,100)", "x > 10", "1"},
+        {"x>>vidxcut" + suffix + "(20,0,100)", "v[1] > 30", "1"},
+        {"v[0]:x>>vidx2d" + suffix + "(10,0,100,10,0,100)", "n >= 1", "v[0]/100"},
+        // plain weights on top of the tree weight
+        {"x>>wgt" + suffix + "(20,0,100)", "n >= 2", "x/10"},
+    };
+}
+
+static void compare(TChain* chain, TString label)
+{
+    std::map<TString, TH1*> ref = RooUtil::DrawUtil::drawHistograms(chain, getDrawExprs("_ref_" + label));
+    std::map<TString, TH1*> jit = RooUtil::DrawUtil::drawHistogramsCompiled(chain, getDrawExprs("_jit_" + label));
+    check(ref.size() == jit.size() && ref.size() == getDrawExprs("").size(), label + ": every draw is filled by both");
+    for (auto& pair : ref)
+    {
+        TString name = pair.first;
+        name.ReplaceAll("_ref_", "_jit_");
+        check(jit.count(name) && sameHistograms(pair.second, jit[name], 1e-6), label + ": " + pair.first + " compiled == TTreeFormula");
+    }
+}
+
+int main()
+{
+    TChain* chain = new TChain("t");
+    writeInput("test_draw_compiled_0.root", 1, 5000, 0.5);
+    writeInput("test_draw_compiled_1.root", 2, 3000, 1.0);
+    chain->Add("test_draw_compiled_0.root");
+    chain->Add("test_draw_compiled_1.root");
+
+    // per-file tree weights
+    compare(chain, "treewgt");
+
+    // chain weight overriding them
+    chain->SetWeight(1.7, "global");
+    compare(chain, "chainwgt");
+
+    return RooUtil::Test::result();
+}
@@ -0,0 +1,105 @@
+// CutEventList::writeBinary/readBinary round trip, and rejection of truncated or corrupt files
+
+#include "testutil.h"
+#include "cutflowutil.h"
+
+#include <climits>
+#include <fstream>
+
+using RooUtil::Test::check;
+using RooUtil::CutEventList;
+
+static void writeBytes(TString path, const std::string& buf)
+{
+    std::ofstream f(path.Data(), std::ios::binary);
+    f.write(buf.data(), buf.size());
+}
+
+static std::string readBytes(TString path)
+{
+    std::ifstream f(path.Data(), std::ios::binary);
+    return std::string((std::istreambuf_iterator<char>(f)), std::istreambuf_iterator<char>());
+}
+
+static bool sameEvents(CutEventList& a, CutEventList& b)
+{
+    a.sort();
+    b.sort();
+    return a.runs == b.runs && a.lumis == b.lumis && a.evts == b.evts;
+}
+
+int main()
+{
+    TString path = "test_eventlist_binary.bin";
+
+    // Round trip, unsorted input with negative ids, repeated runs/lumis and large gaps in every column
+    CutEventList written;
+    written.add(1, 10, 100);
+    written.add(-5, -3, 7);
+    written.add(1, 10, 99);
+    written.add(1, 11, 0);
+    written.add(INT_MAX, INT_MAX, ULLONG_MAX);
+    written.add(INT_MIN, INT_MIN, 0);
+    written.add(INT_MIN, INT_MAX, ULLONG_MAX - 1);
+    written.add(-5, -3, 1ULL << 40);
+    written.add(1, 10, 100); // duplicate
+    for (int i = 0; i < 1000; ++i)
+        written.add(300000 + i / 100, i % 7 - 3, 1000ULL * i * i);
+    CutEventList expected = written;
+    written.writeBinary(path);
+    CutEventList read;
+    check(read.readBinary(path), "round trip: read back");
+    check(read.size() == expected.size(), "round trip: same number of events");
+    check(sameEvents(read, expected), "round trip: same events");
+
+    // Empty list
+    CutEventList empty;
+    empty.writeBinary(path);
+    check(read.readBinary(path) && read.size() == 0, "empty list: read back as empty");
+
+    // Every truncation of a valid file is rejected and leaves the list empty
+    written.writeBinary(path);
+    std::string good = readBytes(path);
+    bool alltruncated = true;
+    for (size_t len = 0; len < good.size(); ++len)
+    {
+        writeBytes(path, good.substr(0, len));
+        CutEventList l;
+        l.add(1, 1, 1);
+        if (l.readBinary(path) || l.size() != 0)
+        {
+            alltruncated = false;
+            std::cout << "    accepted a file truncated to " << len << " of " << good.size() << " bytes" << std::endl;
+        }
+    }
+    check(alltruncated, "truncated files: rejected");
+
+    // Trailing garbage
+    writeBytes(path, good + "x");
+    check(!read.readBinary(path), "trailing bytes: rejected");
+
+    // Wrong magic
+    std::string badmagic = good;
+    badmagic[0] = 'X';
+    writeBytes(path, badmagic);
+    check(!read.readBinary(path), "wrong magic: rejected");
+
+    // Oversized headers: an event count beyond what the file holds, up to the largest uint64, is rejected before allocating
+    for (unsigned long long n : {4ULL, 1000ULL, 1ULL << 40, ULLONG_MAX})
+    {
+        std::string buf = "RUEVTLST";
+        CutEventList::putVarint(buf, n);
+        buf += std::string(9, '\0'); // three events of one byte per column
+        writeBytes(path, buf);
+        check(!read.readBinary(path) && read.size() == 0, Form("event count %llu with 3 events of data: rejected", n));
+    }
+
+    // Overlong varint (more than 64 bits of continuation bytes)
+    writeBytes(path, std::string("RUEVTLST") + std::string(11, '\xff') + std::string(1, '\0'));
+    check(!read.readBinary(path), "overlong varint: rejected");
+
+    // Missing file
+    check(!read.readBinary("test_eventlist_binary_missing.bin"), "missing file: rejected");
+
+    return RooUtil::Test::result();
+}
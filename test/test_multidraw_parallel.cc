@@ -0,0 +1,77 @@
+// Parallel and serial TMultiDrawTreePlayer::execute() fill the same histograms on a multi-file chain with a chain weight
+
+#include "testutil.h"
+#include "multidraw.h"
+
+#include "TChain.h"
+#include "TFile.h"
+#include "TRandom3.h"
+#include "TROOT.h"
+#include "TTree.h"
+
+using RooUtil::Test::check;
+using RooUtil::Test::sameHistograms;
+
+static void writeInput(TString path, int seed, int nevents)
+{
+    TFile f(path, "recreate");
+    TTree t("t", "t");
+    t.SetAutoFlush(500); // several clusters per file
+    float x, y;
+    int n;
+    t.Branch("x", &x);
+    t.Branch("y", &y);
+    t.Branch("n", &n);
+    TRandom3 rnd(seed);
+    for (int i = 0; i < nevents; ++i)
+    {
+        x = rnd.Gaus(50, 20);
+        y = rnd.Uniform(-3, 3);
+        n = rnd.Poisson(3);
+        t.Fill();
+    }
+    t.Write();
+}
+
+static std::vector<TH1*> draw(TChain* chain, unsigned int nthreads, TString suffix)
+{
+    TMultiDrawTreePlayer p;
+    p.SetTree(chain);
+    p.setNumberOfThreads(nthreads);
+    p.queueDraw("x>>hx" + suffix + "(40,0,100)", "(n>1)*(1+0.1*y)", "goff");
+    p.queueDraw("y>>hy" + suffix + "(30,-3,3)", "x>40", "goff");
+    p.queueDraw("y:x>>hyx" + suffix + "(20,0,100,12,-3,3)", "n", "goff");
+    p.execute();
+    std::vector<TH1*> hists;
+    for (TString name : {"hx", "hy", "hyx"})
+        hists.push_back((TH1*) gROOT->FindObject(name + suffix));
+    return hists;
+}
+
+int main()
+{
+    std::vector<int> nevents = {3000, 1700, 10, 4200};
+    TChain* chain = new TChain("t");
+    for (unsigned int i = 0; i < nevents.size(); ++i)
+    {
+        TString path = Form("test_multidraw_parallel_%u.root", i);
+        writeInput(path, i + 1, nevents[i]);
+        chain->AddFile(path, nevents[i]); // the entry counts are known, as needed for the parallel execution
+    }
+
+    for (double weight : {1., 2.5})
+    {
+        chain->SetWeight(weight, "global");
+        std::vector<TH1*> serial = draw(chain, 1, Form("_serial_w%d", (int) (weight * 10)));
+        std::vector<TH1*> parallel = draw(chain, 4, Form("_parallel_w%d", (int) (weight * 10)));
+        for (unsigned int i = 0; i < serial.size(); ++i)
+        {
+            check(serial[i] && parallel[i], Form("weight %g draw %u booked in both modes", weight, i));
+            check(sameHistograms(serial[i], parallel[i]), Form("weight %g draw %u: parallel == serial", weight, i));
+            if (serial[i])
+                check(serial[i]->GetEntries() > 0, Form("weight %g draw %u: filled", weight, i));
+        }
+    }
+
+    return RooUtil::Test::result();
+}
@@ -0,0 +1,108 @@
+// SparseHist1D/2D filled like a TH1 and converted with toDense() match a TH1 filled the normal way (with Sumw2)
+
+#include "testutil.h"
+#include "cutflowutil.h"
+
+#include "TH2F.h"
+#include "TRandom3.h"
+
+using RooUtil::Test::check;
+using RooUtil::Test::sameHistograms;
+
+int main()
+{
+    TH1::AddDirectory(kFALSE);
+    TRandom3 rnd(4321);
+
+    // 1D: weighted and unweighted fills, values in the underflow and the overflow, and the TH1 bin accessors
+    {
+        RooUtil::SparseHist1D sparse("sparse1d", 40, 0, 100);
+        THist dense("dense1d", "dense1d", 40, 0, 100);
+        dense.Sumw2();
+        bool samebins = true;
+        for (int i = 0; i < 50000; ++i)
+        {
+            double x = rnd.Gaus(50, 45);
+            double w = rnd.Uniform(-0.5, 2);
+            samebins &= sparse.Fill(x, w) == dense.Fill(x, w);
+            if (i % 7 == 0)
+            {
+                sparse.Fill(x);
+                dense.Fill(x);
+            }
+        }
+        check(samebins, "1D: Fill returns the same global bin as TH1");
+        sparse.AddBinContent(3, 2.5);
+        dense.AddBinContent(3, 2.5);
+        dense.SetBinError(3, std::sqrt(dense.GetBinError(3) * dense.GetBinError(3) + 2.5 * 2.5)); // TH1::AddBinContent leaves the sumw2 as is, the sparse bins add w^2
+        sparse.SetBinContent(5, 7);
+        dense.SetBinContent(5, 7);
+        sparse.SetBinError(5, 0.5);
+        dense.SetBinError(5, 0.5);
+
+        bool sameaccessors = true;
+        for (int bin = 0; bin < dense.GetNcells(); ++bin)
+            sameaccessors &= std::fabs(sparse.GetBinContent(bin) - dense.GetBinContent(bin)) < 1e-9 * std::max(1., std::fabs(dense.GetBinContent(bin)))
+                          && std::fabs(sparse.GetBinError(bin) - dense.GetBinError(bin)) < 1e-9 * std::max(1., dense.GetBinError(bin));
+        check(sameaccessors, "1D: GetBinContent/GetBinError of the sparse histogram == TH1");
+        check(sparse.GetBinContent(0) != 0 && sparse.GetBinContent(41) != 0, "1D: under/overflow are filled");
+
+        THist* converted = sparse.toDense();
+        check(sameHistograms(converted, &dense), "1D: toDense() == TH1, including under/overflow");
+        check(converted->GetSumw2N() > 0, "1D: toDense() has Sumw2");
+        check(converted->GetEntries() == dense.GetEntries(), "1D: toDense() has the same number of entries");
+        check(std::fabs(converted->Integral() - dense.Integral()) < 1e-9 * std::fabs(dense.Integral()), "1D: toDense() has the same integral");
+
+        sparse.Reset();
+        check(sparse.isEmpty() && sparse.GetEntries() == 0, "1D: Reset() empties the sparse bins");
+        delete converted;
+    }
+
+    // 1D variable binning
+    {
+        std::vector<float> bins = {0, 1, 2, 5, 10, 30, 100};
+        std::vector<double> dbins(bins.begin(), bins.end());
+        RooUtil::SparseHist1D sparse("sparse1dvarbin", bins.size() - 1, bins.data());
+        THist dense("dense1dvarbin", "dense1dvarbin", dbins.size() - 1, dbins.data());
+        dense.Sumw2();
+        for (int i = 0; i < 20000; ++i)
+        {
+            double x = rnd.Exp(20) - 1;
+            double w = rnd.Uniform(0, 3);
+            sparse.Fill(x, w);
+            dense.Fill(x, w);
+        }
+        THist* converted = sparse.toDense();
+        check(sameHistograms(converted, &dense), "1D variable binning: toDense() == TH1");
+        delete converted;
+    }
+
+    // 2D, with the under/overflow in x and in y
+    {
+        RooUtil::SparseHist2D sparse("sparse2d", 30, 0, 100, 20, -5, 5);
+        TH2F dense("dense2d", "dense2d", 30, 0, 100, 20, -5, 5);
+        dense.Sumw2();
+        for (int i = 0; i < 50000; ++i)
+        {
+            double x = rnd.Gaus(50, 45);
+            double y = rnd.Gaus(0, 4);
+            double w = rnd.Uniform(0, 2);
+            sparse.Fill(x, y, w);
+            dense.Fill(x, y, w);
+            if (i % 5 == 0)
+            {
+                sparse.Fill(x, y);
+                dense.Fill(x, y);
+            }
+        }
+        TH2F* converted = sparse.toDense();
+        // TH2F rounds its float contents after every fill, the sparse bins only once in toDense()
+        check(sameHistograms(converted, &dense, 1e-5), "2D: toDense() == TH2F, including under/overflow");
+        check(converted->GetEntries() == dense.GetEntries(), "2D: toDense() has the same number of entries");
+        check(sparse.GetBinContent(sparse.GetBin(0, 10)) != 0 && sparse.GetBinContent(sparse.GetBin(31, 10)) != 0
+           && sparse.GetBinContent(sparse.GetBin(10, 0)) != 0 && sparse.GetBinContent(sparse.GetBin(10, 21)) != 0, "2D: under/overflow in x and y are filled");
+        delete converted;
+    }
+
+    return RooUtil::Test::result();
+}
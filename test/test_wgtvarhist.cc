@@ -0,0 +1,102 @@
+// WgtVarHist (one pass over the weight variations with the nominal fill) gives the same histograms as filling every variation
+// histogram on its own, for dense and sparse nominal histograms
+
+#include "testutil.h"
+#include "cutflowutil.h"
+
+#include "TH2F.h"
+#include "TRandom3.h"
+
+using RooUtil::Test::check;
+using RooUtil::Test::sameHistograms;
+
+static const unsigned int nvariations = 5;
+
+// Per-event weight variations: up/down scale factors, one that is zero for some events and one that is always zero
+static std::vector<float> getWgtVars(TRandom3& rnd)
+{
+    std::vector<float> wgtvars;
+    wgtvars.push_back(1 + 0.1 * rnd.Gaus());
+    wgtvars.push_back(1 - 0.1 * rnd.Gaus());
+    wgtvars.push_back(rnd.Uniform() < 0.3 ? 0 : rnd.Uniform(0.5, 2));
+    wgtvars.push_back(0);
+    wgtvars.push_back(-1); // negative weights
+    return wgtvars;
+}
+
+// TH2F stores float contents, which are rounded after every fill in the reference but only once per flush in WgtVarHist
+template <class Nominal, class Book, class Fill, class Dense>
+static void compare(TString label, double tolerance, Book book, Fill fill, Dense dense)
+{
+    TRandom3 rnd(12345);
+    Nominal* nominal = book("nominal_" + label);
+    std::vector<TH1*> variations;
+    std::vector<TH1*> references;
+    RooUtil::WgtVarHist wvh(nominal);
+    // Use the variations in a different order than the per-event vector, as Cutflow does for the wgt systematics of a histogram
+    std::vector<unsigned int> varidxs = {3, 0, 4, 2, 1};
+    for (unsigned int i = 0; i < nvariations; ++i)
+    {
+        variations.push_back(book(Form("var%u_%s", i, label.Data())));
+        references.push_back(book(Form("ref%u_%s", i, label.Data())));
+        wvh.addVariation(variations.back(), varidxs[i]);
+    }
+
+    // Two rounds of fills, each flushed into the variation histograms, with values outside of the axes (under/overflow)
+    for (int iflush = 0; iflush < 2; ++iflush)
+    {
+        for (int ievent = 0; ievent < 20000; ++ievent)
+        {
+            float weight = rnd.Uniform(0.2, 1.5);
+            std::vector<float> wgtvars = getWgtVars(rnd);
+            double x = rnd.Gaus(50, 40);
+            double y = rnd.Gaus(0, 3);
+            int bin = fill(nominal, x, y, weight);
+            wvh.fill(bin, weight, wgtvars);
+            for (unsigned int i = 0; i < nvariations; ++i)
+                fill((Nominal*) references[i], x, y, weight * wgtvars[varidxs[i]]);
+        }
+        wvh.flush();
+    }
+
+    for (unsigned int i = 0; i < nvariations; ++i)
+    {
+        TH1* var = dense(variations[i]);
+        TH1* ref = dense(references[i]);
+        check(sameHistograms(var, ref, tolerance), Form("%s: variation %u == per variation fill", label.Data(), i));
+        check(var->GetEntries() == ref->GetEntries(), Form("%s: variation %u has the same number of entries", label.Data(), i));
+    }
+}
+
+int main()
+{
+    TH1::AddDirectory(kFALSE);
+
+    // Dense 1D (and variable binning)
+    compare<THist>("dense1d", 1e-9,
+            [](TString n) { THist* h = new THist(n, n, 25, 0, 100); h->Sumw2(); return h; },
+            [](THist* h, double x, double, float w) { return h->Fill(x, w); },
+            [](TH1* h) { return h; });
+    compare<THist>("dense1dvarbin", 1e-9,
+            [](TString n) { std::vector<double> bins = {0, 5, 10, 20, 40, 80, 100}; THist* h = new THist(n, n, bins.size() - 1, bins.data()); h->Sumw2(); return h; },
+            [](THist* h, double x, double, float w) { return h->Fill(x, w); },
+            [](TH1* h) { return h; });
+
+    // Dense 2D
+    compare<TH2F>("dense2d", 1e-5,
+            [](TString n) { TH2F* h = new TH2F(n, n, 20, 0, 100, 12, -6, 6); h->Sumw2(); return h; },
+            [](TH2F* h, double x, double y, float w) { return h->Fill(x, y, w); },
+            [](TH1* h) { return h; });
+
+    // Sparse nominal bins (the variations are accumulated per filled bin), compared after toDense()
+    compare<RooUtil::SparseHist1D>("sparse1d", 1e-9,
+            [](TString n) { return new RooUtil::SparseHist1D(n, 1000, 0, 100); },
+            [](RooUtil::SparseHist1D* h, double x, double, float w) { return h->Fill(x, w); },
+            [](TH1* h) { return (TH1*) ((RooUtil::SparseHist1D*) h)->toDense(); });
+    compare<RooUtil::SparseHist2D>("sparse2d", 1e-5,
+            [](TString n) { return new RooUtil::SparseHist2D(n, 200, 0, 100, 120, -6, 6); },
+            [](RooUtil::SparseHist2D* h, double x, double y, float w) { return h->Fill(x, y, w); },
+            [](TH1* h) { return (TH1*) ((RooUtil::SparseHist2D*) h)->toDense(); });
+
+    return RooUtil::Test::result();
+}
@@ -0,0 +1,52 @@
+//  .
+// ..: Shared helpers of the standalone tests (see Makefile)
+
+#ifndef testutil_h
+#define testutil_h
+
+#include <cmath>
+#include <iostream>
+
+#include "TH1.h"
+#include "TString.h"
+
+namespace RooUtil
+{
+    namespace Test
+    {
+        inline int& nfailed() { static int n = 0; return n; }
+
+        inline void check(bool ok, TString what)
+        {
+            if (!ok)
+                nfailed()++;
+            std::cout << (ok ? "  ok    " : "  FAILED ") << what << std::endl;
+        }
+
+        // Same binning, and every bin (including under/overflow) with the same content and error up to a relative tolerance
+        inline bool sameHistograms(const TH1* a, const TH1* b, double tolerance=1e-9)
+        {
+            if (!a || !b || a->GetNcells() != b->GetNcells())
+                return false;
+            auto close = [&](double x, double y) { return std::fabs(x - y) <= tolerance * std::max(1., std::max(std::fabs(x), std::fabs(y))); };
+            for (int i = 0; i < a->GetNcells(); ++i)
+            {
+                if (!close(a->GetBinContent(i), b->GetBinContent(i)) || !close(a->GetBinError(i), b->GetBinError(i)))
+                {
+                    std::cout << "    bin " << i << ": " << a->GetBinContent(i) << " +- " << a->GetBinError(i)
+                              << " vs " << b->GetBinContent(i) << " +- " << b->GetBinError(i) << std::endl;
+                    return false;
+                }
+            }
+            return true;
+        }
+
+        inline int result()
+        {
+            std::cout << (nfailed() ? Form("%d check(s) failed", nfailed()) : "all checks passed") << std::endl;
+            return nfailed() ? 1 : 0;
+        }
+    }
+}
+
+#endif
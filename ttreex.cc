@@ -17,23 +17,115 @@ using namespace RooUtil;
 RooUtil::TTreeX::TTreeX()
 {
     ttree = 0;
+    compressionsettings = -1;
+    basketsize = 0;
+    autoflush = 0;
+    autosave = 0;
+    isreadmode = false;
+    readentry = -1;
+    readlocalentry = -1;
+    readtreenumber = -1;
+    registerInstance();
 }
 
 //_________________________________________________________________________________________________
 RooUtil::TTreeX::TTreeX(TString treename, TString title)
 {
     ttree = new TTree(treename.Data(), title.Data());
+    compressionsettings = -1;
+    basketsize = 0;
+    autoflush = 0;
+    autosave = 0;
+    isreadmode = false;
+    readentry = -1;
+    readlocalentry = -1;
+    readtreenumber = -1;
+    registerInstance();
 }
 
 //_________________________________________________________________________________________________
 RooUtil::TTreeX::TTreeX(TTree* tree)
 {
     ttree = tree;
+    compressionsettings = -1;
+    basketsize = 0;
+    autoflush = 0;
+    autosave = 0;
+    isreadmode = false;
+    readentry = -1;
+    readlocalentry = -1;
+    readtreenumber = -1;
+    registerInstance();
+}
+
+//_________________________________________________________________________________________________
+// Live TTreeX instances, for the liveness check of the branch handles. The branch names of the destroyed instances are
+// kept so that a handle outliving its TTreeX can still be reported by name. Never deleted, as TTreeX may be destroyed
+// during the static destruction at exit.
+namespace
+{
+    struct TTreeXRegistry
+    {
+        std::mutex mtx;
+        std::unordered_set<const RooUtil::TTreeX*> live;
+        std::unordered_map<const RooUtil::TTreeX*, std::vector<TString>> deadslotnames;
+        std::atomic<unsigned long> ndestroyed{0};
+    };
+    TTreeXRegistry& getTTreeXRegistry()
+    {
+        static TTreeXRegistry* registry = new TTreeXRegistry;
+        return *registry;
+    }
+}
+
+//_________________________________________________________________________________________________
+void RooUtil::TTreeX::registerInstance()
+{
+    TTreeXRegistry& registry = getTTreeXRegistry();
+    std::lock_guard<std::mutex> lock(registry.mtx);
+    registry.live.insert(this);
+    registry.deadslotnames.erase(this);
 }
 
 //_________________________________________________________________________________________________
 RooUtil::TTreeX::~TTreeX()
 {
+    TTreeXRegistry& registry = getTTreeXRegistry();
+    std::lock_guard<std::mutex> lock(registry.mtx);
+    registry.live.erase(this);
+    registry.deadslotnames[this] = std::move(slotnames);
+    registry.ndestroyed++;
+}
+
+//_________________________________________________________________________________________________
+// Called on every access through a branch handle in debug builds: the last instance found alive by this thread stays
+// valid as long as no TTreeX was destroyed since, which costs one atomic load instead of taking the lock.
+bool RooUtil::TTreeX::isAlive(const TTreeX* tx)
+{
+    thread_local const TTreeX* lastalive = 0;
+    thread_local unsigned long lastndestroyed = 0;
+    TTreeXRegistry& registry = getTTreeXRegistry();
+    if (tx == lastalive and registry.ndestroyed.load(std::memory_order_acquire) == lastndestroyed)
+        return true;
+    std::lock_guard<std::mutex> lock(registry.mtx);
+    if (!registry.live.count(tx))
+        return false;
+    lastalive = tx;
+    lastndestroyed = registry.ndestroyed;
+    return true;
+}
+
+//_________________________________________________________________________________________________
+TString RooUtil::TTreeX::getSlotName(const TTreeX* tx, unsigned int slotid)
+{
+    TTreeXRegistry& registry = getTTreeXRegistry();
+    std::lock_guard<std::mutex> lock(registry.mtx);
+    const std::vector<TString>* names = 0;
+    if (registry.live.count(tx))
+        names = &(tx->slotnames);
+    else if (registry.deadslotnames.count(tx))
+        names = &(registry.deadslotnames[tx]);
+    return names and slotid < names->size() ? (*names)[slotid] : TString::Format("(slot %u)", slotid);
 }
 
 //_________________________________________________________________________________________________
@@ -52,23 +144,128 @@ void* RooUtil::TTreeX::getValPtr(TString brname)
 //__________________________________________________________________________________________________
 void RooUtil::TTreeX::clear()
 {
-    for (auto& pair : mapInt_t  ) pair.second = -999;
-    for (auto& pair : mapBool_t ) pair.second = 0;
-    for (auto& pair : mapFloat_t) pair.second = -999;
-    for (auto& pair : mapTString) pair.second = "";
-    for (auto& pair : mapLV     ) pair.second.SetXYZT(0, 0, 0, 0 ) ;
-    for (auto& pair : mapTBits  ) pair.second = 0;
-    for (auto& pair : mapULL    ) pair.second = 0;
-    for (auto& pair : mapUI     ) pair.second = 0;
-    for (auto& pair : mapVecInt_t  ) pair.second.clear();
-    for (auto& pair : mapVecUInt_t ) pair.second.clear();
-    for (auto& pair : mapVecBool_t ) pair.second.clear();
-    for (auto& pair : mapVecFloat_t) pair.second.clear();
-    for (auto& pair : mapVecTString) pair.second.clear();
-    for (auto& pair : mapVecLV     ) pair.second.clear();
-    for (auto& pair : mapVecVInt   ) pair.second.clear();
-    for (auto& pair : mapVecVFloat ) pair.second.clear();
-    for (auto& pair : mapIsBranchSet) pair.second = false;
+    // Only the slots that were set since the last clear() are touched; vector branches keep their capacity
+    for (auto& slotid : dirtyslots)
+    {
+        slotresetters[slotid](*this, slotpositions[slotid]);
+        isBranchSetFlags[slotid] = false;
+    }
+    dirtyslots.clear();
+    for (auto& slotid : alwaysclearslots)
+        slotresetters[slotid](*this, slotpositions[slotid]);
+}
+
+//__________________________________________________________________________________________________
+void RooUtil::TTreeX::setOutputProfile(kOutputProfile profile)
+{
+    // Negative auto-flush/auto-save values are in bytes, i.e. a cluster is flushed every N bytes of uncompressed data.
+    // At the first auto-flush ROOT resizes each branch basket from the entry sizes observed so far (TTree::OptimizeBaskets),
+    // so the basket size given here is only the starting point.
+    switch (profile)
+    {
+        case kDefaultOutput:
+            compressionsettings = -1; basketsize = 0; autoflush = 0; autosave = 0;
+            break;
+        case kFastOutput:
+            compressionsettings = 404; basketsize = 256000; autoflush = -50000000; autosave = -500000000;
+            break;
+        case kCompactOutput:
+            compressionsettings = 505; basketsize = 128000; autoflush = -30000000; autosave = -300000000;
+            break;
+        case kArchivalOutput:
+            compressionsettings = 208; basketsize = 128000; autoflush = -100000000; autosave = -1000000000;
+            break;
+        default:
+            error(TString::Format("unknown output profile = %d", profile), __FUNCTION__);
+            return;
+    }
+    applyOutputSettings(0);
+}
+
+//__________________________________________________________________________________________________
+void RooUtil::TTreeX::setCompressionSettings(int settings) { compressionsettings = settings; applyOutputSettings(0); }
+
+//__________________________________________________________________________________________________
+void RooUtil::TTreeX::setBasketSize(int size) { basketsize = size; applyOutputSettings(0); }
+
+//__________________________________________________________________________________________________
+void RooUtil::TTreeX::setAutoFlush(Long64_t n) { autoflush = n; applyOutputSettings(0); }
+
+//__________________________________________________________________________________________________
+void RooUtil::TTreeX::setAutoSave(Long64_t n) { autosave = n; applyOutputSettings(0); }
+
+//__________________________________________________________________________________________________
+void RooUtil::TTreeX::applyOutputSettings(TBranch* br)
+{
+    // With br = 0 the settings are applied to the tree and all of its existing branches, otherwise only to br
+    if (!ttree)
+        return;
+    if (!br)
+    {
+        if (autoflush != 0) ttree->SetAutoFlush(autoflush);
+        if (autosave != 0) ttree->SetAutoSave(autosave);
+        if (basketsize > 0) ttree->SetBasketSize("*", basketsize);
+        if (compressionsettings >= 0)
+        {
+            // The output file as well, for the tree header, the other objects written to it (e.g. the cutflow histograms)
+            // and any branch ROOT creates without going through createBranch (e.g. the sub-branches of split objects).
+            // A tree that is not attached to a file yet only gets the per branch settings.
+            TFile* file = ttree->GetCurrentFile();
+            if (file and file->IsWritable())
+                file->SetCompressionSettings(compressionsettings);
+            TObjArray* branches = ttree->GetListOfBranches();
+            for (int ib = 0; branches and ib < branches->GetEntries(); ++ib)
+                ((TBranch*) branches->At(ib))->SetCompressionSettings(compressionsettings);
+        }
+        return;
+    }
+    if (basketsize > 0) br->SetBasketSize(basketsize);
+    if (compressionsettings >= 0) br->SetCompressionSettings(compressionsettings);
+}
+
+//__________________________________________________________________________________________________
+void RooUtil::TTreeX::setReadMode(bool readmode)
+{
+    isreadmode = readmode;
+    ttree->SetBranchStatus("*", !readmode);
+    for (auto& reader : readers)
+    {
+        ttree->SetBranchStatus(reader.name, 1);
+        ttree->SetBranchStatus(reader.name + ".*", 1);
+    }
+}
+
+//__________________________________________________________________________________________________
+Long64_t RooUtil::TTreeX::loadEntry(Long64_t entry)
+{
+    // Only positions the tree (and opens the next file of a TChain), the branches are read on access
+    readlocalentry = ttree->LoadTree(entry);
+    if (readlocalentry < 0)
+        return readlocalentry;
+    readentry = entry;
+    if (ttree->GetTreeNumber() != readtreenumber)
+    {
+        // a TChain moved on to a new file: the branch objects are new
+        readtreenumber = ttree->GetTreeNumber();
+        for (auto& reader : readers)
+        {
+            reader.branch = ttree->GetBranch(reader.name);
+            reader.loadedentry = -1;
+        }
+    }
+    return readlocalentry;
+}
+
+//__________________________________________________________________________________________________
+void RooUtil::TTreeX::optimizeBaskets(Long64_t maxmemory)
+{
+    // Resize each branch basket in proportion to the entry sizes observed so far, within a total budget of maxmemory bytes
+    if (ttree->GetEntries() == 0)
+    {
+        warning("no entries filled yet, basket sizes are left as is", __FUNCTION__);
+        return;
+    }
+    ttree->OptimizeBaskets(maxmemory, 1.1, "");
 }
 
 //__________________________________________________________________________________________________
@@ -82,31 +279,80 @@ void RooUtil::TTreeX::save(TFile* ofile)
 //__________________________________________________________________________________________________
 void TTreeX::sortVecBranchesByPt(TString p4_bn, std::vector<TString> aux_float_bns, std::vector<TString> aux_int_bns, std::vector<TString> aux_bool_bns)
 {
-    // https://stackoverflow.com/questions/236172/how-do-i-sort-a-stdvector-by-the-values-of-a-different-stdvector
     // The first argument is the p4 branches
     // The rest of the argument holds the list of auxilary branches that needs to be sorted together.
+    // A single index permutation is computed from the p4 pt's and then applied in place to every branch.
+    // The scratch vectors are members so that, once they have grown to the largest multiplicity, no allocation happens here.
 
-    // Creating a "ordered" index list
-    std::vector<std::pair<size_t, lviter> > order(mapVecLV[p4_bn.Data()].size());
+    std::vector<LV>& p4s = getSlotRef<std::vector<LV>>(p4_bn);
+    const size_t n = p4s.size();
 
-    size_t n = 0;
-    for (lviter it = mapVecLV[p4_bn.Data()].begin(); it != mapVecLV[p4_bn.Data()].end(); ++it, ++n)
-            order[n] = make_pair(n, it);
+    sortpt.resize(n);
+    bool sorted = true;
+    for (size_t i = 0; i < n; ++i)
+    {
+        sortpt[i] = p4s[i].pt();
+        if (i > 0 and sortpt[i] > sortpt[i - 1])
+            sorted = false;
+    }
 
-    sort(order.begin(), order.end(), ordering());
+    // Nothing to do when the collection is already in descending pt order
+    if (sorted)
+        return;
+
+    sortperm.resize(n);
+    sortvisited.resize(n);
+    for (size_t i = 0; i < n; ++i)
+        sortperm[i] = i;
+    const std::vector<float>& pts = sortpt;
+    std::sort(sortperm.begin(), sortperm.end(), [&pts](unsigned int a, unsigned int b) { return pts[a] > pts[b] or (pts[a] == pts[b] and a < b); });
 
     // Sort!
-    mapVecLV[p4_bn.Data()] = sortFromRef<LV>(mapVecLV[p4_bn.Data()], order);
+    applySortPermutation<LV>(p4s, p4_bn);
 
     for ( auto& aux_float_bn : aux_float_bns )
-        mapVecFloat_t[aux_float_bn.Data()] = sortFromRef<Float_t>(mapVecFloat_t[aux_float_bn.Data()], order);
+        applySortPermutation<Float_t>(getSlotRef<std::vector<Float_t>>(aux_float_bn), aux_float_bn);
 
     for ( auto& aux_int_bn : aux_int_bns )
-        mapVecInt_t[aux_int_bn.Data()] = sortFromRef<Int_t>(mapVecInt_t[aux_int_bn.Data()], order);
+        applySortPermutation<Int_t>(getSlotRef<std::vector<Int_t>>(aux_int_bn), aux_int_bn);
 
     for ( auto& aux_bool_bn : aux_bool_bns )
-        mapVecBool_t[aux_bool_bn.Data()] = sortFromRef<Bool_t>(mapVecBool_t[aux_bool_bn.Data()], order);
+        applySortPermutation<Bool_t>(getSlotRef<std::vector<Bool_t>>(aux_bool_bn), aux_bool_bn);
+
+}
+
+//_________________________________________________________________________________________________
+ObjectCollection& TTreeX::createCollection(TString name, std::vector<TString> float_fields, std::vector<TString> int_fields, bool writeToTree)
+{
+    if (hasCollection(name))
+        error(TString::Format("collection already exists name = %s", name.Data()), __FUNCTION__);
+    if (float_fields.size() == 0 and int_fields.size() == 0)
+        error(TString::Format("collection has no fields name = %s", name.Data()), __FUNCTION__);
+    collections.emplace_back(name);
+    collectionindex[name.Data()] = collections.size() - 1;
+    ObjectCollection& coll = collections.back();
+    coll.floatfieldnames = float_fields;
+    coll.intfieldnames = int_fields;
+    for (auto& field : float_fields)
+        coll.floatfields.push_back(createBranch<std::vector<Float_t>>(TString::Format("%s_%s", name.Data(), field.Data()), writeToTree));
+    for (auto& field : int_fields)
+        coll.intfields.push_back(createBranch<std::vector<Int_t>>(TString::Format("%s_%s", name.Data(), field.Data()), writeToTree));
+    return coll;
+}
 
+//_________________________________________________________________________________________________
+ObjectCollection& TTreeX::getCollection(TString name)
+{
+    std::unordered_map<std::string, unsigned int>::const_iterator it = collectionindex.find(name.Data());
+    if (it == collectionindex.end())
+        error(TString::Format("collection doesn't exist name = %s", name.Data()), __FUNCTION__);
+    return collections[it->second];
+}
+
+//_________________________________________________________________________________________________
+bool TTreeX::hasCollection(TString name)
+{
+    return collectionindex.find(name.Data()) != collectionindex.end();
 }
 
 //_________________________________________________________________________________________________
@@ -164,52 +410,245 @@ void TTreeX::setFlatBranch(std::vector<TString> p4_bns, std::vector<TString> flo
 }
 
 //_________________________________________________________________________________________________
-template <> void TTreeX::setBranch<Int_t               >(TString bn, Int_t                val, bool force, bool ignore) { if (force) { mapInt_t     [bn.Data()] = val; mapIsBranchSet[bn.Data()] = true; return; } if (mapInt_t     .find(bn.Data()) != mapInt_t     .end()) {mapInt_t     [bn.Data()] = val; mapIsBranchSet[bn.Data()] = true;} else { if (!ignore) error(TString::Format("branch doesn't exist bn = %s", bn.Data()));} }
-template <> void TTreeX::setBranch<Bool_t              >(TString bn, Bool_t               val, bool force, bool ignore) { if (force) { mapBool_t    [bn.Data()] = val; mapIsBranchSet[bn.Data()] = true; return; } if (mapBool_t    .find(bn.Data()) != mapBool_t    .end()) {mapBool_t    [bn.Data()] = val; mapIsBranchSet[bn.Data()] = true;} else { if (!ignore) error(TString::Format("branch doesn't exist bn = %s", bn.Data()));} }
-template <> void TTreeX::setBranch<Float_t             >(TString bn, Float_t              val, bool force, bool ignore) { if (force) { mapFloat_t   [bn.Data()] = val; mapIsBranchSet[bn.Data()] = true; return; } if (mapFloat_t   .find(bn.Data()) != mapFloat_t   .end()) {mapFloat_t   [bn.Data()] = val; mapIsBranchSet[bn.Data()] = true;} else { if (!ignore) error(TString::Format("branch doesn't exist bn = %s", bn.Data()));} }
-template <> void TTreeX::setBranch<TString             >(TString bn, TString              val, bool force, bool ignore) { if (force) { mapTString   [bn.Data()] = val; mapIsBranchSet[bn.Data()] = true; return; } if (mapTString   .find(bn.Data()) != mapTString   .end()) {mapTString   [bn.Data()] = val; mapIsBranchSet[bn.Data()] = true;} else { if (!ignore) error(TString::Format("branch doesn't exist bn = %s", bn.Data()));} }
-template <> void TTreeX::setBranch<LV                  >(TString bn, LV                   val, bool force, bool ignore) { if (force) { mapLV        [bn.Data()] = val; mapIsBranchSet[bn.Data()] = true; return; } if (mapLV        .find(bn.Data()) != mapLV        .end()) {mapLV        [bn.Data()] = val; mapIsBranchSet[bn.Data()] = true;} else { if (!ignore) error(TString::Format("branch doesn't exist bn = %s", bn.Data()));} }
-template <> void TTreeX::setBranch<TBits               >(TString bn, TBits                val, bool force, bool ignore) { if (force) { mapTBits     [bn.Data()] = val; mapIsBranchSet[bn.Data()] = true; return; } if (mapTBits     .find(bn.Data()) != mapTBits     .end()) {mapTBits     [bn.Data()] = val; mapIsBranchSet[bn.Data()] = true;} else { if (!ignore) error(TString::Format("branch doesn't exist bn = %s", bn.Data()));} }
-template <> void TTreeX::setBranch<unsigned long long  >(TString bn, unsigned long long   val, bool force, bool ignore) { if (force) { mapULL       [bn.Data()] = val; mapIsBranchSet[bn.Data()] = true; return; } if (mapULL       .find(bn.Data()) != mapULL       .end()) {mapULL       [bn.Data()] = val; mapIsBranchSet[bn.Data()] = true;} else { if (!ignore) error(TString::Format("branch doesn't exist bn = %s", bn.Data()));} }
-template <> void TTreeX::setBranch<unsigned int        >(TString bn, unsigned int         val, bool force, bool ignore) { if (force) { mapUI        [bn.Data()] = val; mapIsBranchSet[bn.Data()] = true; return; } if (mapUI        .find(bn.Data()) != mapUI        .end()) {mapUI        [bn.Data()] = val; mapIsBranchSet[bn.Data()] = true;} else { if (!ignore) error(TString::Format("branch doesn't exist bn = %s", bn.Data()));} }
-template <> void TTreeX::setBranch<std::vector<Int_t  >>(TString bn, std::vector<Int_t  > val, bool force, bool ignore) { if (force) { mapVecInt_t  [bn.Data()] = val; mapIsBranchSet[bn.Data()] = true; return; } if (mapVecInt_t  .find(bn.Data()) != mapVecInt_t  .end()) {mapVecInt_t  [bn.Data()] = val; mapIsBranchSet[bn.Data()] = true;} else { if (!ignore) error(TString::Format("branch doesn't exist bn = %s", bn.Data()));} }
-template <> void TTreeX::setBranch<std::vector<UInt_t >>(TString bn, std::vector<UInt_t > val, bool force, bool ignore) { if (force) { mapVecUInt_t [bn.Data()] = val; mapIsBranchSet[bn.Data()] = true; return; } if (mapVecUInt_t .find(bn.Data()) != mapVecUInt_t .end()) {mapVecUInt_t [bn.Data()] = val; mapIsBranchSet[bn.Data()] = true;} else { if (!ignore) error(TString::Format("branch doesn't exist bn = %s", bn.Data()));} }
-template <> void TTreeX::setBranch<std::vector<Bool_t >>(TString bn, std::vector<Bool_t > val, bool force, bool ignore) { if (force) { mapVecBool_t [bn.Data()] = val; mapIsBranchSet[bn.Data()] = true; return; } if (mapVecBool_t .find(bn.Data()) != mapVecBool_t .end()) {mapVecBool_t [bn.Data()] = val; mapIsBranchSet[bn.Data()] = true;} else { if (!ignore) error(TString::Format("branch doesn't exist bn = %s", bn.Data()));} }
-template <> void TTreeX::setBranch<std::vector<Float_t>>(TString bn, std::vector<Float_t> val, bool force, bool ignore) { if (force) { mapVecFloat_t[bn.Data()] = val; mapIsBranchSet[bn.Data()] = true; return; } if (mapVecFloat_t.find(bn.Data()) != mapVecFloat_t.end()) {mapVecFloat_t[bn.Data()] = val; mapIsBranchSet[bn.Data()] = true;} else { if (!ignore) error(TString::Format("branch doesn't exist bn = %s", bn.Data()));} }
-template <> void TTreeX::setBranch<std::vector<TString>>(TString bn, std::vector<TString> val, bool force, bool ignore) { if (force) { mapVecTString[bn.Data()] = val; mapIsBranchSet[bn.Data()] = true; return; } if (mapVecTString.find(bn.Data()) != mapVecTString.end()) {mapVecTString[bn.Data()] = val; mapIsBranchSet[bn.Data()] = true;} else { if (!ignore) error(TString::Format("branch doesn't exist bn = %s", bn.Data()));} }
-template <> void TTreeX::setBranch<std::vector<LV     >>(TString bn, std::vector<LV     > val, bool force, bool ignore) { if (force) { mapVecLV     [bn.Data()] = val; mapIsBranchSet[bn.Data()] = true; return; } if (mapVecLV     .find(bn.Data()) != mapVecLV     .end()) {mapVecLV     [bn.Data()] = val; mapIsBranchSet[bn.Data()] = true;} else { if (!ignore) error(TString::Format("branch doesn't exist bn = %s", bn.Data()));} }
-template <> void TTreeX::setBranch<std::vector<VInt   >>(TString bn, std::vector<VInt   > val, bool force, bool ignore) { if (force) { mapVecVInt   [bn.Data()] = val; mapIsBranchSet[bn.Data()] = true; return; } if (mapVecVInt   .find(bn.Data()) != mapVecVInt   .end()) {mapVecVInt   [bn.Data()] = val; mapIsBranchSet[bn.Data()] = true;} else { if (!ignore) error(TString::Format("branch doesn't exist bn = %s", bn.Data()));} }
-template <> void TTreeX::setBranch<std::vector<VFloat >>(TString bn, std::vector<VFloat > val, bool force, bool ignore) { if (force) { mapVecVFloat [bn.Data()] = val; mapIsBranchSet[bn.Data()] = true; return; } if (mapVecVFloat .find(bn.Data()) != mapVecVFloat .end()) {mapVecVFloat [bn.Data()] = val; mapIsBranchSet[bn.Data()] = true;} else { if (!ignore) error(TString::Format("branch doesn't exist bn = %s", bn.Data()));} }
-template <> void TTreeX::pushbackToBranch<Int_t        >(TString bn, Int_t       val) { if (mapVecInt_t  .find(bn.Data()) != mapVecInt_t  .end()) {mapVecInt_t  [bn.Data()].push_back(val); mapIsBranchSet[bn.Data()] = true;} else {error(TString::Format("branch doesn't exist bn = %s", bn.Data()));} }
-template <> void TTreeX::pushbackToBranch<UInt_t       >(TString bn, UInt_t      val) { if (mapVecUInt_t .find(bn.Data()) != mapVecUInt_t .end()) {mapVecUInt_t [bn.Data()].push_back(val); mapIsBranchSet[bn.Data()] = true;} else {error(TString::Format("branch doesn't exist bn = %s", bn.Data()));} }
-template <> void TTreeX::pushbackToBranch<Bool_t       >(TString bn, Bool_t      val) { if (mapVecBool_t .find(bn.Data()) != mapVecBool_t .end()) {mapVecBool_t [bn.Data()].push_back(val); mapIsBranchSet[bn.Data()] = true;} else {error(TString::Format("branch doesn't exist bn = %s", bn.Data()));} }
-template <> void TTreeX::pushbackToBranch<Float_t      >(TString bn, Float_t     val) { if (mapVecFloat_t.find(bn.Data()) != mapVecFloat_t.end()) {mapVecFloat_t[bn.Data()].push_back(val); mapIsBranchSet[bn.Data()] = true;} else {error(TString::Format("branch doesn't exist bn = %s", bn.Data()));} }
-template <> void TTreeX::pushbackToBranch<TString      >(TString bn, TString     val) { if (mapVecTString.find(bn.Data()) != mapVecTString.end()) {mapVecTString[bn.Data()].push_back(val); mapIsBranchSet[bn.Data()] = true;} else {error(TString::Format("branch doesn't exist bn = %s", bn.Data()));} }
-template <> void TTreeX::pushbackToBranch<LV           >(TString bn, LV          val) { if (mapVecLV     .find(bn.Data()) != mapVecLV     .end()) {mapVecLV     [bn.Data()].push_back(val); mapIsBranchSet[bn.Data()] = true;} else {error(TString::Format("branch doesn't exist bn = %s", bn.Data()));} }
-template <> void TTreeX::pushbackToBranch<VInt         >(TString bn, VInt        val) { if (mapVecVInt   .find(bn.Data()) != mapVecVInt   .end()) {mapVecVInt   [bn.Data()].push_back(val); mapIsBranchSet[bn.Data()] = true;} else {error(TString::Format("branch doesn't exist bn = %s", bn.Data()));} }
-template <> void TTreeX::pushbackToBranch<VFloat       >(TString bn, VFloat      val) { if (mapVecVFloat .find(bn.Data()) != mapVecVFloat .end()) {mapVecVFloat [bn.Data()].push_back(val); mapIsBranchSet[bn.Data()] = true;} else {error(TString::Format("branch doesn't exist bn = %s", bn.Data()));} }
+// Values a branch is reset to by clear()
+static void resetValue(Int_t& val) { val = -999; }
+static void resetValue(Bool_t& val) { val = 0; }
+static void resetValue(Float_t& val) { val = -999; }
+static void resetValue(TString& val) { val = ""; }
+static void resetValue(LV& val) { val.SetXYZT(0, 0, 0, 0); }
+static void resetValue(TBits& val) { val = 0; }
+static void resetValue(unsigned long long& val) { val = 0; }
+static void resetValue(unsigned int& val) { val = 0; }
+template <class T> static void resetValue(std::vector<T>& val) { val.clear(); }
+static void resetValue(std::function<float()>&) {}
+
+//_________________________________________________________________________________________________
+template <class T>
+void RooUtil::TTreeX::resetSlot(TTreeX& tx, unsigned int i)
+{
+    resetValue(tx.pool<T>().values[i]);
+}
+
+//_________________________________________________________________________________________________
+template <class T>
+int RooUtil::TTreeX::findSlot(TString bn)
+{
+    SlotPool<T>& p = pool<T>();
+    std::unordered_map<std::string, unsigned int>::const_iterator it = p.index.find(bn.Data());
+    return it == p.index.end() ? -1 : (int) it->second;
+}
+
+//_________________________________________________________________________________________________
+template <class T>
+unsigned int RooUtil::TTreeX::addSlot(TString bn)
+{
+    SlotPool<T>& p = pool<T>();
+    unsigned int i = p.values.size();
+    p.values.emplace_back();
+    p.slotids.push_back(isBranchSetFlags.size());
+    isBranchSetFlags.push_back(false);
+    slotresetters.push_back(&resetSlot<T>);
+    slotreaders.push_back(-1);
+    slotpositions.push_back(i);
+    slotnames.push_back(bn);
+    p.index[bn.Data()] = i;
+    resetSlot<T>(*this, i); // start from the same "unset" value that clear() restores
+    return i;
+}
+
+//_________________________________________________________________________________________________
+template <class T>
+int RooUtil::TTreeX::createSlot(TString bn, bool writeToTree)
+{
+    int i = findSlot<T>(bn);
+    if (i >= 0)
+    {
+        error(TString::Format("branch already exists bn = %s", bn.Data()));
+        return i;
+    }
+    i = addSlot<T>(bn);
+    if (writeToTree)
+        applyOutputSettings(ttree->Branch(bn, &(pool<T>().values[i])));
+    return i;
+}
+
+//_________________________________________________________________________________________________
+template <class T>
+void RooUtil::TTreeX::setSlot(TString bn, const T& val, bool force, bool ignore)
+{
+    int i = findSlot<T>(bn);
+    if (i < 0)
+    {
+        if (!force)
+        {
+            if (!ignore)
+                error(TString::Format("branch doesn't exist bn = %s", bn.Data()));
+            return;
+        }
+        i = addSlot<T>(bn);
+    }
+    SlotPool<T>& p = pool<T>();
+    p.values[i] = val;
+    markSet(p.slotids[i]);
+}
+
+//_________________________________________________________________________________________________
+template <class T>
+void RooUtil::TTreeX::pushbackSlot(TString bn, const typename T::value_type& val)
+{
+    int i = findSlot<T>(bn);
+    if (i < 0)
+    {
+        error(TString::Format("branch doesn't exist bn = %s", bn.Data()));
+        return;
+    }
+    SlotPool<T>& p = pool<T>();
+    p.values[i].push_back(val);
+    markSet(p.slotids[i]);
+}
+
+//_________________________________________________________________________________________________
+template <class T>
+const T& RooUtil::TTreeX::getSlot(TString bn, bool check)
+{
+    int i = findSlot<T>(bn);
+    if (i < 0 and isreadmode)
+        i = bindSlot<T>(bn);
+    if (check and (i < 0 or !isBranchSetFlags[pool<T>().slotids[i]]))
+        error(TString::Format("branch hasn't been set yet bn = %s", bn.Data()));
+    if (i < 0)
+        i = addSlot<T>(bn);
+    if (isreadmode)
+    {
+        int r = slotreaders[pool<T>().slotids[i]];
+        if (r >= 0)
+            readers[r].load();
+    }
+    return pool<T>().values[i];
+}
+
+//_________________________________________________________________________________________________
+template <class T>
+T& RooUtil::TTreeX::getSlotRef(TString bn)
+{
+    int i = findSlot<T>(bn);
+    if (i < 0)
+        i = addSlot<T>(bn);
+    return pool<T>().values[i];
+}
+
+//_________________________________________________________________________________________________
+// Basic types are read straight into the slot, objects (vectors, LV, TString, ...) through a pointer to it
+template <class T>
+static void bindAddress(TTree* t, TString bn, T* val, std::deque<T*>& ptrs, std::true_type) { t->SetBranchAddress(bn, val); }
+template <class T>
+static void bindAddress(TTree* t, TString bn, T* val, std::deque<T*>& ptrs, std::false_type) { ptrs.push_back(val); t->SetBranchAddress(bn, &(ptrs.back())); }
+static void bindAddress(TTree*, TString, std::function<float()>*, std::deque<std::function<float()>*>&, std::false_type) {}
+
+//_________________________________________________________________________________________________
+template <class T>
+int RooUtil::TTreeX::bindSlot(TString bn)
+{
+    // Reader mode: binds the input branch bn to a new slot, or returns -1 if the input tree has no such branch
+    TBranch* br = ttree->GetBranch(bn);
+    if (!br)
+        return -1;
+    unsigned int i = addSlot<T>(bn);
+    SlotPool<T>& p = pool<T>();
+    ttree->SetBranchStatus(bn, 1);
+    ttree->SetBranchStatus(bn + ".*", 1); // sub-branches of split objects
+    bindAddress(ttree, bn, &(p.values[i]), p.readptrs, std::integral_constant<bool, std::is_arithmetic<T>::value>());
+    readers.push_back(BranchReader());
+    BranchReader& reader = readers.back();
+    reader.name = bn;
+    reader.branch = br;
+    reader.loadedentry = -1;
+    reader.entry = &readentry;
+    reader.localentry = &readlocalentry;
+    slotreaders[p.slotids[i]] = readers.size() - 1;
+    isBranchSetFlags[p.slotids[i]] = true; // input values are always "set"; not added to the dirty list so clear() leaves them alone
+    return i;
+}
+
+//_________________________________________________________________________________________________
+template <class T>
+T* RooUtil::TTreeX::getSlotAddress(TString bn)
+{
+    // Writes through the returned address bypass the set flags, so the slot is reset on every clear()
+    T* val = &getSlotRef<T>(bn);
+    unsigned int slotid = pool<T>().slotids[findSlot<T>(bn)];
+    if (std::find(alwaysclearslots.begin(), alwaysclearslots.end(), slotid) == alwaysclearslots.end())
+        alwaysclearslots.push_back(slotid);
+    return val;
+}
+
+//_________________________________________________________________________________________________
+template <> TTreeX::SlotPool<Int_t               >& TTreeX::pool<Int_t               >() { return poolInt_t     ; }
+template <> TTreeX::SlotPool<Bool_t              >& TTreeX::pool<Bool_t              >() { return poolBool_t    ; }
+template <> TTreeX::SlotPool<Float_t             >& TTreeX::pool<Float_t             >() { return poolFloat_t   ; }
+template <> TTreeX::SlotPool<TString             >& TTreeX::pool<TString             >() { return poolTString   ; }
+template <> TTreeX::SlotPool<LV                  >& TTreeX::pool<LV                  >() { return poolLV        ; }
+template <> TTreeX::SlotPool<TBits               >& TTreeX::pool<TBits               >() { return poolTBits     ; }
+template <> TTreeX::SlotPool<unsigned long long  >& TTreeX::pool<unsigned long long  >() { return poolULL       ; }
+template <> TTreeX::SlotPool<unsigned int        >& TTreeX::pool<unsigned int        >() { return poolUI        ; }
+template <> TTreeX::SlotPool<std::vector<Int_t  >>& TTreeX::pool<std::vector<Int_t  >>() { return poolVecInt_t  ; }
+template <> TTreeX::SlotPool<std::vector<UInt_t >>& TTreeX::pool<std::vector<UInt_t >>() { return poolVecUInt_t ; }
+template <> TTreeX::SlotPool<std::vector<Bool_t >>& TTreeX::pool<std::vector<Bool_t >>() { return poolVecBool_t ; }
+template <> TTreeX::SlotPool<std::vector<Float_t>>& TTreeX::pool<std::vector<Float_t>>() { return poolVecFloat_t; }
+template <> TTreeX::SlotPool<std::vector<TString>>& TTreeX::pool<std::vector<TString>>() { return poolVecTString; }
+template <> TTreeX::SlotPool<std::vector<LV     >>& TTreeX::pool<std::vector<LV     >>() { return poolVecLV     ; }
+template <> TTreeX::SlotPool<std::vector<VInt   >>& TTreeX::pool<std::vector<VInt   >>() { return poolVecVInt   ; }
+template <> TTreeX::SlotPool<std::vector<VFloat >>& TTreeX::pool<std::vector<VFloat >>() { return poolVecVFloat ; }
 // functors
-template <> void TTreeX::setBranch<std::function<float()>>(TString bn, std::function<float()> val, bool force, bool ignore) { if (force) { mapFloatFunc_t[bn.Data()] = val; mapIsBranchSet[bn.Data()] = true; return; } if (mapFloatFunc_t.find(bn.Data()) != mapFloatFunc_t.end()) {mapFloatFunc_t[bn.Data()] = val; mapIsBranchSet[bn.Data()] = true;} else { if (!ignore) error(TString::Format("branch doesn't exist bn = %s", bn.Data()));} }
-
-//_________________________________________________________________________________________________
-template <> const Int_t               & TTreeX::getBranch<Int_t               >(TString bn, bool check) { if (check) if (!mapIsBranchSet[bn.Data()]) error(TString::Format("branch hasn't been set yet bn = %s", bn.Data())); return mapInt_t     [bn.Data()]; }
-template <> const Bool_t              & TTreeX::getBranch<Bool_t              >(TString bn, bool check) { if (check) if (!mapIsBranchSet[bn.Data()]) error(TString::Format("branch hasn't been set yet bn = %s", bn.Data())); return mapBool_t    [bn.Data()]; }
-template <> const Float_t             & TTreeX::getBranch<Float_t             >(TString bn, bool check) { if (check) if (!mapIsBranchSet[bn.Data()]) error(TString::Format("branch hasn't been set yet bn = %s", bn.Data())); return mapFloat_t   [bn.Data()]; }
-template <> const TString             & TTreeX::getBranch<TString             >(TString bn, bool check) { if (check) if (!mapIsBranchSet[bn.Data()]) error(TString::Format("branch hasn't been set yet bn = %s", bn.Data())); return mapTString   [bn.Data()]; }
-template <> const LV                  & TTreeX::getBranch<LV                  >(TString bn, bool check) { if (check) if (!mapIsBranchSet[bn.Data()]) error(TString::Format("branch hasn't been set yet bn = %s", bn.Data())); return mapLV        [bn.Data()]; }
-template <> const TBits               & TTreeX::getBranch<TBits               >(TString bn, bool check) { if (check) if (!mapIsBranchSet[bn.Data()]) error(TString::Format("branch hasn't been set yet bn = %s", bn.Data())); return mapTBits     [bn.Data()]; }
-template <> const unsigned long long  & TTreeX::getBranch<unsigned long long  >(TString bn, bool check) { if (check) if (!mapIsBranchSet[bn.Data()]) error(TString::Format("branch hasn't been set yet bn = %s", bn.Data())); return mapULL       [bn.Data()]; }
-template <> const unsigned int        & TTreeX::getBranch<unsigned int        >(TString bn, bool check) { if (check) if (!mapIsBranchSet[bn.Data()]) error(TString::Format("branch hasn't been set yet bn = %s", bn.Data())); return mapUI        [bn.Data()]; }
-template <> const std::vector<Int_t  >& TTreeX::getBranch<std::vector<Int_t  >>(TString bn, bool check) { if (check) if (!mapIsBranchSet[bn.Data()]) error(TString::Format("branch hasn't been set yet bn = %s", bn.Data())); return mapVecInt_t  [bn.Data()]; }
-template <> const std::vector<UInt_t >& TTreeX::getBranch<std::vector<UInt_t >>(TString bn, bool check) { if (check) if (!mapIsBranchSet[bn.Data()]) error(TString::Format("branch hasn't been set yet bn = %s", bn.Data())); return mapVecUInt_t [bn.Data()]; }
-template <> const std::vector<Bool_t >& TTreeX::getBranch<std::vector<Bool_t >>(TString bn, bool check) { if (check) if (!mapIsBranchSet[bn.Data()]) error(TString::Format("branch hasn't been set yet bn = %s", bn.Data())); return mapVecBool_t [bn.Data()]; }
-template <> const std::vector<Float_t>& TTreeX::getBranch<std::vector<Float_t>>(TString bn, bool check) { if (check) if (!mapIsBranchSet[bn.Data()]) error(TString::Format("branch hasn't been set yet bn = %s", bn.Data())); return mapVecFloat_t[bn.Data()]; }
-template <> const std::vector<TString>& TTreeX::getBranch<std::vector<TString>>(TString bn, bool check) { if (check) if (!mapIsBranchSet[bn.Data()]) error(TString::Format("branch hasn't been set yet bn = %s", bn.Data())); return mapVecTString[bn.Data()]; }
-template <> const std::vector<LV     >& TTreeX::getBranch<std::vector<LV     >>(TString bn, bool check) { if (check) if (!mapIsBranchSet[bn.Data()]) error(TString::Format("branch hasn't been set yet bn = %s", bn.Data())); return mapVecLV     [bn.Data()]; }
-template <> const std::vector<VInt   >& TTreeX::getBranch<std::vector<VInt   >>(TString bn, bool check) { if (check) if (!mapIsBranchSet[bn.Data()]) error(TString::Format("branch hasn't been set yet bn = %s", bn.Data())); return mapVecVInt   [bn.Data()]; }
-template <> const std::vector<VFloat >& TTreeX::getBranch<std::vector<VFloat >>(TString bn, bool check) { if (check) if (!mapIsBranchSet[bn.Data()]) error(TString::Format("branch hasn't been set yet bn = %s", bn.Data())); return mapVecVFloat [bn.Data()]; }
+template <> TTreeX::SlotPool<std::function<float()>>& TTreeX::pool<std::function<float()>>() { return poolFloatFunc_t; }
+
+//_________________________________________________________________________________________________
+template <> void TTreeX::setBranch<Int_t               >(TString bn, Int_t                val, bool force, bool ignore) { setSlot<Int_t               >(bn, val, force, ignore); }
+template <> void TTreeX::setBranch<Bool_t              >(TString bn, Bool_t               val, bool force, bool ignore) { setSlot<Bool_t              >(bn, val, force, ignore); }
+template <> void TTreeX::setBranch<Float_t             >(TString bn, Float_t              val, bool force, bool ignore) { setSlot<Float_t             >(bn, val, force, ignore); }
+template <> void TTreeX::setBranch<TString             >(TString bn, TString              val, bool force, bool ignore) { setSlot<TString             >(bn, val, force, ignore); }
+template <> void TTreeX::setBranch<LV                  >(TString bn, LV                   val, bool force, bool ignore) { setSlot<LV                  >(bn, val, force, ignore); }
+template <> void TTreeX::setBranch<TBits               >(TString bn, TBits                val, bool force, bool ignore) { setSlot<TBits               >(bn, val, force, ignore); }
+template <> void TTreeX::setBranch<unsigned long long  >(TString bn, unsigned long long   val, bool force, bool ignore) { setSlot<unsigned long long  >(bn, val, force, ignore); }
+template <> void TTreeX::setBranch<unsigned int        >(TString bn, unsigned int         val, bool force, bool ignore) { setSlot<unsigned int        >(bn, val, force, ignore); }
+template <> void TTreeX::setBranch<std::vector<Int_t  >>(TString bn, std::vector<Int_t  > val, bool force, bool ignore) { setSlot<std::vector<Int_t  >>(bn, val, force, ignore); }
+template <> void TTreeX::setBranch<std::vector<UInt_t >>(TString bn, std::vector<UInt_t > val, bool force, bool ignore) { setSlot<std::vector<UInt_t >>(bn, val, force, ignore); }
+template <> void TTreeX::setBranch<std::vector<Bool_t >>(TString bn, std::vector<Bool_t > val, bool force, bool ignore) { setSlot<std::vector<Bool_t >>(bn, val, force, ignore); }
+template <> void TTreeX::setBranch<std::vector<Float_t>>(TString bn, std::vector<Float_t> val, bool force, bool ignore) { setSlot<std::vector<Float_t>>(bn, val, force, ignore); }
+template <> void TTreeX::setBranch<std::vector<TString>>(TString bn, std::vector<TString> val, bool force, bool ignore) { setSlot<std::vector<TString>>(bn, val, force, ignore); }
+template <> void TTreeX::setBranch<std::vector<LV     >>(TString bn, std::vector<LV     > val, bool force, bool ignore) { setSlot<std::vector<LV     >>(bn, val, force, ignore); }
+template <> void TTreeX::setBranch<std::vector<VInt   >>(TString bn, std::vector<VInt   > val, bool force, bool ignore) { setSlot<std::vector<VInt   >>(bn, val, force, ignore); }
+template <> void TTreeX::setBranch<std::vector<VFloat >>(TString bn, std::vector<VFloat > val, bool force, bool ignore) { setSlot<std::vector<VFloat >>(bn, val, force, ignore); }
+template <> void TTreeX::pushbackToBranch<Int_t        >(TString bn, Int_t        val) { pushbackSlot<std::vector<Int_t  >>(bn, val); }
+template <> void TTreeX::pushbackToBranch<UInt_t       >(TString bn, UInt_t       val) { pushbackSlot<std::vector<UInt_t >>(bn, val); }
+template <> void TTreeX::pushbackToBranch<Bool_t       >(TString bn, Bool_t       val) { pushbackSlot<std::vector<Bool_t >>(bn, val); }
+template <> void TTreeX::pushbackToBranch<Float_t      >(TString bn, Float_t      val) { pushbackSlot<std::vector<Float_t>>(bn, val); }
+template <> void TTreeX::pushbackToBranch<TString      >(TString bn, TString      val) { pushbackSlot<std::vector<TString>>(bn, val); }
+template <> void TTreeX::pushbackToBranch<LV           >(TString bn, LV           val) { pushbackSlot<std::vector<LV     >>(bn, val); }
+template <> void TTreeX::pushbackToBranch<VInt         >(TString bn, VInt         val) { pushbackSlot<std::vector<VInt   >>(bn, val); }
+template <> void TTreeX::pushbackToBranch<VFloat       >(TString bn, VFloat       val) { pushbackSlot<std::vector<VFloat >>(bn, val); }
 // functors
-template <> const std::function<float()>& TTreeX::getBranch<std::function<float()>>(TString bn, bool check) { if (check) if (!mapIsBranchSet[bn.Data()]) error(TString::Format("branch hasn't been set yet bn = %s", bn.Data())); return mapFloatFunc_t[bn.Data()]; }
+template <> void TTreeX::setBranch<std::function<float()>>(TString bn, std::function<float()> val, bool force, bool ignore) { setSlot<std::function<float()>>(bn, val, force, ignore); }
+
+//_________________________________________________________________________________________________
+template <> const Int_t               & TTreeX::getBranch<Int_t               >(TString bn, bool check) { return getSlot<Int_t               >(bn, check); }
+template <> const Bool_t              & TTreeX::getBranch<Bool_t              >(TString bn, bool check) { return getSlot<Bool_t              >(bn, check); }
+template <> const Float_t             & TTreeX::getBranch<Float_t             >(TString bn, bool check) { return getSlot<Float_t             >(bn, check); }
+template <> const TString             & TTreeX::getBranch<TString             >(TString bn, bool check) { return getSlot<TString             >(bn, check); }
+template <> const LV                  & TTreeX::getBranch<LV                  >(TString bn, bool check) { return getSlot<LV                  >(bn, check); }
+template <> const TBits               & TTreeX::getBranch<TBits               >(TString bn, bool check) { return getSlot<TBits               >(bn, check); }
+template <> const unsigned long long  & TTreeX::getBranch<unsigned long long  >(TString bn, bool check) { return getSlot<unsigned long long  >(bn, check); }
+template <> const unsigned int        & TTreeX::getBranch<unsigned int        >(TString bn, bool check) { return getSlot<unsigned int        >(bn, check); }
+template <> const std::vector<Int_t  >& TTreeX::getBranch<std::vector<Int_t  >>(TString bn, bool check) { return getSlot<std::vector<Int_t  >>(bn, check); }
+template <> const std::vector<UInt_t >& TTreeX::getBranch<std::vector<UInt_t >>(TString bn, bool check) { return getSlot<std::vector<UInt_t >>(bn, check); }
+template <> const std::vector<Bool_t >& TTreeX::getBranch<std::vector<Bool_t >>(TString bn, bool check) { return getSlot<std::vector<Bool_t >>(bn, check); }
+template <> const std::vector<Float_t>& TTreeX::getBranch<std::vector<Float_t>>(TString bn, bool check) { return getSlot<std::vector<Float_t>>(bn, check); }
+template <> const std::vector<TString>& TTreeX::getBranch<std::vector<TString>>(TString bn, bool check) { return getSlot<std::vector<TString>>(bn, check); }
+template <> const std::vector<LV     >& TTreeX::getBranch<std::vector<LV     >>(TString bn, bool check) { return getSlot<std::vector<LV     >>(bn, check); }
+template <> const std::vector<VInt   >& TTreeX::getBranch<std::vector<VInt   >>(TString bn, bool check) { return getSlot<std::vector<VInt   >>(bn, check); }
+template <> const std::vector<VFloat >& TTreeX::getBranch<std::vector<VFloat >>(TString bn, bool check) { return getSlot<std::vector<VFloat >>(bn, check); }
+// functors
+template <> const std::function<float()>& TTreeX::getBranch<std::function<float()>>(TString bn, bool check) { return getSlot<std::function<float()>>(bn, check); }
 
 //_________________________________________________________________________________________________
 template <> const Int_t               & TTreeX::getBranchLazy<Int_t               >(TString bn) { return getBranch<Int_t               >(bn, false); }
@@ -232,69 +671,70 @@ template <> const std::vector<VFloat >& TTreeX::getBranchLazy<std::vector<VFloat
 template <> const std::function<float()>& TTreeX::getBranchLazy<std::function<float()>>(TString bn) { return getBranch<std::function<float()>>(bn, false); }
 
 //_________________________________________________________________________________________________
-template <> bool TTreeX::isBranchSet<Int_t               >(TString bn) { return mapIsBranchSet[bn.Data()]; }
-template <> bool TTreeX::isBranchSet<Bool_t              >(TString bn) { return mapIsBranchSet[bn.Data()]; }
-template <> bool TTreeX::isBranchSet<Float_t             >(TString bn) { return mapIsBranchSet[bn.Data()]; }
-template <> bool TTreeX::isBranchSet<TString             >(TString bn) { return mapIsBranchSet[bn.Data()]; }
-template <> bool TTreeX::isBranchSet<LV                  >(TString bn) { return mapIsBranchSet[bn.Data()]; }
-template <> bool TTreeX::isBranchSet<TBits               >(TString bn) { return mapIsBranchSet[bn.Data()]; }
-template <> bool TTreeX::isBranchSet<unsigned long long  >(TString bn) { return mapIsBranchSet[bn.Data()]; }
-template <> bool TTreeX::isBranchSet<unsigned int        >(TString bn) { return mapIsBranchSet[bn.Data()]; }
-template <> bool TTreeX::isBranchSet<std::vector<Int_t  >>(TString bn) { return mapIsBranchSet[bn.Data()]; }
-template <> bool TTreeX::isBranchSet<std::vector<UInt_t >>(TString bn) { return mapIsBranchSet[bn.Data()]; }
-template <> bool TTreeX::isBranchSet<std::vector<Bool_t >>(TString bn) { return mapIsBranchSet[bn.Data()]; }
-template <> bool TTreeX::isBranchSet<std::vector<Float_t>>(TString bn) { return mapIsBranchSet[bn.Data()]; }
-template <> bool TTreeX::isBranchSet<std::vector<TString>>(TString bn) { return mapIsBranchSet[bn.Data()]; }
-template <> bool TTreeX::isBranchSet<std::vector<LV     >>(TString bn) { return mapIsBranchSet[bn.Data()]; }
-template <> bool TTreeX::isBranchSet<std::vector<VInt   >>(TString bn) { return mapIsBranchSet[bn.Data()]; }
-template <> bool TTreeX::isBranchSet<std::vector<VFloat >>(TString bn) { return mapIsBranchSet[bn.Data()]; }
+template <> bool TTreeX::isBranchSet<Int_t               >(TString bn) { int i = findSlot<Int_t               >(bn); return i >= 0 and isBranchSetFlags[pool<Int_t               >().slotids[i]]; }
+template <> bool TTreeX::isBranchSet<Bool_t              >(TString bn) { int i = findSlot<Bool_t              >(bn); return i >= 0 and isBranchSetFlags[pool<Bool_t              >().slotids[i]]; }
+template <> bool TTreeX::isBranchSet<Float_t             >(TString bn) { int i = findSlot<Float_t             >(bn); return i >= 0 and isBranchSetFlags[pool<Float_t             >().slotids[i]]; }
+template <> bool TTreeX::isBranchSet<TString             >(TString bn) { int i = findSlot<TString             >(bn); return i >= 0 and isBranchSetFlags[pool<TString             >().slotids[i]]; }
+template <> bool TTreeX::isBranchSet<LV                  >(TString bn) { int i = findSlot<LV                  >(bn); return i >= 0 and isBranchSetFlags[pool<LV                  >().slotids[i]]; }
+template <> bool TTreeX::isBranchSet<TBits               >(TString bn) { int i = findSlot<TBits               >(bn); return i >= 0 and isBranchSetFlags[pool<TBits               >().slotids[i]]; }
+template <> bool TTreeX::isBranchSet<unsigned long long  >(TString bn) { int i = findSlot<unsigned long long  >(bn); return i >= 0 and isBranchSetFlags[pool<unsigned long long  >().slotids[i]]; }
+template <> bool TTreeX::isBranchSet<unsigned int        >(TString bn) { int i = findSlot<unsigned int        >(bn); return i >= 0 and isBranchSetFlags[pool<unsigned int        >().slotids[i]]; }
+template <> bool TTreeX::isBranchSet<std::vector<Int_t  >>(TString bn) { int i = findSlot<std::vector<Int_t  >>(bn); return i >= 0 and isBranchSetFlags[pool<std::vector<Int_t  >>().slotids[i]]; }
+template <> bool TTreeX::isBranchSet<std::vector<UInt_t >>(TString bn) { int i = findSlot<std::vector<UInt_t >>(bn); return i >= 0 and isBranchSetFlags[pool<std::vector<UInt_t >>().slotids[i]]; }
+template <> bool TTreeX::isBranchSet<std::vector<Bool_t >>(TString bn) { int i = findSlot<std::vector<Bool_t >>(bn); return i >= 0 and isBranchSetFlags[pool<std::vector<Bool_t >>().slotids[i]]; }
+template <> bool TTreeX::isBranchSet<std::vector<Float_t>>(TString bn) { int i = findSlot<std::vector<Float_t>>(bn); return i >= 0 and isBranchSetFlags[pool<std::vector<Float_t>>().slotids[i]]; }
+template <> bool TTreeX::isBranchSet<std::vector<TString>>(TString bn) { int i = findSlot<std::vector<TString>>(bn); return i >= 0 and isBranchSetFlags[pool<std::vector<TString>>().slotids[i]]; }
+template <> bool TTreeX::isBranchSet<std::vector<LV     >>(TString bn) { int i = findSlot<std::vector<LV     >>(bn); return i >= 0 and isBranchSetFlags[pool<std::vector<LV     >>().slotids[i]]; }
+template <> bool TTreeX::isBranchSet<std::vector<VInt   >>(TString bn) { int i = findSlot<std::vector<VInt   >>(bn); return i >= 0 and isBranchSetFlags[pool<std::vector<VInt   >>().slotids[i]]; }
+template <> bool TTreeX::isBranchSet<std::vector<VFloat >>(TString bn) { int i = findSlot<std::vector<VFloat >>(bn); return i >= 0 and isBranchSetFlags[pool<std::vector<VFloat >>().slotids[i]]; }
 // functors
-template <> bool TTreeX::isBranchSet<std::function<float()>>(TString bn) { return mapIsBranchSet[bn.Data()]; }
-
-//_________________________________________________________________________________________________
-template <> Int_t*   TTreeX::getBranchAddress<Int_t  >(TString bn) { return &mapInt_t  [bn.Data()]; }
-template <> Bool_t*  TTreeX::getBranchAddress<Bool_t >(TString bn) { return &mapBool_t [bn.Data()]; }
-template <> Float_t* TTreeX::getBranchAddress<Float_t>(TString bn) { return &mapFloat_t[bn.Data()]; }
-
-//_________________________________________________________________________________________________
-template <> void TTreeX::createBranch<Int_t               >(TString bn, bool writeToTree) { if (mapInt_t     .find(bn.Data()) == mapInt_t     .end()) { if (writeToTree) ttree->Branch(bn, &(mapInt_t      [bn.Data()])); else mapInt_t      [bn.Data()]; } else {error(TString::Format("branch already exists bn = %s", bn.Data()));} }
-template <> void TTreeX::createBranch<Bool_t              >(TString bn, bool writeToTree) { if (mapBool_t    .find(bn.Data()) == mapBool_t    .end()) { if (writeToTree) ttree->Branch(bn, &(mapBool_t     [bn.Data()])); else mapBool_t     [bn.Data()]; } else {error(TString::Format("branch already exists bn = %s", bn.Data()));} }
-template <> void TTreeX::createBranch<Float_t             >(TString bn, bool writeToTree) { if (mapFloat_t   .find(bn.Data()) == mapFloat_t   .end()) { if (writeToTree) ttree->Branch(bn, &(mapFloat_t    [bn.Data()])); else mapFloat_t    [bn.Data()]; } else {error(TString::Format("branch already exists bn = %s", bn.Data()));} }
-template <> void TTreeX::createBranch<TString             >(TString bn, bool writeToTree) { if (mapTString   .find(bn.Data()) == mapTString   .end()) { if (writeToTree) ttree->Branch(bn, &(mapTString    [bn.Data()])); else mapTString    [bn.Data()]; } else {error(TString::Format("branch already exists bn = %s", bn.Data()));} }
-template <> void TTreeX::createBranch<LV                  >(TString bn, bool writeToTree) { if (mapLV        .find(bn.Data()) == mapLV        .end()) { if (writeToTree) ttree->Branch(bn, &(mapLV         [bn.Data()])); else mapLV         [bn.Data()]; } else {error(TString::Format("branch already exists bn = %s", bn.Data()));} }
-template <> void TTreeX::createBranch<TBits               >(TString bn, bool writeToTree) { if (mapTBits     .find(bn.Data()) == mapTBits     .end()) { if (writeToTree) ttree->Branch(bn, &(mapTBits      [bn.Data()])); else mapTBits      [bn.Data()]; } else {error(TString::Format("branch already exists bn = %s", bn.Data()));} }
-template <> void TTreeX::createBranch<unsigned long long  >(TString bn, bool writeToTree) { if (mapULL       .find(bn.Data()) == mapULL       .end()) { if (writeToTree) ttree->Branch(bn, &(mapULL        [bn.Data()])); else mapULL        [bn.Data()]; } else {error(TString::Format("branch already exists bn = %s", bn.Data()));} }
-template <> void TTreeX::createBranch<unsigned int        >(TString bn, bool writeToTree) { if (mapUI        .find(bn.Data()) == mapUI        .end()) { if (writeToTree) ttree->Branch(bn, &(mapUI         [bn.Data()])); else mapUI         [bn.Data()]; } else {error(TString::Format("branch already exists bn = %s", bn.Data()));} }
-template <> void TTreeX::createBranch<std::vector<Int_t  >>(TString bn, bool writeToTree) { if (mapVecInt_t  .find(bn.Data()) == mapVecInt_t  .end()) { if (writeToTree) ttree->Branch(bn, &(mapVecInt_t   [bn.Data()])); else mapVecInt_t   [bn.Data()]; } else {error(TString::Format("branch already exists bn = %s", bn.Data()));} }
-template <> void TTreeX::createBranch<std::vector<UInt_t >>(TString bn, bool writeToTree) { if (mapVecUInt_t .find(bn.Data()) == mapVecUInt_t .end()) { if (writeToTree) ttree->Branch(bn, &(mapVecUInt_t  [bn.Data()])); else mapVecUInt_t  [bn.Data()]; } else {error(TString::Format("branch already exists bn = %s", bn.Data()));} }
-template <> void TTreeX::createBranch<std::vector<Bool_t >>(TString bn, bool writeToTree) { if (mapVecBool_t .find(bn.Data()) == mapVecBool_t .end()) { if (writeToTree) ttree->Branch(bn, &(mapVecBool_t  [bn.Data()])); else mapVecBool_t  [bn.Data()]; } else {error(TString::Format("branch already exists bn = %s", bn.Data()));} }
-template <> void TTreeX::createBranch<std::vector<Float_t>>(TString bn, bool writeToTree) { if (mapVecFloat_t.find(bn.Data()) == mapVecFloat_t.end()) { if (writeToTree) ttree->Branch(bn, &(mapVecFloat_t [bn.Data()])); else mapVecFloat_t [bn.Data()]; } else {error(TString::Format("branch already exists bn = %s", bn.Data()));} }
-template <> void TTreeX::createBranch<std::vector<TString>>(TString bn, bool writeToTree) { if (mapVecTString.find(bn.Data()) == mapVecTString.end()) { if (writeToTree) ttree->Branch(bn, &(mapVecTString [bn.Data()])); else mapVecTString [bn.Data()]; } else {error(TString::Format("branch already exists bn = %s", bn.Data()));} }
-template <> void TTreeX::createBranch<std::vector<LV     >>(TString bn, bool writeToTree) { if (mapVecLV     .find(bn.Data()) == mapVecLV     .end()) { if (writeToTree) ttree->Branch(bn, &(mapVecLV      [bn.Data()])); else mapVecLV      [bn.Data()]; } else {error(TString::Format("branch already exists bn = %s", bn.Data()));} }
-template <> void TTreeX::createBranch<std::vector<VInt   >>(TString bn, bool writeToTree) { if (mapVecVInt   .find(bn.Data()) == mapVecVInt   .end()) { if (writeToTree) ttree->Branch(bn, &(mapVecVInt    [bn.Data()])); else mapVecVInt    [bn.Data()]; } else {error(TString::Format("branch already exists bn = %s", bn.Data()));} }
-template <> void TTreeX::createBranch<std::vector<VFloat >>(TString bn, bool writeToTree) { if (mapVecVFloat .find(bn.Data()) == mapVecVFloat .end()) { if (writeToTree) ttree->Branch(bn, &(mapVecVFloat  [bn.Data()])); else mapVecVFloat  [bn.Data()]; } else {error(TString::Format("branch already exists bn = %s", bn.Data()));} }
+template <> bool TTreeX::isBranchSet<std::function<float()>>(TString bn) { int i = findSlot<std::function<float()>>(bn); return i >= 0 and isBranchSetFlags[pool<std::function<float()>>().slotids[i]]; }
+
+//_________________________________________________________________________________________________
+template <> Int_t*   TTreeX::getBranchAddress<Int_t  >(TString bn) { return getSlotAddress<Int_t  >(bn); }
+template <> Bool_t*  TTreeX::getBranchAddress<Bool_t >(TString bn) { return getSlotAddress<Bool_t >(bn); }
+template <> Float_t* TTreeX::getBranchAddress<Float_t>(TString bn) { return getSlotAddress<Float_t>(bn); }
+template <> unsigned long long* TTreeX::getBranchAddress<unsigned long long>(TString bn) { return getSlotAddress<unsigned long long>(bn); }
+
+//_________________________________________________________________________________________________
+template <> BranchHandle<Int_t               > TTreeX::createBranch<Int_t               >(TString bn, bool writeToTree) { return makeHandle<Int_t               >(bn, createSlot<Int_t               >(bn, writeToTree)); }
+template <> BranchHandle<Bool_t              > TTreeX::createBranch<Bool_t              >(TString bn, bool writeToTree) { return makeHandle<Bool_t              >(bn, createSlot<Bool_t              >(bn, writeToTree)); }
+template <> BranchHandle<Float_t             > TTreeX::createBranch<Float_t             >(TString bn, bool writeToTree) { return makeHandle<Float_t             >(bn, createSlot<Float_t             >(bn, writeToTree)); }
+template <> BranchHandle<TString             > TTreeX::createBranch<TString             >(TString bn, bool writeToTree) { return makeHandle<TString             >(bn, createSlot<TString             >(bn, writeToTree)); }
+template <> BranchHandle<LV                  > TTreeX::createBranch<LV                  >(TString bn, bool writeToTree) { return makeHandle<LV                  >(bn, createSlot<LV                  >(bn, writeToTree)); }
+template <> BranchHandle<TBits               > TTreeX::createBranch<TBits               >(TString bn, bool writeToTree) { return makeHandle<TBits               >(bn, createSlot<TBits               >(bn, writeToTree)); }
+template <> BranchHandle<unsigned long long  > TTreeX::createBranch<unsigned long long  >(TString bn, bool writeToTree) { return makeHandle<unsigned long long  >(bn, createSlot<unsigned long long  >(bn, writeToTree)); }
+template <> BranchHandle<unsigned int        > TTreeX::createBranch<unsigned int        >(TString bn, bool writeToTree) { return makeHandle<unsigned int        >(bn, createSlot<unsigned int        >(bn, writeToTree)); }
+template <> BranchHandle<std::vector<Int_t  >> TTreeX::createBranch<std::vector<Int_t  >>(TString bn, bool writeToTree) { return makeHandle<std::vector<Int_t  >>(bn, createSlot<std::vector<Int_t  >>(bn, writeToTree)); }
+template <> BranchHandle<std::vector<UInt_t >> TTreeX::createBranch<std::vector<UInt_t >>(TString bn, bool writeToTree) { return makeHandle<std::vector<UInt_t >>(bn, createSlot<std::vector<UInt_t >>(bn, writeToTree)); }
+template <> BranchHandle<std::vector<Bool_t >> TTreeX::createBranch<std::vector<Bool_t >>(TString bn, bool writeToTree) { return makeHandle<std::vector<Bool_t >>(bn, createSlot<std::vector<Bool_t >>(bn, writeToTree)); }
+template <> BranchHandle<std::vector<Float_t>> TTreeX::createBranch<std::vector<Float_t>>(TString bn, bool writeToTree) { return makeHandle<std::vector<Float_t>>(bn, createSlot<std::vector<Float_t>>(bn, writeToTree)); }
+template <> BranchHandle<std::vector<TString>> TTreeX::createBranch<std::vector<TString>>(TString bn, bool writeToTree) { return makeHandle<std::vector<TString>>(bn, createSlot<std::vector<TString>>(bn, writeToTree)); }
+template <> BranchHandle<std::vector<LV     >> TTreeX::createBranch<std::vector<LV     >>(TString bn, bool writeToTree) { return makeHandle<std::vector<LV     >>(bn, createSlot<std::vector<LV     >>(bn, writeToTree)); }
+template <> BranchHandle<std::vector<VInt   >> TTreeX::createBranch<std::vector<VInt   >>(TString bn, bool writeToTree) { return makeHandle<std::vector<VInt   >>(bn, createSlot<std::vector<VInt   >>(bn, writeToTree)); }
+template <> BranchHandle<std::vector<VFloat >> TTreeX::createBranch<std::vector<VFloat >>(TString bn, bool writeToTree) { return makeHandle<std::vector<VFloat >>(bn, createSlot<std::vector<VFloat >>(bn, writeToTree)); }
 // functors
-template <> void TTreeX::createBranch<std::function<float()>>(TString bn, bool writeToTree) { if (mapFloatFunc_t.find(bn.Data()) == mapFloatFunc_t.end()) mapFloatFunc_t[bn.Data()]; else error(TString::Format("branch already exists bn = %s", bn.Data()));}
-
-//_________________________________________________________________________________________________
-template <> bool TTreeX::hasBranch<Int_t               >(TString bn) { if (mapInt_t     .find(bn.Data()) == mapInt_t     .end()) return false; else return true;}
-template <> bool TTreeX::hasBranch<Bool_t              >(TString bn) { if (mapBool_t    .find(bn.Data()) == mapBool_t    .end()) return false; else return true;}
-template <> bool TTreeX::hasBranch<Float_t             >(TString bn) { if (mapFloat_t   .find(bn.Data()) == mapFloat_t   .end()) return false; else return true;}
-template <> bool TTreeX::hasBranch<TString             >(TString bn) { if (mapTString   .find(bn.Data()) == mapTString   .end()) return false; else return true;}
-template <> bool TTreeX::hasBranch<LV                  >(TString bn) { if (mapLV        .find(bn.Data()) == mapLV        .end()) return false; else return true;}
-template <> bool TTreeX::hasBranch<TBits               >(TString bn) { if (mapTBits     .find(bn.Data()) == mapTBits     .end()) return false; else return true;}
-template <> bool TTreeX::hasBranch<unsigned long long  >(TString bn) { if (mapULL       .find(bn.Data()) == mapULL       .end()) return false; else return true;}
-template <> bool TTreeX::hasBranch<unsigned int        >(TString bn) { if (mapUI        .find(bn.Data()) == mapUI        .end()) return false; else return true;}
-template <> bool TTreeX::hasBranch<std::vector<Int_t  >>(TString bn) { if (mapVecInt_t  .find(bn.Data()) == mapVecInt_t  .end()) return false; else return true;}
-template <> bool TTreeX::hasBranch<std::vector<UInt_t >>(TString bn) { if (mapVecUInt_t .find(bn.Data()) == mapVecUInt_t .end()) return false; else return true;}
-template <> bool TTreeX::hasBranch<std::vector<Bool_t >>(TString bn) { if (mapVecBool_t .find(bn.Data()) == mapVecBool_t .end()) return false; else return true;}
-template <> bool TTreeX::hasBranch<std::vector<Float_t>>(TString bn) { if (mapVecFloat_t.find(bn.Data()) == mapVecFloat_t.end()) return false; else return true;}
-template <> bool TTreeX::hasBranch<std::vector<TString>>(TString bn) { if (mapVecTString.find(bn.Data()) == mapVecTString.end()) return false; else return true;}
-template <> bool TTreeX::hasBranch<std::vector<LV     >>(TString bn) { if (mapVecLV     .find(bn.Data()) == mapVecLV     .end()) return false; else return true;}
-template <> bool TTreeX::hasBranch<std::vector<VInt   >>(TString bn) { if (mapVecVInt   .find(bn.Data()) == mapVecVInt   .end()) return false; else return true;}
-template <> bool TTreeX::hasBranch<std::vector<VFloat >>(TString bn) { if (mapVecVFloat .find(bn.Data()) == mapVecVFloat .end()) return false; else return true;}
+template <> BranchHandle<std::function<float()>> TTreeX::createBranch<std::function<float()>>(TString bn, bool writeToTree) { return makeHandle<std::function<float()>>(bn, createSlot<std::function<float()>>(bn, false)); }
+
+//_________________________________________________________________________________________________
+template <> bool TTreeX::hasBranch<Int_t               >(TString bn) { return findSlot<Int_t               >(bn) >= 0; }
+template <> bool TTreeX::hasBranch<Bool_t              >(TString bn) { return findSlot<Bool_t              >(bn) >= 0; }
+template <> bool TTreeX::hasBranch<Float_t             >(TString bn) { return findSlot<Float_t             >(bn) >= 0; }
+template <> bool TTreeX::hasBranch<TString             >(TString bn) { return findSlot<TString             >(bn) >= 0; }
+template <> bool TTreeX::hasBranch<LV                  >(TString bn) { return findSlot<LV                  >(bn) >= 0; }
+template <> bool TTreeX::hasBranch<TBits               >(TString bn) { return findSlot<TBits               >(bn) >= 0; }
+template <> bool TTreeX::hasBranch<unsigned long long  >(TString bn) { return findSlot<unsigned long long  >(bn) >= 0; }
+template <> bool TTreeX::hasBranch<unsigned int        >(TString bn) { return findSlot<unsigned int        >(bn) >= 0; }
+template <> bool TTreeX::hasBranch<std::vector<Int_t  >>(TString bn) { return findSlot<std::vector<Int_t  >>(bn) >= 0; }
+template <> bool TTreeX::hasBranch<std::vector<UInt_t >>(TString bn) { return findSlot<std::vector<UInt_t >>(bn) >= 0; }
+template <> bool TTreeX::hasBranch<std::vector<Bool_t >>(TString bn) { return findSlot<std::vector<Bool_t >>(bn) >= 0; }
+template <> bool TTreeX::hasBranch<std::vector<Float_t>>(TString bn) { return findSlot<std::vector<Float_t>>(bn) >= 0; }
+template <> bool TTreeX::hasBranch<std::vector<TString>>(TString bn) { return findSlot<std::vector<TString>>(bn) >= 0; }
+template <> bool TTreeX::hasBranch<std::vector<LV     >>(TString bn) { return findSlot<std::vector<LV     >>(bn) >= 0; }
+template <> bool TTreeX::hasBranch<std::vector<VInt   >>(TString bn) { return findSlot<std::vector<VInt   >>(bn) >= 0; }
+template <> bool TTreeX::hasBranch<std::vector<VFloat >>(TString bn) { return findSlot<std::vector<VFloat >>(bn) >= 0; }
 // functors
-template <> bool TTreeX::hasBranch<std::function<float()>>(TString bn) { if (mapFloatFunc_t.find(bn.Data()) == mapFloatFunc_t.end()) return false; else return true;}
+template <> bool TTreeX::hasBranch<std::function<float()>>(TString bn) { return findSlot<std::function<float()>>(bn) >= 0; }
 
 //_________________________________________________________________________________________________
 template <> void TTreeX::setBranch<std::map<TTREEXSTRING, std::vector<Int_t>>>(std::map<TTREEXSTRING, std::vector<Int_t>>& objidx)
@@ -314,4 +754,92 @@ template <> void TTreeX::createBranch<std::map<TTREEXSTRING, std::vector<Int_t>>
     }
 }
 
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//
+//
+// Object collection
+//
+//
+///////////////////////////////////////////////////////////////////////////////////////////////////
+
+//_________________________________________________________________________________________________
+int RooUtil::ObjectCollection::getFloatFieldIndex(TString field) const
+{
+    for (unsigned int i = 0; i < floatfieldnames.size(); ++i)
+        if (floatfieldnames[i] == field)
+            return i;
+    return -1;
+}
+
+//_________________________________________________________________________________________________
+int RooUtil::ObjectCollection::getIntFieldIndex(TString field) const
+{
+    for (unsigned int i = 0; i < intfieldnames.size(); ++i)
+        if (intfieldnames[i] == field)
+            return i;
+    return -1;
+}
+
+//_________________________________________________________________________________________________
+void RooUtil::ObjectCollection::pushback(std::initializer_list<Float_t> floatvals, std::initializer_list<Int_t> intvals)
+{
+    if (floatvals.size() != floatfields.size() or intvals.size() != intfields.size())
+    {
+        error(TString::Format("collection %s has %zu float and %zu int fields but %zu and %zu values were given",
+                    name.Data(), floatfields.size(), intfields.size(), floatvals.size(), intvals.size()), __FUNCTION__);
+        return;
+    }
+    std::initializer_list<Float_t>::const_iterator fit = floatvals.begin();
+    for (auto& field : floatfields)
+        field.pushback(*(fit++));
+    std::initializer_list<Int_t>::const_iterator iit = intvals.begin();
+    for (auto& field : intfields)
+        field.pushback(*(iit++));
+}
+
+//_________________________________________________________________________________________________
+void RooUtil::ObjectCollection::sortBy(unsigned int ifield, bool descending)
+{
+    // Same approach as TTreeX::sortVecBranchesByPt: one index permutation applied in place to every field
+    const std::vector<Float_t>& key = floatfields[ifield].get();
+    const size_t n = key.size();
+
+    bool sorted = true;
+    for (size_t i = 1; i < n and sorted; ++i)
+        sorted = descending ? key[i] <= key[i - 1] : key[i] >= key[i - 1];
+    if (sorted)
+        return;
+
+    perm.resize(n);
+    scratch.resize(n);
+    for (size_t i = 0; i < n; ++i)
+        perm[i] = i;
+    if (descending)
+        std::sort(perm.begin(), perm.end(), [&key](unsigned int a, unsigned int b) { return key[a] > key[b] or (key[a] == key[b] and a < b); });
+    else
+        std::sort(perm.begin(), perm.end(), [&key](unsigned int a, unsigned int b) { return key[a] < key[b] or (key[a] == key[b] and a < b); });
+
+    for (auto& field : floatfields) permuteInPlace(field.ref(), perm, scratch);
+    for (auto& field : intfields) permuteInPlace(field.ref(), perm, scratch);
+}
+
+//_________________________________________________________________________________________________
+void RooUtil::ObjectCollection::sortBy(TString field, bool descending)
+{
+    int ifield = getFloatFieldIndex(field);
+    if (ifield < 0)
+    {
+        error(TString::Format("collection %s has no float field %s to sort by", name.Data(), field.Data()), __FUNCTION__);
+        return;
+    }
+    sortBy(ifield, descending);
+}
+
+//_________________________________________________________________________________________________
+void RooUtil::ObjectCollection::clear()
+{
+    for (auto& field : floatfields) field.ref().clear();
+    for (auto& field : intfields) field.ref().clear();
+}
+
 //eof
@@ -16,6 +16,11 @@
 #include <functional>
 #include <cmath>
 #include <utility>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <unordered_set>
 
 // ROOT
 #include "TBenchmark.h"
@@ -61,6 +66,168 @@ typedef std::vector<Float_t> VFloat;
 namespace RooUtil
 {
 
+    ///////////////////////////////////////////////////////////////////////////////////////////////
+    // TTreeX branch reader
+    ///////////////////////////////////////////////////////////////////////////////////////////////
+    // In reader mode (TTreeX::setReadMode) each input branch requested by the analysis gets one of these.
+    // The branch is read only when its value is accessed for an entry that has not been read yet.
+    struct BranchReader
+    {
+        TString name;
+        TBranch* branch;
+        Long64_t loadedentry;
+        const Long64_t* entry; // current entry of the TTreeX
+        const Long64_t* localentry; // same entry within the current tree of a TChain
+        inline void load() { if (loadedentry != *entry) { branch->GetEntry(*localentry); loadedentry = *entry; } }
+    };
+
+    ///////////////////////////////////////////////////////////////////////////////////////////////
+    // TTreeX branch handle
+    ///////////////////////////////////////////////////////////////////////////////////////////////
+    // Returned by TTreeX::createBranch<T> (or TTreeX::getHandle<T>) and points straight at the slot
+    // holding the branch value, so that set/pushback/get in the event loop involve no name lookup.
+    // e.g.
+    //     RooUtil::BranchHandle<std::vector<LV>> h_p4 = ana.tx->createBranch<std::vector<LV>>("reco_leptons_p4");
+    //     ...
+    //     h_p4.pushback(lep.p4());
+    // In reader mode TTreeX::readBranch<T> returns the same handle, whose get() reads the branch on first access per entry.
+    // Unless compiled with -DNDEBUG, every access checks that the handle was initialized and that the TTreeX is still alive.
+    // The handle is only the value pointer, the slot id and the owner, so that copying it is as cheap as copying a pointer;
+    // the branch name and the liveness used by the checks are kept on the TTreeX side.
+    class TTreeX;
+    template <class T>
+    class BranchHandle
+    {
+        friend class TTreeX;
+
+        private:
+        T* val;
+        TTreeX* owner;
+        unsigned int slotid;
+
+        inline void markSet();
+        inline void check() const;
+
+        public:
+        BranchHandle() : val(0), owner(0), slotid(0) {}
+        bool valid() const { return val; }
+        void set(const T& v) { check(); *val = v; markSet(); }
+        template <class V>
+        void pushback(const V& v) { check(); val->push_back(v); markSet(); }
+        inline const T& get() const;
+        T& ref() { check(); markSet(); return *val; } // for filling the value in place, marks the branch as set
+        inline bool isSet() const;
+    };
+
+    //_________________________________________________________________________________________________
+    // Reorders vec in place so that vec[i] becomes vec[perm[i]], following each cycle of the permutation
+    // (visited is scratch space of the same size as perm)
+    template <class T>
+    void permuteInPlace(std::vector<T>& vec, const std::vector<unsigned int>& perm, std::vector<unsigned char>& visited)
+    {
+        const size_t n = perm.size();
+        std::fill(visited.begin(), visited.end(), 0);
+        for (size_t i = 0; i < n; ++i)
+        {
+            if (visited[i] or perm[i] == i)
+                continue;
+            T tmp = vec[i];
+            size_t j = i;
+            while (perm[j] != i)
+            {
+                vec[j] = vec[perm[j]];
+                visited[j] = 1;
+                j = perm[j];
+            }
+            vec[j] = tmp;
+            visited[j] = 1;
+        }
+    }
+
+    ///////////////////////////////////////////////////////////////////////////////////////////////
+    // Object collection
+    ///////////////////////////////////////////////////////////////////////////////////////////////
+    // Created by TTreeX::createCollection(name, float fields, int fields) and stored as structure of arrays:
+    // every field is a std::vector<float> or std::vector<int> branch named <name>_<field>, and all of them share one size.
+    // Objects are pushed back, filtered and sorted as a whole so that the fields can never go out of sync.
+    // e.g.
+    //     RooUtil::ObjectCollection& leps = ana.tx->createCollection("reco_leptons", {"pt", "eta", "phi", "mass"}, {"pdgId", "tightid"});
+    //     ...
+    //     leps.pushback({pt, eta, phi, mass}, {pdgId, tightid});
+    //     ...
+    //     leps.filter([&](unsigned int i) { return leps.getInt(1, i); });
+    //     leps.sortBy("pt");
+    class ObjectCollection
+    {
+        friend class TTreeX;
+
+        private:
+        TString name;
+        std::vector<TString> floatfieldnames;
+        std::vector<TString> intfieldnames;
+        std::vector<BranchHandle<std::vector<Float_t>>> floatfields;
+        std::vector<BranchHandle<std::vector<Int_t>>> intfields;
+
+        // scratch space reused by filter() and sortBy()
+        std::vector<unsigned int> perm;
+        std::vector<unsigned char> scratch;
+
+        template <class T>
+        static void compact(std::vector<T>&, const std::vector<unsigned char>&);
+
+        public:
+        ObjectCollection(TString n) : name(n) {}
+        const TString& getName() const { return name; }
+        size_t size() const { return floatfields.size() > 0 ? floatfields[0].get().size() : intfields[0].get().size(); }
+        int getFloatFieldIndex(TString) const;
+        int getIntFieldIndex(TString) const;
+        std::vector<Float_t>& getFloatField(unsigned int ifield) { return floatfields[ifield].ref(); }
+        std::vector<Int_t>& getIntField(unsigned int ifield) { return intfields[ifield].ref(); }
+        Float_t getFloat(unsigned int ifield, unsigned int iobj) const { return floatfields[ifield].get()[iobj]; }
+        Int_t getInt(unsigned int ifield, unsigned int iobj) const { return intfields[ifield].get()[iobj]; }
+        void pushback(std::initializer_list<Float_t>, std::initializer_list<Int_t> = {});
+        template <class F>
+        void filter(F keep);
+        void sortBy(unsigned int ifield, bool descending=true);
+        void sortBy(TString field, bool descending=true);
+        void clear();
+    };
+
+    //_________________________________________________________________________________________________
+    template <class T>
+    void ObjectCollection::compact(std::vector<T>& vec, const std::vector<unsigned char>& keep)
+    {
+        size_t j = 0;
+        for (size_t i = 0; i < vec.size(); ++i)
+        {
+            if (!keep[i])
+                continue;
+            if (i != j)
+                vec[j] = vec[i];
+            ++j;
+        }
+        vec.resize(j);
+    }
+
+    //_________________________________________________________________________________________________
+    // keep(i) is evaluated once per object and every field is then compacted in place
+    template <class F>
+    void ObjectCollection::filter(F keep)
+    {
+        const size_t n = size();
+        scratch.resize(n);
+        bool keepall = true;
+        for (size_t i = 0; i < n; ++i)
+        {
+            scratch[i] = keep(i) ? 1 : 0;
+            keepall = keepall and scratch[i];
+        }
+        if (keepall)
+            return;
+        for (auto& field : floatfields) compact(field.ref(), scratch);
+        for (auto& field : intfields) compact(field.ref(), scratch);
+    }
+
     ///////////////////////////////////////////////////////////////////////////////////////////////
     // TTreeX class
     ///////////////////////////////////////////////////////////////////////////////////////////////
@@ -89,29 +256,112 @@ namespace RooUtil
             kVecLV      = 16
         };
         typedef std::vector<LV>::const_iterator lviter;
+        enum kOutputProfile
+        {
+            kDefaultOutput  = 0, // ROOT defaults
+            kFastOutput     = 1, // intermediate babies read back soon: LZ4, large baskets and clusters
+            kCompactOutput  = 2, // ZSTD, good balance of size and read speed
+            kArchivalOutput = 3  // LZMA, smallest files but slowest to write and read
+        };
 
         private:
         TTree* ttree;
-        std::map<TTREEXSTRING, Int_t  > mapInt_t;
-        std::map<TTREEXSTRING, Bool_t > mapBool_t;
-        std::map<TTREEXSTRING, Float_t> mapFloat_t;
-        std::map<TTREEXSTRING, TString> mapTString;
-        std::map<TTREEXSTRING, LV     > mapLV;
-        std::map<TTREEXSTRING, TBits  > mapTBits;
-        std::map<TTREEXSTRING, unsigned long long> mapULL;
-        std::map<TTREEXSTRING, unsigned int> mapUI;
-        std::map<TTREEXSTRING, std::vector<Int_t  > > mapVecInt_t;
-        std::map<TTREEXSTRING, std::vector<UInt_t > > mapVecUInt_t;
-        std::map<TTREEXSTRING, std::vector<Bool_t > > mapVecBool_t;
-        std::map<TTREEXSTRING, std::vector<Float_t> > mapVecFloat_t;
-        std::map<TTREEXSTRING, std::vector<TString> > mapVecTString;
-        std::map<TTREEXSTRING, std::vector<LV     > > mapVecLV;
-        std::map<TTREEXSTRING, std::vector<std::vector<Int_t>  > > mapVecVInt;
-        std::map<TTREEXSTRING, std::vector<std::vector<Float_t>> > mapVecVFloat;
-
-        std::map<TTREEXSTRING, std::function<float()>> mapFloatFunc_t;
-
-        std::map<TTREEXSTRING, Bool_t > mapIsBranchSet;
+
+        // Each branch is resolved by name once to a slot: the position of its value in the array of its type.
+        // std::deque keeps the values of a type in contiguous blocks and, unlike std::vector, never moves them as branches are added
+        // (the addresses are handed to TTree::Branch).
+        template <class T>
+        struct SlotPool
+        {
+            std::deque<T> values;
+            std::unordered_map<std::string, unsigned int> index; // branch name -> position in values
+            std::vector<unsigned int> slotids; // position in values -> slot id (index in isBranchSetFlags)
+            std::deque<T*> readptrs; // reader mode: pointers handed to TTree::SetBranchAddress for object branches
+        };
+        SlotPool<Int_t  > poolInt_t;
+        SlotPool<Bool_t > poolBool_t;
+        SlotPool<Float_t> poolFloat_t;
+        SlotPool<TString> poolTString;
+        SlotPool<LV     > poolLV;
+        SlotPool<TBits  > poolTBits;
+        SlotPool<unsigned long long> poolULL;
+        SlotPool<unsigned int> poolUI;
+        SlotPool<std::vector<Int_t  > > poolVecInt_t;
+        SlotPool<std::vector<UInt_t > > poolVecUInt_t;
+        SlotPool<std::vector<Bool_t > > poolVecBool_t;
+        SlotPool<std::vector<Float_t> > poolVecFloat_t;
+        SlotPool<std::vector<TString> > poolVecTString;
+        SlotPool<std::vector<LV     > > poolVecLV;
+        SlotPool<std::vector<std::vector<Int_t>  > > poolVecVInt;
+        SlotPool<std::vector<std::vector<Float_t>> > poolVecVFloat;
+
+        SlotPool<std::function<float()>> poolFloatFunc_t;
+
+        std::deque<Bool_t> isBranchSetFlags; // by slot id
+
+        // clear() only resets the slots that were set since the last clear() (plus the ones whose address was handed out)
+        std::vector<void (*)(TTreeX&, unsigned int)> slotresetters; // by slot id
+        std::vector<unsigned int> slotpositions; // by slot id -> position in values
+        std::vector<unsigned int> dirtyslots;
+        std::vector<unsigned int> alwaysclearslots;
+        inline void markSet(unsigned int slotid) { if (!isBranchSetFlags[slotid]) { isBranchSetFlags[slotid] = true; dirtyslots.push_back(slotid); } }
+
+        // for the checks of the branch handles (see BranchHandle::check())
+        std::vector<TString> slotnames; // by slot id
+        static bool isAlive(const TTreeX*);
+        static TString getSlotName(const TTreeX*, unsigned int);
+        void registerInstance();
+        template <class T>
+        friend class BranchHandle;
+
+        // output I/O settings (negative or zero means ROOT default), applied to the tree and to every branch created afterwards
+        int compressionsettings; // 100 * algorithm + level
+        int basketsize;
+        Long64_t autoflush;
+        Long64_t autosave;
+        void applyOutputSettings(TBranch*);
+
+        // reader mode
+        bool isreadmode;
+        Long64_t readentry;
+        Long64_t readlocalentry;
+        int readtreenumber;
+        std::deque<BranchReader> readers;
+        std::vector<int> slotreaders; // by slot id -> index in readers (-1 if the slot is not read from the input tree)
+        inline void loadSlot(unsigned int slotid) { int r = slotreaders[slotid]; if (r >= 0) readers[r].load(); }
+        template <class T>
+        int bindSlot(TString);
+
+        // scratch space reused by sortVecBranchesByPt() so that sorting does not allocate per event
+        std::vector<unsigned int> sortperm;
+        std::vector<float> sortpt;
+        std::vector<unsigned char> sortvisited;
+
+        std::deque<ObjectCollection> collections;
+        std::unordered_map<std::string, unsigned int> collectionindex;
+
+        template <class T>
+        SlotPool<T>& pool();
+        template <class T>
+        static void resetSlot(TTreeX&, unsigned int);
+        template <class T>
+        int findSlot(TString);
+        template <class T>
+        unsigned int addSlot(TString);
+        template <class T>
+        int createSlot(TString, bool);
+        template <class T>
+        BranchHandle<T> makeHandle(TString, int);
+        template <class T>
+        void setSlot(TString, const T&, bool, bool);
+        template <class T>
+        void pushbackSlot(TString, const typename T::value_type&);
+        template <class T>
+        const T& getSlot(TString, bool);
+        template <class T>
+        T& getSlotRef(TString);
+        template <class T>
+        T* getSlotAddress(TString);
 
         public:
         TTreeX();
@@ -124,10 +374,25 @@ namespace RooUtil
         template <class T>
         T* get(TString brname, int entry=-1);
         void fill() { ttree->Fill(); }
+        void setOutputProfile(kOutputProfile);
+        void setCompressionSettings(int);
+        void setBasketSize(int);
+        void setAutoFlush(Long64_t);
+        void setAutoSave(Long64_t);
+        void optimizeBaskets(Long64_t maxmemory=10000000);
+
+        // Reader mode: all input branches are disabled and only the ones requested through getBranch<T>/readBranch<T>
+        // are bound (via SetBranchAddress into the typed slots) and read, lazily, once per entry set by loadEntry()
+        void setReadMode(bool=true);
+        Long64_t loadEntry(Long64_t);
+        template <class T>
+        BranchHandle<T> readBranch(TString);
         void write() { ttree->Write(); }
 
         template <class T>
-        void createBranch(TString, bool=true);
+        BranchHandle<T> createBranch(TString, bool=true);
+        template <class T>
+        BranchHandle<T> getHandle(TString);
         template <class T>
         void setBranch(TString, T, bool=false, bool=false);
         template <class T>
@@ -147,16 +412,13 @@ namespace RooUtil
         template <class T>
         void pushbackToBranch(TString, T);
 
+        ObjectCollection& createCollection(TString, std::vector<TString>, std::vector<TString> = {}, bool=true);
+        ObjectCollection& getCollection(TString);
+        bool hasCollection(TString);
+
         void sortVecBranchesByPt(TString, std::vector<TString>, std::vector<TString>, std::vector<TString>);
         template <class T>
-        std::vector<T> sortFromRef( std::vector<T> const& in, std::vector<std::pair<size_t, lviter> > const& reference);
-        struct ordering
-        {
-            bool operator ()(std::pair<size_t, lviter> const& a, std::pair<size_t, lviter> const& b) 
-            {
-                return (*(a.second)).pt() > (*(b.second)).pt();
-            }
-        };
+        void applySortPermutation(std::vector<T>&, TString);
         void createFlatBranch(std::vector<TString>, std::vector<TString>, std::vector<TString>, std::vector<TString>, int);
         void setFlatBranch(std::vector<TString>, std::vector<TString>, std::vector<TString>, std::vector<TString>, int);
 
@@ -164,6 +426,26 @@ namespace RooUtil
         void save(TFile*);
     };
 
+    //_________________________________________________________________________________________________
+    template <> TTreeX::SlotPool<Int_t               >& TTreeX::pool<Int_t               >();
+    template <> TTreeX::SlotPool<Bool_t              >& TTreeX::pool<Bool_t              >();
+    template <> TTreeX::SlotPool<Float_t             >& TTreeX::pool<Float_t             >();
+    template <> TTreeX::SlotPool<TString             >& TTreeX::pool<TString             >();
+    template <> TTreeX::SlotPool<LV                  >& TTreeX::pool<LV                  >();
+    template <> TTreeX::SlotPool<TBits               >& TTreeX::pool<TBits               >();
+    template <> TTreeX::SlotPool<unsigned long long  >& TTreeX::pool<unsigned long long  >();
+    template <> TTreeX::SlotPool<unsigned int        >& TTreeX::pool<unsigned int        >();
+    template <> TTreeX::SlotPool<std::vector<Int_t  >>& TTreeX::pool<std::vector<Int_t  >>();
+    template <> TTreeX::SlotPool<std::vector<UInt_t >>& TTreeX::pool<std::vector<UInt_t >>();
+    template <> TTreeX::SlotPool<std::vector<Bool_t >>& TTreeX::pool<std::vector<Bool_t >>();
+    template <> TTreeX::SlotPool<std::vector<Float_t>>& TTreeX::pool<std::vector<Float_t>>();
+    template <> TTreeX::SlotPool<std::vector<TString>>& TTreeX::pool<std::vector<TString>>();
+    template <> TTreeX::SlotPool<std::vector<LV     >>& TTreeX::pool<std::vector<LV     >>();
+    template <> TTreeX::SlotPool<std::vector<VInt   >>& TTreeX::pool<std::vector<VInt   >>();
+    template <> TTreeX::SlotPool<std::vector<VFloat >>& TTreeX::pool<std::vector<VFloat >>();
+    // functors
+    template <> TTreeX::SlotPool<std::function<float()>>& TTreeX::pool<std::function<float()>>();
+
     //_________________________________________________________________________________________________
     template <> void TTreeX::setBranch<Int_t               >(TString bn, Int_t                val, bool force, bool ignore);
     template <> void TTreeX::setBranch<Bool_t              >(TString bn, Bool_t               val, bool force, bool ignore);
@@ -256,26 +538,27 @@ namespace RooUtil
     template <> Int_t*   TTreeX::getBranchAddress<Int_t  >(TString bn);
     template <> Bool_t*  TTreeX::getBranchAddress<Bool_t >(TString bn);
     template <> Float_t* TTreeX::getBranchAddress<Float_t>(TString bn);
+    template <> unsigned long long* TTreeX::getBranchAddress<unsigned long long>(TString bn);
 
     //_________________________________________________________________________________________________
-    template <> void TTreeX::createBranch<Int_t               >(TString bn, bool writeToTree);
-    template <> void TTreeX::createBranch<Bool_t              >(TString bn, bool writeToTree);
-    template <> void TTreeX::createBranch<Float_t             >(TString bn, bool writeToTree);
-    template <> void TTreeX::createBranch<TString             >(TString bn, bool writeToTree);
-    template <> void TTreeX::createBranch<LV                  >(TString bn, bool writeToTree);
-    template <> void TTreeX::createBranch<TBits               >(TString bn, bool writeToTree);
-    template <> void TTreeX::createBranch<unsigned long long  >(TString bn, bool writeToTree);
-    template <> void TTreeX::createBranch<unsigned int        >(TString bn, bool writeToTree);
-    template <> void TTreeX::createBranch<std::vector<Int_t  >>(TString bn, bool writeToTree);
-    template <> void TTreeX::createBranch<std::vector<UInt_t >>(TString bn, bool writeToTree);
-    template <> void TTreeX::createBranch<std::vector<Bool_t >>(TString bn, bool writeToTree);
-    template <> void TTreeX::createBranch<std::vector<Float_t>>(TString bn, bool writeToTree);
-    template <> void TTreeX::createBranch<std::vector<TString>>(TString bn, bool writeToTree);
-    template <> void TTreeX::createBranch<std::vector<LV     >>(TString bn, bool writeToTree);
-    template <> void TTreeX::createBranch<std::vector<VInt   >>(TString bn, bool writeToTree);
-    template <> void TTreeX::createBranch<std::vector<VFloat >>(TString bn, bool writeToTree);
+    template <> BranchHandle<Int_t               > TTreeX::createBranch<Int_t               >(TString bn, bool writeToTree);
+    template <> BranchHandle<Bool_t              > TTreeX::createBranch<Bool_t              >(TString bn, bool writeToTree);
+    template <> BranchHandle<Float_t             > TTreeX::createBranch<Float_t             >(TString bn, bool writeToTree);
+    template <> BranchHandle<TString             > TTreeX::createBranch<TString             >(TString bn, bool writeToTree);
+    template <> BranchHandle<LV                  > TTreeX::createBranch<LV                  >(TString bn, bool writeToTree);
+    template <> BranchHandle<TBits               > TTreeX::createBranch<TBits               >(TString bn, bool writeToTree);
+    template <> BranchHandle<unsigned long long  > TTreeX::createBranch<unsigned long long  >(TString bn, bool writeToTree);
+    template <> BranchHandle<unsigned int        > TTreeX::createBranch<unsigned int        >(TString bn, bool writeToTree);
+    template <> BranchHandle<std::vector<Int_t  >> TTreeX::createBranch<std::vector<Int_t  >>(TString bn, bool writeToTree);
+    template <> BranchHandle<std::vector<UInt_t >> TTreeX::createBranch<std::vector<UInt_t >>(TString bn, bool writeToTree);
+    template <> BranchHandle<std::vector<Bool_t >> TTreeX::createBranch<std::vector<Bool_t >>(TString bn, bool writeToTree);
+    template <> BranchHandle<std::vector<Float_t>> TTreeX::createBranch<std::vector<Float_t>>(TString bn, bool writeToTree);
+    template <> BranchHandle<std::vector<TString>> TTreeX::createBranch<std::vector<TString>>(TString bn, bool writeToTree);
+    template <> BranchHandle<std::vector<LV     >> TTreeX::createBranch<std::vector<LV     >>(TString bn, bool writeToTree);
+    template <> BranchHandle<std::vector<VInt   >> TTreeX::createBranch<std::vector<VInt   >>(TString bn, bool writeToTree);
+    template <> BranchHandle<std::vector<VFloat >> TTreeX::createBranch<std::vector<VFloat >>(TString bn, bool writeToTree);
     // functors
-    template <> void TTreeX::createBranch<std::function<float()>>(TString bn, bool writeToTree); // writeToTree in this specification does not matter it will never write a std::function to TTree
+    template <> BranchHandle<std::function<float()>> TTreeX::createBranch<std::function<float()>>(TString bn, bool writeToTree); // writeToTree in this specification does not matter it will never write a std::function to TTree
 
     //_________________________________________________________________________________________________
     template <> bool TTreeX::hasBranch<Int_t               >(TString bn);
@@ -301,18 +584,95 @@ namespace RooUtil
     template <> void TTreeX::setBranch<std::map<TTREEXSTRING, std::vector<Int_t>>>(std::map<TTREEXSTRING, std::vector<Int_t>>& objidx);
     template <> void TTreeX::createBranch<std::map<TTREEXSTRING, std::vector<Int_t>>>(std::map<TTREEXSTRING, std::vector<Int_t>>& objidx);
 
+    //_________________________________________________________________________________________________
     template <class T>
-    std::vector<T> TTreeX::sortFromRef( std::vector<T> const& in, std::vector<std::pair<size_t, TTreeX::lviter> > const& reference)
+    void TTreeX::applySortPermutation(std::vector<T>& vec, TString bn)
     {
-        std::vector<T> ret(in.size());
+        if (vec.size() != sortperm.size())
+        {
+            error(TString::Format("branch bn = %s has %zu entries while the sorted p4 branch has %zu", bn.Data(), vec.size(), sortperm.size()), __FUNCTION__);
+            return;
+        }
+        permuteInPlace(vec, sortperm, sortvisited);
+    }
+
+}
+
+//_________________________________________________________________________________________________
+template <class T>
+void RooUtil::BranchHandle<T>::markSet()
+{
+    owner->markSet(slotid);
+}
+
+//_________________________________________________________________________________________________
+template <class T>
+void RooUtil::BranchHandle<T>::check() const
+{
+#ifndef NDEBUG
+    if (!val)
+        RooUtil::error("uninitialized branch handle", __FUNCTION__);
+    else if (!TTreeX::isAlive(owner))
+        RooUtil::error(TString::Format("TTreeX owning the branch %s no longer exists", TTreeX::getSlotName(owner, slotid).Data()), __FUNCTION__);
+#endif
+}
 
-        size_t const size = in.size();
-        for (size_t i = 0; i < size; ++i)
-            ret[i] = in[reference[i].first];
+//_________________________________________________________________________________________________
+template <class T>
+const T& RooUtil::BranchHandle<T>::get() const
+{
+    check();
+    owner->loadSlot(slotid);
+    return *val;
+}
 
-        return ret;
+//_________________________________________________________________________________________________
+template <class T>
+bool RooUtil::BranchHandle<T>::isSet() const
+{
+    check();
+    return owner->isBranchSetFlags[slotid];
+}
+
+//_________________________________________________________________________________________________
+template <class T>
+RooUtil::BranchHandle<T> RooUtil::TTreeX::makeHandle(TString bn, int i)
+{
+    BranchHandle<T> h;
+    if (i < 0)
+        return h;
+    SlotPool<T>& p = pool<T>();
+    h.val = &(p.values[i]);
+    h.owner = this;
+    h.slotid = p.slotids[i];
+    return h;
+}
+
+//_________________________________________________________________________________________________
+template <class T>
+RooUtil::BranchHandle<T> RooUtil::TTreeX::getHandle(TString bn)
+{
+    SlotPool<T>& p = pool<T>();
+    std::unordered_map<std::string, unsigned int>::const_iterator it = p.index.find(bn.Data());
+    if (it == p.index.end())
+    {
+        error(TString::Format("branch of the requested type doesn't exist bn = %s", bn.Data()), __FUNCTION__);
+        return BranchHandle<T>();
     }
+    return makeHandle<T>(bn, it->second);
+}
 
+//_________________________________________________________________________________________________
+template <class T>
+RooUtil::BranchHandle<T> RooUtil::TTreeX::readBranch(TString bn)
+{
+    if (!isreadmode)
+        error("TTreeX is not in reader mode, call setReadMode() first", __FUNCTION__);
+    getBranch<T>(bn, false); // binds the input branch to a slot on the first request
+    BranchHandle<T> h = getHandle<T>(bn);
+    if (slotreaders[h.slotid] < 0)
+        error(TString::Format("input tree has no branch bn = %s", bn.Data()), __FUNCTION__);
+    return h;
 }
 
 //_________________________________________________________________________________________________